@@ -23,6 +23,7 @@
 #include <unistd.h>
 #include "common.h"
 #include "script.h"
+#include "workload.h"
 
 struct rate_conversion {
         const char *prefix;
@@ -258,14 +259,54 @@ int do_connect(int s, const struct sockaddr *addr, socklen_t addr_len)
         }
 }
 
-ssize_t do_write(struct script_slave *ss, int sockfd, char *buf, size_t len,
-                 int flags)
+typedef ssize_t (*msg_hook_t)(struct script_slave *, int, struct msghdr *,
+                              int);
+typedef int (*batch_hook_t)(struct script_slave *, int, struct mmsghdr *,
+                            unsigned int, int);
+
+/* A script with only a batched hook gets one message at a time from it. */
+static ssize_t batch_of_one(struct script_slave *ss, int sockfd,
+                            struct msghdr *msg, int flags, batch_hook_t hook)
+{
+        struct mmsghdr mmsg = { .msg_hdr = *msg };
+        int n;
+
+        n = hook(ss, sockfd, &mmsg, 1, flags);
+        return n == 1 ? (ssize_t)mmsg.msg_len : n;
+}
+
+/* A script with only a per-message hook gets a batch one message at a time. */
+static int each_message(struct script_slave *ss, int sockfd,
+                        struct mmsghdr *msgvec, unsigned int vlen, int flags,
+                        msg_hook_t hook)
+{
+        unsigned int i;
+        ssize_t n = 0;
+
+        for (i = 0; i < vlen; i++) {
+                n = hook(ss, sockfd, &msgvec[i].msg_hdr, flags);
+                if (n < 0)
+                        break;
+                msgvec[i].msg_len = n;
+        }
+        return i > 0 ? (int)i : n;
+}
+
+ssize_t do_write(struct script_slave *ss, const struct socket_ops *ops,
+                 int sockfd, char *buf, size_t len, int flags)
 {
         struct iovec iov = { .iov_base = buf, .iov_len = len };
         struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
         ssize_t n;
 
+        /* No system calls to hook into on transports of their own */
+        if (ops && ops->write)
+                return ops->write(sockfd, buf, len);
+
         n = script_slave_sendmsg_hook(ss, sockfd, &msg, flags);
+        if (n == -EHOOKEMPTY)
+                n = batch_of_one(ss, sockfd, &msg, flags,
+                                 script_slave_sendmmsg_hook);
         if (n == -EHOOKEMPTY)
                 n = write(sockfd, buf, len);
         else if (n < 0)
@@ -274,8 +315,8 @@ ssize_t do_write(struct script_slave *ss, int sockfd, char *buf, size_t len,
         return n < 0 ? -1 : n;
 }
 
-ssize_t do_read(struct script_slave *ss, int sockfd, char *buf, size_t len,
-                int flags)
+ssize_t do_read(struct script_slave *ss, const struct socket_ops *ops,
+                int sockfd, char *buf, size_t len, int flags)
 {
         /* XXX: Make cmsg buffer size configurable through opts? */
         uint8_t cbuf[512];
@@ -292,7 +333,13 @@ ssize_t do_read(struct script_slave *ss, int sockfd, char *buf, size_t len,
                 .msg_controllen = ARRAY_SIZE(cbuf),
         };
 
+        if (ops && ops->read)
+                return ops->read(sockfd, buf, len);
+
         n = script_slave_recvmsg_hook(ss, sockfd, &msg, flags);
+        if (n == -EHOOKEMPTY)
+                n = batch_of_one(ss, sockfd, &msg, flags,
+                                 script_slave_recvmmsg_hook);
         if (n == -EHOOKEMPTY)
                 n = read(sockfd, buf, len);
         else if (n < 0)
@@ -329,6 +376,40 @@ ssize_t do_readerr(struct script_slave *ss, int sockfd, char *buf, size_t len,
         return n < 0 ? -1 : n;
 }
 
+int do_sendmmsg(struct script_slave *ss, int sockfd, struct mmsghdr *msgvec,
+                unsigned int vlen, int flags)
+{
+        int n;
+
+        n = script_slave_sendmmsg_hook(ss, sockfd, msgvec, vlen, flags);
+        if (n == -EHOOKEMPTY)
+                n = each_message(ss, sockfd, msgvec, vlen, flags,
+                                 script_slave_sendmsg_hook);
+        if (n == -EHOOKEMPTY)
+                n = sendmmsg(sockfd, msgvec, vlen, flags);
+        else if (n < 0)
+                errno = -n;
+
+        return n < 0 ? -1 : n;
+}
+
+int do_recvmmsg(struct script_slave *ss, int sockfd, struct mmsghdr *msgvec,
+                unsigned int vlen, int flags)
+{
+        int n;
+
+        n = script_slave_recvmmsg_hook(ss, sockfd, msgvec, vlen, flags);
+        if (n == -EHOOKEMPTY)
+                n = each_message(ss, sockfd, msgvec, vlen, flags,
+                                 script_slave_recvmsg_hook);
+        if (n == -EHOOKEMPTY)
+                n = recvmmsg(sockfd, msgvec, vlen, flags, NULL);
+        else if (n < 0)
+                errno = -n;
+
+        return n < 0 ? -1 : n;
+}
+
 struct addrinfo *copy_addrinfo(struct addrinfo *in)
 {
         struct addrinfo *out = calloc(1, sizeof(*in) + in->ai_addrlen);
@@ -45,6 +45,7 @@
 
 
 struct script_slave;
+struct socket_ops;
 
 struct byte_array {
         uint8_t *data;
@@ -111,12 +112,23 @@ int procfile_int(const char *path, struct callbacks *cb);
 void fill_random(char *buf, int size);
 int do_close(int fd);
 int do_connect(int s, const struct sockaddr *addr, socklen_t addr_len);
-ssize_t do_write(struct script_slave *ss, int sockfd, char *buf, size_t len,
-                 int flags);
-ssize_t do_read(struct script_slave *ss, int sockfd, char *buf, size_t len,
-                int flags);
+/* Send or receive through the transport's own operations if it has any, else
+ * through a script's hooks, else the system call.  @ops may be NULL.
+ */
+ssize_t do_write(struct script_slave *ss, const struct socket_ops *ops,
+                 int sockfd, char *buf, size_t len, int flags);
+ssize_t do_read(struct script_slave *ss, const struct socket_ops *ops,
+                int sockfd, char *buf, size_t len, int flags);
 ssize_t do_readerr(struct script_slave *ss, int sockfd, char *buf, size_t len,
                    int flags);
+/* Send or receive up to @vlen messages in one go, through a script's batched
+ * hook, else its per-message hook one message at a time, else the system
+ * call.  Returns the number of messages, or -1 with errno set.
+ */
+int do_sendmmsg(struct script_slave *ss, int sockfd, struct mmsghdr *msgvec,
+                unsigned int vlen, int flags);
+int do_recvmmsg(struct script_slave *ss, int sockfd, struct mmsghdr *msgvec,
+                unsigned int vlen, int flags);
 struct addrinfo *copy_addrinfo(struct addrinfo *in);
 void reset_port(struct addrinfo *ai, int port, struct callbacks *cb);
 int try_connect(const char *host, const char *port, struct addrinfo **ai,
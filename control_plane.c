@@ -16,13 +16,21 @@
 
 #include "control_plane.h"
 #include <assert.h>
+#include <endian.h>
+#include <math.h>
 #include <netinet/tcp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include "common.h"
 #include "hexdump.h"
 #include "lib.h"
 #include "logging.h"
+#include "percentiles.h"
 #include "script.h"
 
 static int recv_magic(int fd, struct callbacks *cb, const char *fn)
@@ -44,7 +52,7 @@ static void send_magic(int fd, int magic, struct callbacks *cb, const char *fn)
         int n;
 
         magic = htonl(magic);
-        while ((n = write(fd, &magic, sizeof(magic))) == -1) {
+        while ((n = send(fd, &magic, sizeof(magic), MSG_NOSIGNAL)) == -1) {
                 if (errno == EINTR || errno == EAGAIN)
                         continue;
                 PLOG_FATAL(cb, "%s: write", fn);
@@ -53,26 +61,223 @@ static void send_magic(int fd, int magic, struct callbacks *cb, const char *fn)
                 LOG_FATAL(cb, "%s: Incomplete write %d", fn, n);
 }
 
+/* Times go over the wire as nanoseconds of the sender's CLOCK_MONOTONIC. */
+static void send_time(int fd, const struct timespec *ts, struct callbacks *cb,
+                      const char *fn)
+{
+        uint64_t ns = htobe64(ts->tv_sec * 1000000000ULL + ts->tv_nsec);
+        int n;
+
+        while ((n = send(fd, &ns, sizeof(ns), MSG_NOSIGNAL)) == -1) {
+                if (errno == EINTR || errno == EAGAIN)
+                        continue;
+                PLOG_FATAL(cb, "%s: write", fn);
+        }
+        if (n != sizeof(ns))
+                LOG_FATAL(cb, "%s: Incomplete write %d", fn, n);
+}
+
+static void recv_time(int fd, struct timespec *ts, struct callbacks *cb,
+                      const char *fn)
+{
+        uint64_t ns;
+        int n;
+
+        while ((n = read(fd, &ns, sizeof(ns))) == -1) {
+                if (errno == EINTR || errno == EAGAIN)
+                        continue;
+                PLOG_FATAL(cb, "%s: read", fn);
+        }
+        if (n != sizeof(ns))
+                LOG_FATAL(cb, "%s: Incomplete read %d", fn, n);
+        ns = be64toh(ns);
+        ts->tv_sec = ns / 1000000000ULL;
+        ts->tv_nsec = ns % 1000000000ULL;
+}
+
 static const char control_port_secret[] = "neper control port secret";
 #define SECRET_SIZE (sizeof(control_port_secret))
 
+/* The client's hello is the secret and its test parameters, each terminated
+ * by a NUL.
+ */
+#define HELLO_MAX 1024
+
+#define HANDSHAKE_TIMEOUT 5.0   /* seconds for a client to send the secret */
+#define HEARTBEAT_PERIOD  1.0   /* seconds between heartbeats of a client */
+#define LIVENESS_TIMEOUT  (5 * HEARTBEAT_PERIOD)
+
+/* Clients send heartbeats while the test runs, and the magic number when it
+ * is over.  Servers that don't know about heartbeats only warn about them.
+ */
+#define HEARTBEAT(magic) (~(magic))
+
+/* Clients that ask for a synchronized start are told to go with CLOCK_SYNC
+ * instead of the magic number.  They then measure the offset of the server's
+ * clock with TIME_PING, and once their workers are set up send START_READY.
+ * The server answers both with a time on its clock, the latter with the time
+ * at which all clients start.
+ */
+#define CLOCK_SYNC(magic)  ((magic) + 1)
+#define TIME_PING(magic)   ((magic) + 2)
+#define START_READY(magic) ((magic) + 3)
+#define NUM_PINGS 8
+#define START_LEAD 0.1  /* seconds from the last client ready to the start */
+
+/* Authenticated clients beyond the number the test starts with are told so
+ * instead of the magic number, and the connection is closed.
+ */
+#define SERVER_BUSY(magic) ((magic) + 4)
+
+/* Options a --daemon server takes from its clients, test after test. */
+static const struct test_param {
+        const char *name;
+        size_t offset;
+        bool is_double;
+} test_params[] = {
+        { "num_threads",   offsetof(struct options, num_threads) },
+        { "num_flows",     offsetof(struct options, num_flows) },
+        { "num_clients",   offsetof(struct options, num_clients) },
+        { "test_length",   offsetof(struct options, test_length), true },
+        { "interval",      offsetof(struct options, interval), true },
+        { "buffer_size",   offsetof(struct options, buffer_size) },
+        { "request_size",  offsetof(struct options, request_size) },
+        { "response_size", offsetof(struct options, response_size) },
+};
+
+/* The client's test parameters as key=value lines. */
+static int format_test_params(const struct options *opts, char *buf,
+                              size_t size)
+{
+        const struct test_param *p;
+        const char *sep = "percentiles=";
+        const void *var;
+        FILE *f;
+        int i;
+
+        f = fmemopen(buf, size, "w");
+        if (!f)
+                return -1;
+        for (p = test_params; p < test_params + ARRAY_SIZE(test_params);
+             p++) {
+                var = (const char *)opts + p->offset;
+                if (p->is_double)
+                        fprintf(f, "%s=%.17g\n", p->name,
+                                *(const double *)var);
+                else
+                        fprintf(f, "%s=%d\n", p->name, *(const int *)var);
+        }
+        fprintf(f, "enable_read=%d\n", opts->enable_read);
+        fprintf(f, "enable_write=%d\n", opts->enable_write);
+        for (i = 0; i <= 100; i++) {
+                if (!opts->percentiles.chosen[i])
+                        continue;
+                fprintf(f, "%s%d", sep, i);
+                sep = ",";
+        }
+        if (*sep == ',')
+                fprintf(f, "\n");
+        fprintf(f, "clock_sync=1\n");
+        /* Fails if the parameters did not fit, fclose() would not */
+        if (fflush(f)) {
+                fclose(f);
+                return -1;
+        }
+        if (fclose(f))
+                return -1;
+        return strlen(buf);
+}
+
+/* Take the client's parameters over the server's options.  What the client
+ * reads the server writes and the other way around.
+ */
+static void apply_test_params(struct options *opts, char *params,
+                              struct callbacks *cb)
+{
+        const struct test_param *p;
+        char *line, *value, *saveptr;
+        void *var;
+        double v;
+
+        for (line = strtok_r(params, "\n", &saveptr); line;
+             line = strtok_r(NULL, "\n", &saveptr)) {
+                value = strchr(line, '=');
+                if (!value)
+                        continue;
+                *value++ = '\0';
+                if (!strcmp(line, "percentiles")) {
+                        memset(&opts->percentiles, 0,
+                               sizeof(opts->percentiles));
+                        parse_percentiles(value, &opts->percentiles, cb);
+                        continue;
+                }
+                v = strtod(value, NULL);
+                if (!strcmp(line, "enable_read")) {
+                        opts->enable_write = v;
+                        continue;
+                }
+                if (!strcmp(line, "enable_write")) {
+                        opts->enable_read = v;
+                        continue;
+                }
+                for (p = test_params;
+                     p < test_params + ARRAY_SIZE(test_params); p++) {
+                        if (strcmp(line, p->name))
+                                continue;
+                        if (!(v > 0)) {
+                                LOG_WARN(cb, "ignoring %s=%s from client",
+                                         line, value);
+                                break;
+                        }
+                        var = (char *)opts + p->offset;
+                        if (p->is_double)
+                                *(double *)var = v;
+                        else
+                                *(int *)var = v;
+                        break;
+                }
+        }
+}
+
 static int ctrl_connect(const char *host, const char *port,
                         struct addrinfo **ai, struct options *opts,
-                        struct callbacks *cb)
+                        bool *synced, struct callbacks *cb)
 {
-        int ctrl_conn, magic, optval = 1;
+        int ctrl_conn, magic, optval = 1, len;
+        char hello[HELLO_MAX];
+        ssize_t n;
+        char *p;
+
+        /* The secret with its terminating NUL, then the test parameters,
+         * which servers that don't know about them skip.
+         */
+        memcpy(hello, control_port_secret, SECRET_SIZE);
+        len = format_test_params(opts, hello + SECRET_SIZE,
+                                 sizeof(hello) - SECRET_SIZE);
+        if (len < 0)
+                LOG_FATAL(cb, "test parameters do not fit");
+        len += SECRET_SIZE + 1;
+
         ctrl_conn = try_connect(host, port, ai, opts, cb);
         if (setsockopt(ctrl_conn, IPPROTO_TCP, TCP_NODELAY, &optval,
                        sizeof(optval)))
                 PLOG_ERROR(cb, "setsockopt(TCP_NODELAY)");
-        while (write(ctrl_conn, control_port_secret, SECRET_SIZE) == -1) {
-                if (errno == EINTR)
-                        continue;
-                PLOG_FATAL(cb, "write");
+        for (p = hello; len > 0; p += n, len -= n) {
+                n = write(ctrl_conn, p, len);
+                if (n == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        PLOG_FATAL(cb, "write");
+                }
         }
-        /* if authentication passes, server should write back a magic number */
+        /* if authentication passes, server should write back a magic number,
+         * or CLOCK_SYNC if it knows how to synchronize the start
+         */
         magic = recv_magic(ctrl_conn, cb, __func__);
-        if (magic != opts->magic)
+        if (magic == SERVER_BUSY(opts->magic))
+                LOG_FATAL(cb, "server is busy with a test of other clients");
+        *synced = magic == CLOCK_SYNC(opts->magic);
+        if (magic != opts->magic && !*synced)
                 LOG_FATAL(cb, "magic mismatch: %d != %d", magic, opts->magic);
         return ctrl_conn;
 }
@@ -109,70 +314,131 @@ static int ctrl_listen(const char *host, const char *port,
         return fd_listen;
 }
 
-static int ctrl_accept(int ctrl_port, int *num_incidents, struct callbacks *cb,
-                       int magic)
+/* Sleep until an absolute CLOCK_MONOTONIC time. */
+static void sleep_until(const struct timespec *deadline, struct callbacks *cb)
 {
-        char buf[1024], dump[8192], host[NI_MAXHOST], port[NI_MAXSERV];
-        struct sockaddr_storage cli_addr;
-        socklen_t cli_len;
-        int ctrl_conn, s;
-        ssize_t len;
-retry:
-        cli_len = sizeof(cli_addr);
-        while ((ctrl_conn = accept(ctrl_port, (struct sockaddr *)&cli_addr,
-                                   &cli_len)) == -1) {
-                if (errno == EINTR || errno == ECONNABORTED)
+        struct itimerspec its = { .it_value = *deadline };
+        uint64_t expirations;
+        int fd;
+
+        fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (fd == -1)
+                PLOG_FATAL(cb, "timerfd_create");
+        if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL))
+                PLOG_FATAL(cb, "timerfd_settime");
+        while (read(fd, &expirations, sizeof(expirations)) == -1) {
+                if (errno == EINTR)
                         continue;
-                PLOG_FATAL(cb, "accept");
+                PLOG_FATAL(cb, "read timerfd");
         }
-        s = getnameinfo((struct sockaddr *)&cli_addr, cli_len,
-                        host, sizeof(host), port, sizeof(port),
-                        NI_NUMERICHOST | NI_NUMERICSERV);
-        if (s) {
-                LOG_ERROR(cb, "getnameinfo: %s", gai_strerror(s));
-                strcpy(host, "(unknown)");
-                strcpy(port, "(unknown)");
+        do_close(fd);
+}
+
+static void add_seconds(struct timespec *ts, double seconds)
+{
+        double int_part, frac_part;
+
+        frac_part = modf(seconds, &int_part);
+        ts->tv_sec += int_part;
+        ts->tv_nsec += frac_part * 1e9;
+        if (ts->tv_nsec >= 1000000000L) {
+                ts->tv_sec++;
+                ts->tv_nsec -= 1000000000L;
+        } else if (ts->tv_nsec < 0) {
+                ts->tv_sec--;
+                ts->tv_nsec += 1000000000L;
         }
-        memset(buf, 0, sizeof(buf));
-        while ((len = read(ctrl_conn, buf, sizeof(buf))) == -1) {
-                if (errno == EINTR)
-                        continue;
-                PLOG_ERROR(cb, "read");
-                do_close(ctrl_conn);
-                goto retry;
-        }
-        if (memcmp(buf, control_port_secret, SECRET_SIZE) != 0) {
-                if (num_incidents)
-                        (*num_incidents)++;
-                if (hexdump(buf, len, dump, sizeof(dump))) {
-                        LOG_WARN(cb, "Invalid secret from %s:%s\n%s", host,
-                                 port, dump);
-                } else
-                        LOG_WARN(cb, "Invalid secret from %s:%s", host, port);
-                do_close(ctrl_conn);
-                goto retry;
-        }
-        /* tell client that authentication passes */
-        send_magic(ctrl_conn, magic, cb, __func__);
-        LOG_INFO(cb, "Control connection established with %s:%s", host, port);
-        return ctrl_conn;
 }
 
-static void ctrl_wait_client(int ctrl_conn, int expect, struct callbacks *cb)
+/* Send a report to the peer, which may have gone already. */
+static void send_report(int ctrl_conn, const char *report, struct callbacks *cb)
 {
-        int magic;
+        size_t len = strlen(report);
+        ssize_t n;
 
-        while ((magic = recv_magic(ctrl_conn, cb, __func__)) != expect)
-                LOG_WARN(cb, "Unexpected magic %d", magic);
+        while (len > 0) {
+                n = send(ctrl_conn, report, len, MSG_NOSIGNAL);
+                if (n == -1) {
+                        if (errno == EINTR || errno == EAGAIN)
+                                continue;
+                        PLOG_ERROR(cb, "send report");
+                        return;
+                }
+                report += n;
+                len -= n;
+        }
 }
 
-static void ctrl_notify_server(int ctrl_conn, int magic, struct callbacks *cb)
+/* Read a report until the peer closes the connection.  Peers that don't send
+ * one leave the report empty.
+ */
+static char *recv_report(int ctrl_conn, struct callbacks *cb)
+{
+        size_t len = 0, size = 4096;
+        char *report, *p;
+        ssize_t n;
+
+        report = malloc(size);
+        if (!report)
+                PLOG_FATAL(cb, "malloc");
+        for (;;) {
+                if (len + 1 == size) {
+                        size *= 2;
+                        p = realloc(report, size);
+                        if (!p)
+                                PLOG_FATAL(cb, "realloc");
+                        report = p;
+                }
+                n = read(ctrl_conn, report + len, size - len - 1);
+                if (n == -1) {
+                        if (errno == EINTR || errno == EAGAIN)
+                                continue;
+                        PLOG_ERROR(cb, "read report");
+                        break;
+                }
+                if (n == 0)
+                        break;
+                len += n;
+        }
+        report[len] = '\0';
+        return report;
+}
+
+/* The client's report follows its notification. */
+static void ctrl_notify_server(int ctrl_conn, int magic, const char *report,
+                               struct callbacks *cb)
 {
         send_magic(ctrl_conn, magic, cb, __func__);
+        if (report)
+                send_report(ctrl_conn, report, cb);
         if (shutdown(ctrl_conn, SHUT_WR))
                 PLOG_ERROR(cb, "shutdown");
 }
 
+enum ctrl_state {
+        CTRL_HANDSHAKE,         /* connected, the secret has yet to come */
+        CTRL_READY,             /* authenticated, waiting for the others */
+        CTRL_RUNNING,           /* test started, heartbeats may come */
+        CTRL_REPORTING,         /* notified, the report follows until EOF */
+        CTRL_DONE,
+};
+
+/* Server side of a control connection. */
+struct ctrl_client {
+        int fd;
+        int index;              /* numbered when the test starts */
+        enum ctrl_state state;
+        bool heartbeats;        /* has sent some, so it can time out */
+        bool sync;              /* asked for a synchronized start */
+        bool armed;             /* its workers wait for the start time */
+        struct timespec last_heard;
+        char name[NI_MAXHOST + NI_MAXSERV + 1];
+        char *params;           /* test parameters sent with the secret */
+        char *buf;              /* partial hello or magic, then the report */
+        size_t len;
+        size_t size;
+};
+
 struct control_plane {
         struct options *opts;
         struct callbacks *cb;
@@ -180,6 +446,17 @@ struct control_plane {
         int num_incidents;
         int ctrl_conn;
         int ctrl_port;
+        int epfd;                       /* server: control connections */
+        struct ctrl_client **clients;   /* server: all of them */
+        int num_conns;
+        int num_ready;                  /* server: authenticated */
+        int num_done;                   /* server: finished or gone */
+        char **client_reports;          /* server: received from clients */
+        int num_reports;                /* server: room in client_reports */
+        char *remote_report;            /* client: received from the server */
+        bool synced;                    /* client: the start is synchronized */
+        double clock_offset;            /* client: server's clock minus ours */
+        struct timespec start_time;     /* when the workers start */
 };
 
 struct control_plane* control_plane_create(struct options *opts,
@@ -192,67 +469,636 @@ struct control_plane* control_plane_create(struct options *opts,
         cp->opts = opts;
         cp->cb = cb;
         cp->script_engine = se;
+        cp->ctrl_port = -1;
+        cp->epfd = -1;
 
         return cp;
 }
 
+static double timespec_seconds(const struct timespec *ts)
+{
+        return ts->tv_sec + ts->tv_nsec * 1e-9;
+}
+
+/* Estimate how far the server's clock is ahead of ours, from the ping with the
+ * shortest round trip, assuming it took as long each way.
+ */
+static void measure_clock_offset(struct control_plane *cp)
+{
+        struct timespec sent, received, server;
+        double rtt, min_rtt = INFINITY;
+        int i;
+
+        for (i = 0; i < NUM_PINGS; i++) {
+                clock_gettime(CLOCK_MONOTONIC, &sent);
+                send_magic(cp->ctrl_conn, TIME_PING(cp->opts->magic), cp->cb,
+                           __func__);
+                recv_time(cp->ctrl_conn, &server, cp->cb, __func__);
+                clock_gettime(CLOCK_MONOTONIC, &received);
+                rtt = seconds_between(&sent, &received);
+                if (rtt >= min_rtt)
+                        continue;
+                min_rtt = rtt;
+                cp->clock_offset = timespec_seconds(&server) -
+                                   timespec_seconds(&sent) - rtt / 2;
+        }
+        LOG_INFO(cp->cb, "clock offset %g s, round trip %g s",
+                 cp->clock_offset, min_rtt);
+}
+
 void control_plane_start(struct control_plane *cp, struct addrinfo **ai)
 {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
         if (cp->opts->client) {
                 cp->ctrl_conn = ctrl_connect(cp->opts->host,
                                              cp->opts->control_port, ai,
-                                             cp->opts, cp->cb);
+                                             cp->opts, &cp->synced, cp->cb);
                 LOG_INFO(cp->cb, "connected to control port");
+                if (cp->synced)
+                        measure_clock_offset(cp);
         } else {
                 cp->ctrl_port = ctrl_listen(NULL, cp->opts->control_port, ai,
                                             cp->opts, cp->cb);
+                set_nonblocking(cp->ctrl_port, cp->cb);
+                cp->epfd = epoll_create1(EPOLL_CLOEXEC);
+                if (cp->epfd == -1)
+                        PLOG_FATAL(cp->cb, "epoll_create1");
+                /* the listen socket is the only one without a client */
+                epoll_ctl_or_die(cp->epfd, EPOLL_CTL_ADD, cp->ctrl_port, &ev,
+                                 cp->cb);
                 LOG_INFO(cp->cb, "opened control port");
         }
 }
 
-void control_plane_wait_until_done(struct control_plane *cp)
+static double seconds_since(const struct timespec *ts)
 {
-        if (cp->opts->client) {
-                sleep(cp->opts->test_length);
-                LOG_INFO(cp->cb, "finished sleep");
-        } else {
-                const int n = cp->opts->num_clients;
-                int* client_fds = calloc(n, sizeof(int));
-                int i;
+        struct timespec now;
 
-                if (!client_fds)
-                        PLOG_FATAL(cp->cb, "calloc client_fds");
-                LOG_INFO(cp->cb, "expecting %d clients", n);
-                for (i = 0; i < n; i++) {
-                        client_fds[i] = ctrl_accept(cp->ctrl_port,
-                                                    &cp->num_incidents, cp->cb,
-                                                    cp->opts->magic);
-                        LOG_INFO(cp->cb, "client %d connected", i);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return seconds_between(ts, &now);
+}
+
+static void add_client(struct control_plane *cp, int fd,
+                       const struct sockaddr *addr, socklen_t addr_len)
+{
+        struct epoll_event ev = { .events = EPOLLIN };
+        char host[NI_MAXHOST], port[NI_MAXSERV];
+        struct ctrl_client *c, **clients;
+        int s;
+
+        s = getnameinfo(addr, addr_len, host, sizeof(host), port, sizeof(port),
+                        NI_NUMERICHOST | NI_NUMERICSERV);
+        if (s) {
+                LOG_ERROR(cp->cb, "getnameinfo: %s", gai_strerror(s));
+                strcpy(host, "(unknown)");
+                strcpy(port, "(unknown)");
+        }
+        c = calloc(1, sizeof(*c));
+        clients = realloc(cp->clients, (cp->num_conns + 1) * sizeof(c));
+        if (!c || !clients)
+                PLOG_FATAL(cp->cb, "alloc control connection");
+        cp->clients = clients;
+        cp->clients[cp->num_conns++] = c;
+        c->fd = fd;
+        c->index = -1;
+        c->state = CTRL_HANDSHAKE;
+        clock_gettime(CLOCK_MONOTONIC, &c->last_heard);
+        snprintf(c->name, sizeof(c->name), "%s:%s", host, port);
+        ev.data.ptr = c;
+        epoll_ctl_or_die(cp->epfd, EPOLL_CTL_ADD, fd, &ev, cp->cb);
+}
+
+/* Close the connection.  Clients of a running test keep their slot. */
+static void close_client(struct control_plane *cp, struct ctrl_client *c)
+{
+        if (c->fd == -1)
+                return;
+        do_close(c->fd);  /* leaves the epoll set as well */
+        c->fd = -1;
+        if (c->state == CTRL_RUNNING || c->state == CTRL_REPORTING) {
+                c->state = CTRL_DONE;
+                cp->num_done++;
+        }
+}
+
+static void drop_client(struct control_plane *cp, struct ctrl_client *c)
+{
+        int i;
+
+        close_client(cp, c);
+        if (c->state == CTRL_READY)
+                cp->num_ready--;
+        for (i = 0; i < cp->num_conns; i++) {
+                if (cp->clients[i] == c) {
+                        cp->clients[i] = cp->clients[--cp->num_conns];
+                        break;
                 }
-                do_close(cp->ctrl_port);  /* disallow further connections */
-                if (cp->opts->nonblocking) {
-                        for (i = 0; i < n; i++)
-                                set_nonblocking(client_fds[i], cp->cb);
+        }
+        free(c->params);
+        free(c->buf);
+        free(c);
+}
+
+static void accept_clients(struct control_plane *cp)
+{
+        struct sockaddr_storage addr;
+        socklen_t addr_len;
+        int fd;
+
+        for (;;) {
+                addr_len = sizeof(addr);
+                fd = accept4(cp->ctrl_port, (struct sockaddr *)&addr,
+                             &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd == -1) {
+                        if (errno == EINTR || errno == ECONNABORTED)
+                                continue;
+                        if (errno == EAGAIN || errno == EWOULDBLOCK)
+                                return;
+                        PLOG_FATAL(cp->cb, "accept");
+                }
+                add_client(cp, fd, (struct sockaddr *)&addr, addr_len);
+        }
+}
+
+static bool has_line(const char *text, const char *line)
+{
+        size_t len = strlen(line);
+        const char *p = text;
+
+        for (;;) {
+                if (!strncmp(p, line, len) &&
+                    (p[len] == '\n' || p[len] == '\0'))
+                        return true;
+                p = strchr(p, '\n');
+                if (!p)
+                        return false;
+                p++;
+        }
+}
+
+/* Buffer the secret and the test parameters until the NUL that ends them.
+ * They may come in several reads.  Older clients send the secret alone and
+ * wait for the magic number, so a secret with nothing after it once the
+ * socket is drained is a hello without parameters.
+ */
+static void handshake(struct control_plane *cp, struct ctrl_client *c)
+{
+        char dump[8192], *end = NULL;
+        ssize_t n;
+
+        if (!c->buf) {
+                c->buf = malloc(HELLO_MAX);
+                if (!c->buf)
+                        PLOG_FATAL(cp->cb, "malloc");
+                c->size = HELLO_MAX;
+        }
+        while (!end) {
+                n = read(c->fd, c->buf + c->len, c->size - c->len);
+                if (n == -1 && errno == EAGAIN && c->len == SECRET_SIZE) {
+                        end = c->buf + SECRET_SIZE - 1;
+                        break;
+                }
+                if (n == -1 && (errno == EINTR || errno == EAGAIN))
+                        return;
+                if (n <= 0) {
+                        if (n == -1)
+                                PLOG_ERROR(cp->cb, "read");
+                        drop_client(cp, c);
+                        return;
+                }
+                c->len += n;
+                if (memcmp(c->buf, control_port_secret,
+                           c->len < SECRET_SIZE ? c->len : SECRET_SIZE)) {
+                        cp->num_incidents++;
+                        if (hexdump(c->buf, c->len, dump, sizeof(dump))) {
+                                LOG_WARN(cp->cb, "Invalid secret from %s\n%s",
+                                         c->name, dump);
+                        } else
+                                LOG_WARN(cp->cb, "Invalid secret from %s",
+                                         c->name);
+                        drop_client(cp, c);
+                        return;
+                }
+                if (c->len > SECRET_SIZE)
+                        end = memchr(c->buf + SECRET_SIZE, '\0',
+                                     c->len - SECRET_SIZE);
+                if (!end && c->len == c->size) {
+                        LOG_WARN(cp->cb, "Hello from %s exceeds %d bytes",
+                                 c->name, HELLO_MAX);
+                        drop_client(cp, c);
+                        return;
+                }
+        }
+        c->params = strdup(end < c->buf + SECRET_SIZE ? "" :
+                           c->buf + SECRET_SIZE);
+        if (!c->params)
+                PLOG_FATAL(cp->cb, "strdup");
+        /* Anything after the hello is for parse_magics() */
+        c->len -= end + 1 - c->buf;
+        memmove(c->buf, end + 1, c->len);
+        c->sync = has_line(c->params, "clock_sync=1");
+        c->state = CTRL_READY;
+        cp->num_ready++;
+        LOG_INFO(cp->cb, "Control connection established with %s", c->name);
+}
+
+/* Consume the heartbeats, clock synchronization messages and the
+ * notification at the start of the buffer.
+ */
+static void parse_magics(struct control_plane *cp, struct ctrl_client *c)
+{
+        struct timespec now;
+        int magic;
+
+        while (c->state == CTRL_RUNNING && c->len >= sizeof(magic)) {
+                memcpy(&magic, c->buf, sizeof(magic));
+                magic = ntohl(magic);
+                c->len -= sizeof(magic);
+                memmove(c->buf, c->buf + sizeof(magic), c->len);
+                if (magic == cp->opts->magic) {
+                        c->state = CTRL_REPORTING;
+                        LOG_INFO(cp->cb, "received notification %d",
+                                 c->index);
+                } else if (magic == HEARTBEAT(cp->opts->magic)) {
+                        c->heartbeats = true;
+                } else if (magic == TIME_PING(cp->opts->magic)) {
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                        send_time(c->fd, &now, cp->cb, __func__);
+                } else if (magic == START_READY(cp->opts->magic)) {
+                        c->armed = true;
+                } else {
+                        LOG_WARN(cp->cb, "Unexpected magic %d", magic);
+                }
+        }
+}
+
+/* Read whatever the client sent: heartbeats, its notification and then its
+ * report, which ends when the client closes the connection.
+ */
+static void client_input(struct control_plane *cp, struct ctrl_client *c)
+{
+        ssize_t n;
+        char *p;
+
+        for (;;) {
+                if (c->len + 1 >= c->size) {
+                        c->size = c->size ? c->size * 2 : 4096;
+                        p = realloc(c->buf, c->size);
+                        if (!p)
+                                PLOG_FATAL(cp->cb, "realloc");
+                        c->buf = p;
+                }
+                n = read(c->fd, c->buf + c->len, c->size - c->len - 1);
+                if (n == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno == EAGAIN)
+                                break;
+                        PLOG_ERROR(cp->cb, "read from %s", c->name);
+                }
+                if (n <= 0 && c->state == CTRL_REPORTING) {
+                        /* keep the connection to send the server's report */
+                        c->buf[c->len] = '\0';
+                        cp->client_reports[c->index] = c->buf;
+                        c->buf = NULL;
+                        epoll_del_or_err(cp->epfd, c->fd, cp->cb);
+                        c->state = CTRL_DONE;
+                        cp->num_done++;
+                        return;
+                }
+                if (n <= 0) {
+                        LOG_WARN(cp->cb, "%s closed the control connection",
+                                 c->name);
+                        close_client(cp, c);
+                        return;
+                }
+                c->len += n;
+                clock_gettime(CLOCK_MONOTONIC, &c->last_heard);
+                parse_magics(cp, c);
+        }
+}
+
+static void client_event(struct control_plane *cp, struct ctrl_client *c)
+{
+        char buf[256];
+
+        switch (c->state) {
+        case CTRL_HANDSHAKE:
+                handshake(cp, c);
+                break;
+        case CTRL_READY:
+                /* nothing is expected before the start, but a goodbye */
+                if (read(c->fd, buf, sizeof(buf)) == 0) {
+                        LOG_WARN(cp->cb, "%s left before the test", c->name);
+                        drop_client(cp, c);
+                }
+                break;
+        case CTRL_RUNNING:
+        case CTRL_REPORTING:
+                client_input(cp, c);
+                break;
+        case CTRL_DONE:
+                break;
+        }
+}
+
+static void check_timeouts(struct control_plane *cp)
+{
+        struct ctrl_client *c;
+        int i;
+
+        for (i = cp->num_conns - 1; i >= 0; i--) {
+                c = cp->clients[i];
+                if (c->state == CTRL_HANDSHAKE &&
+                    seconds_since(&c->last_heard) > HANDSHAKE_TIMEOUT) {
+                        LOG_WARN(cp->cb, "No secret from %s", c->name);
+                        drop_client(cp, c);
+                } else if ((c->state == CTRL_RUNNING ||
+                            c->state == CTRL_REPORTING) && c->heartbeats &&
+                           seconds_since(&c->last_heard) > LIVENESS_TIMEOUT) {
+                        LOG_WARN(cp->cb, "client %d (%s) timed out", c->index,
+                                 c->name);
+                        close_client(cp, c);
+                }
+        }
+}
+
+/* Handle control connections until @done.  All clients are served at once,
+ * so a slow one holds up nobody but itself.
+ */
+static void serve_clients(struct control_plane *cp,
+                          bool (*done)(struct control_plane *))
+{
+        struct epoll_event events[64];
+        int i, n;
+
+        while (!done(cp)) {
+                n = epoll_wait(cp->epfd, events, ARRAY_SIZE(events), 100);
+                if (n == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        PLOG_FATAL(cp->cb, "epoll_wait");
                 }
-                LOG_INFO(cp->cb, "expecting %d notifications", n);
                 for (i = 0; i < n; i++) {
-                        ctrl_wait_client(client_fds[i], cp->opts->magic,
-                                         cp->cb);
-                        LOG_INFO(cp->cb, "received notification %d", i);
+                        if (events[i].data.ptr)
+                                client_event(cp, events[i].data.ptr);
+                        else
+                                accept_clients(cp);
+                }
+                check_timeouts(cp);
+        }
+}
+
+static bool any_ready(struct control_plane *cp)
+{
+        return cp->num_ready > 0;
+}
+
+static bool all_ready(struct control_plane *cp)
+{
+        return cp->num_ready >= cp->opts->num_clients;
+}
+
+static bool all_done(struct control_plane *cp)
+{
+        return cp->num_done >= cp->num_ready;
+}
+
+/* Every client still there has its workers set up. */
+static bool all_armed(struct control_plane *cp)
+{
+        int i;
+
+        for (i = 0; i < cp->num_conns; i++) {
+                if (cp->clients[i]->state == CTRL_RUNNING &&
+                    !cp->clients[i]->armed)
+                        return false;
+        }
+        return true;
+}
+
+static void free_client_reports(struct control_plane *cp)
+{
+        int i;
+
+        if (!cp->client_reports)
+                return;
+        for (i = 0; i < cp->num_reports; i++)
+                free(cp->client_reports[i]);
+        free(cp->client_reports);
+        cp->client_reports = NULL;
+        cp->num_reports = 0;
+}
+
+/* Wait for all the clients of a test to connect. */
+static void wait_for_clients(struct control_plane *cp)
+{
+        free_client_reports(cp);
+        cp->client_reports = calloc(cp->opts->num_clients, sizeof(char *));
+        if (!cp->client_reports)
+                PLOG_FATAL(cp->cb, "calloc client_reports");
+        cp->num_reports = cp->opts->num_clients;
+        LOG_INFO(cp->cb, "expecting %d clients", cp->opts->num_clients);
+        serve_clients(cp, all_ready);
+}
+
+/* Let all the clients go at once.  Connections still in the handshake, and
+ * any client beyond --num-clients, are turned away, the latter with
+ * SERVER_BUSY.
+ */
+static void start_clients(struct control_plane *cp)
+{
+        struct ctrl_client *c;
+        int i, index = 0;
+
+        /* disallow further connections, unless for the next test */
+        if (cp->opts->daemon) {
+                epoll_del_or_err(cp->epfd, cp->ctrl_port, cp->cb);
+        } else {
+                do_close(cp->ctrl_port);
+                cp->ctrl_port = -1;
+        }
+        /* the first to connect are the ones that go */
+        for (i = 0; i < cp->num_conns; i++) {
+                c = cp->clients[i];
+                if (c->state == CTRL_READY && index < cp->opts->num_clients)
+                        c->index = index++;
+        }
+        for (i = cp->num_conns - 1; i >= 0; i--) {
+                c = cp->clients[i];
+                if (c->index != -1)
+                        continue;
+                LOG_WARN(cp->cb, "turning away %s", c->name);
+                if (c->state == CTRL_READY)
+                        send_magic(c->fd, SERVER_BUSY(cp->opts->magic), cp->cb,
+                                   __func__);
+                drop_client(cp, c);
+        }
+        for (i = 0; i < cp->num_conns; i++) {
+                c = cp->clients[i];
+                c->state = CTRL_RUNNING;
+                c->armed = !c->sync;
+                clock_gettime(CLOCK_MONOTONIC, &c->last_heard);
+                send_magic(c->fd, c->sync ? CLOCK_SYNC(cp->opts->magic) :
+                           cp->opts->magic, cp->cb, __func__);
+        }
+        LOG_INFO(cp->cb, "started %d clients", cp->num_conns);
+}
+
+/* Once all clients are set up, tell those that asked for it when to start,
+ * far enough ahead for the time to reach them.
+ */
+static void synchronize_start(struct control_plane *cp)
+{
+        struct ctrl_client *c;
+        int i, n = 0;
+
+        serve_clients(cp, all_armed);
+        clock_gettime(CLOCK_MONOTONIC, &cp->start_time);
+        add_seconds(&cp->start_time, START_LEAD);
+        for (i = 0; i < cp->num_conns; i++) {
+                c = cp->clients[i];
+                if (c->sync && c->state == CTRL_RUNNING) {
+                        send_time(c->fd, &cp->start_time, cp->cb, __func__);
+                        n++;
                 }
-                for (i = 0; i < n; i++)
-                        do_close(client_fds[i]);
-                free(client_fds);
         }
+        if (n)
+                LOG_INFO(cp->cb, "sent the start time to %d clients", n);
+        else
+                clock_gettime(CLOCK_MONOTONIC, &cp->start_time);
 }
 
-void control_plane_stop(struct control_plane *cp)
+/* A --daemon server takes the test parameters, the number of clients among
+ * them, from the first client to authenticate.
+ */
+void control_plane_accept(struct control_plane *cp)
 {
+        struct ctrl_client *first = NULL;
+        int i;
+
+        serve_clients(cp, any_ready);
+        for (i = 0; i < cp->num_conns; i++) {
+                if (cp->clients[i]->state == CTRL_READY) {
+                        first = cp->clients[i];
+                        break;
+                }
+        }
+        if (!*first->params)
+                LOG_WARN(cp->cb, "client sent no test parameters");
+        apply_test_params(cp->opts, first->params, cp->cb);
+        wait_for_clients(cp);
+}
+
+/* Sleep until @deadline, telling the server every HEARTBEAT_PERIOD that the
+ * client is still alive.
+ */
+static void heartbeat_until(struct control_plane *cp,
+                            const struct timespec *deadline)
+{
+        struct timespec next;
+
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        for (;;) {
+                add_seconds(&next, HEARTBEAT_PERIOD);
+                if (seconds_between(&next, deadline) <= 0)
+                        break;
+                sleep_until(&next, cp->cb);
+                send_magic(cp->ctrl_conn, HEARTBEAT(cp->opts->magic), cp->cb,
+                           __func__);
+        }
+        sleep_until(deadline, cp->cb);
+}
+
+void control_plane_sync_start(struct control_plane *cp)
+{
+        struct timespec start;
+        double late;
+
+        if (!cp->opts->client)
+                return;
+        if (!cp->synced) {
+                clock_gettime(CLOCK_MONOTONIC, &cp->start_time);
+                return;
+        }
+        send_magic(cp->ctrl_conn, START_READY(cp->opts->magic), cp->cb,
+                   __func__);
+        recv_time(cp->ctrl_conn, &start, cp->cb, __func__);
+        add_seconds(&start, -cp->clock_offset);
+        cp->start_time = start;
+        late = seconds_since(&start);
+        if (late > 0)
+                LOG_WARN(cp->cb, "start time passed %g s ago", late);
+        sleep_until(&start, cp->cb);
+}
+
+bool control_plane_clock_offset(struct control_plane *cp, double *offset)
+{
+        *offset = cp->clock_offset;
+        return cp->synced;
+}
+
+void control_plane_wait_until_done(struct control_plane *cp,
+                                   struct timespec *window_start,
+                                   struct timespec *window_end)
+{
+        if (cp->opts->client) {
+                *window_start = cp->start_time;
+                *window_end = *window_start;
+                add_seconds(window_end, cp->opts->test_length);
+                heartbeat_until(cp, window_end);
+                LOG_INFO(cp->cb, "finished sleep");
+        } else {
+                if (!cp->num_ready)
+                        wait_for_clients(cp);
+                start_clients(cp);
+                synchronize_start(cp);
+                *window_start = cp->start_time;
+                LOG_INFO(cp->cb, "expecting %d notifications", cp->num_ready);
+                serve_clients(cp, all_done);
+                clock_gettime(CLOCK_MONOTONIC, window_end);
+        }
+}
+
+void control_plane_stop(struct control_plane *cp, const char *report)
+{
+        struct ctrl_client *c;
+
         if (cp->opts->client) {
-                ctrl_notify_server(cp->ctrl_conn, cp->opts->magic, cp->cb);
+                ctrl_notify_server(cp->ctrl_conn, cp->opts->magic, report,
+                                   cp->cb);
                 LOG_INFO(cp->cb, "notified server to exit");
+                cp->remote_report = recv_report(cp->ctrl_conn, cp->cb);
                 do_close(cp->ctrl_conn);
+                return;
+        }
+        while (cp->num_conns) {
+                c = cp->clients[0];
+                if (report && c->fd != -1)
+                        send_report(c->fd, report, cp->cb);
+                drop_client(cp, c);
         }
+        cp->num_ready = 0;
+        cp->num_done = 0;
+        if (cp->opts->daemon) {
+                struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+                epoll_ctl_or_die(cp->epfd, EPOLL_CTL_ADD, cp->ctrl_port, &ev,
+                                 cp->cb);
+        }
+}
+
+const char *control_plane_remote_report(struct control_plane *cp)
+{
+        return cp->remote_report ? cp->remote_report : "";
+}
+
+const char *control_plane_client_report(struct control_plane *cp, int i)
+{
+        if (!cp->client_reports || !cp->client_reports[i])
+                return "";
+        return cp->client_reports[i];
 }
 
 int control_plane_incidents(struct control_plane *cp)
@@ -262,5 +1108,12 @@ int control_plane_incidents(struct control_plane *cp)
 
 void control_plane_destroy(struct control_plane *cp)
 {
+        free_client_reports(cp);
+        free(cp->clients);
+        if (cp->ctrl_port != -1)
+                do_close(cp->ctrl_port);
+        if (cp->epfd != -1)
+                do_close(cp->epfd);
+        free(cp->remote_report);
         free(cp);
 }
@@ -17,18 +17,46 @@
 #ifndef NEPER_CONTROL_PLANE_H
 #define NEPER_CONTROL_PLANE_H
 
+#include <stdbool.h>
+
 struct addrinfo;
 struct callbacks;
 struct control_plane;
 struct options;
 struct script_engine;
+struct timespec;
 
 struct control_plane* control_plane_create(struct options *opts,
                                            struct callbacks *cb,
                                            struct script_engine *se);
 void control_plane_start(struct control_plane *cp, struct addrinfo **ai);
-void control_plane_wait_until_done(struct control_plane *cp);
-void control_plane_stop(struct control_plane *cp);
+/* Server: wait for the clients of the next test and take its parameters from
+ * them.  The clients start once control_plane_wait_until_done() is called.
+ */
+void control_plane_accept(struct control_plane *cp);
+/* Client: called once the workers are set up, returns at the time the server
+ * set for all clients to start, or right away if it can't.
+ */
+void control_plane_sync_start(struct control_plane *cp);
+/* Client: how far the server's clock is ahead of ours, in seconds, if the start
+ * was synchronized.
+ */
+bool control_plane_clock_offset(struct control_plane *cp, double *offset);
+/* Returns once the test is over.  The client runs for test_length seconds, the
+ * server until all clients are done.  Stamps the boundaries of the measurement
+ * window.
+ */
+void control_plane_wait_until_done(struct control_plane *cp,
+                                   struct timespec *window_start,
+                                   struct timespec *window_end);
+/* Reports are lists of key=value lines.  Each client sends its own along with
+ * its notification, the server sends its report to every client.
+ */
+void control_plane_stop(struct control_plane *cp, const char *report);
+/* What the client received from the server, or an empty string. */
+const char *control_plane_remote_report(struct control_plane *cp);
+/* What the server received from client @i, or an empty string. */
+const char *control_plane_client_report(struct control_plane *cp, int i);
 int control_plane_incidents(struct control_plane *cp);
 void control_plane_destroy(struct control_plane *cp);
 
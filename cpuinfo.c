@@ -14,57 +14,294 @@
  * limitations under the License.
  */
 
-#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "cpuinfo.h"
 
-static const char *ltrim(const char *str)
+#define SYSFS_CPU  "/sys/devices/system/cpu"
+#define SYSFS_NODE "/sys/devices/system/node"
+
+int parse_cpulist(const char *str, cpu_set_t *set)
 {
-        while (isspace(*str))
-                str++;
-        return str;
+        const char *p = str;
+        char *end;
+        long first, last;
+
+        CPU_ZERO(set);
+        while (*p && *p != '\n') {
+                first = strtol(p, &end, 10);
+                if (end == p || first < 0)
+                        goto invalid;
+                last = first;
+                p = end;
+                if (*p == '-') {
+                        p++;
+                        last = strtol(p, &end, 10);
+                        if (end == p || last < first)
+                                goto invalid;
+                        p = end;
+                }
+                if (last >= CPU_SETSIZE)
+                        goto invalid;
+                for (; first <= last; first++)
+                        CPU_SET(first, set);
+                if (*p == ',')
+                        p++;
+                else if (*p && *p != '\n')
+                        goto invalid;
+        }
+        return 0;
+invalid:
+        errno = EINVAL;
+        return -1;
 }
 
-static void rtrim(char *str)
+char *format_cpulist(const cpu_set_t *set, char *buf, int len)
 {
-        char *p = str + strlen(str) - 1;
-        while (p >= str && isspace(*p))
-                *p-- = 0;
+        int cpu, first, n = 0;
+
+        buf[0] = '\0';
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (!CPU_ISSET(cpu, set))
+                        continue;
+                first = cpu;
+                while (cpu + 1 < CPU_SETSIZE && CPU_ISSET(cpu + 1, set))
+                        cpu++;
+                if (n >= len)
+                        break;
+                if (first == cpu)
+                        n += snprintf(buf + n, len - n, "%s%d",
+                                      n ? "," : "", cpu);
+                else
+                        n += snprintf(buf + n, len - n, "%s%d-%d",
+                                      n ? "," : "", first, cpu);
+        }
+        return buf;
 }
 
-int get_cpuinfo(struct cpuinfo *cpus, int max_cpus)
+/* Read the first line of a sysfs attribute.  Returns -1 if it's missing. */
+static int read_attr(const char *path, char *buf, int len)
 {
         FILE *f;
-        int n = 0;
-        char *key, *value;
+        int r = 0;
 
-        f = fopen("/proc/cpuinfo", "r");
+        f = fopen(path, "r");
         if (!f)
                 return -1;
-        while (n < max_cpus) {
-                while (fscanf(f, "%m[^:]:%m[^\n]\n", &key, &value) == 2) {
-                        rtrim(key);
-                        if (strcmp(ltrim(key), "processor") == 0)
-                                sscanf(value, "%d", &cpus[n].processor);
-                        else if (strcmp(ltrim(key), "physical id") == 0)
-                                sscanf(value, "%d", &cpus[n].physical_id);
-                        else if (strcmp(ltrim(key), "siblings") == 0)
-                                sscanf(value, "%d", &cpus[n].siblings);
-                        else if (strcmp(ltrim(key), "core id") == 0)
-                                sscanf(value, "%d", &cpus[n].core_id);
-                        else if (strcmp(ltrim(key), "cpu cores") == 0)
-                                sscanf(value, "%d", &cpus[n].cpu_cores);
-                        free(key);
-                        free(value);
+        if (!fgets(buf, len, f))
+                r = -1;
+        fclose(f);
+        return r;
+}
+
+static int read_cpu_attr_int(int cpu, const char *attr, int *val)
+{
+        char path[128], buf[32];
+
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/%s", cpu,
+                 attr);
+        if (read_attr(path, buf, sizeof(buf)))
+                return -1;
+        *val = atoi(buf);
+        return 0;
+}
+
+static int read_cpu_attr_list(int cpu, const char *attr, cpu_set_t *set)
+{
+        char path[128], buf[4096];
+
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/%s", cpu,
+                 attr);
+        if (read_attr(path, buf, sizeof(buf)))
+                return -1;
+        return parse_cpulist(buf, set);
+}
+
+/* Fill in node_of[] for every CPU listed under /sys/devices/system/node.
+ * CPUs of machines without NUMA support stay on node 0.
+ */
+static void read_nodes(int *node_of)
+{
+        char path[300], buf[4096];
+        struct dirent *de;
+        cpu_set_t set;
+        DIR *dir;
+        int cpu, node;
+
+        dir = opendir(SYSFS_NODE);
+        if (!dir)
+                return;
+        while ((de = readdir(dir))) {
+                if (sscanf(de->d_name, "node%d", &node) != 1)
+                        continue;
+                snprintf(path, sizeof(path), SYSFS_NODE "/%s/cpulist",
+                         de->d_name);
+                if (read_attr(path, buf, sizeof(buf)) ||
+                    parse_cpulist(buf, &set))
+                        continue;
+                for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                        if (CPU_ISSET(cpu, &set))
+                                node_of[cpu] = node;
                 }
-                if (ferror(f))
-                        return -1;
-                if (feof(f))
-                        break;
+        }
+        closedir(dir);
+}
+
+int get_cpuinfo(struct cpuinfo *cpus, int max_cpus)
+{
+        char buf[4096];
+        cpu_set_t online, allowed, siblings;
+        int *node_of;
+        int cpu, i, n = 0;
+
+        if (read_attr(SYSFS_CPU "/online", buf, sizeof(buf)) ||
+            parse_cpulist(buf, &online))
+                return -1;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed))
+                return -1;
+        CPU_AND(&online, &online, &allowed);
+
+        node_of = calloc(CPU_SETSIZE, sizeof(*node_of));
+        if (!node_of)
+                return -1;
+        read_nodes(node_of);
+
+        for (cpu = 0; cpu < CPU_SETSIZE && n < max_cpus; cpu++) {
+                struct cpuinfo *c = &cpus[n];
+
+                if (!CPU_ISSET(cpu, &online))
+                        continue;
+                c->processor = cpu;
+                c->node = node_of[cpu];
+                if (read_cpu_attr_int(cpu, "physical_package_id",
+                                      &c->physical_id))
+                        c->physical_id = 0;
+                if (read_cpu_attr_int(cpu, "core_id", &c->core_id))
+                        c->core_id = cpu;
+                c->smt_index = 0;
+                if (!read_cpu_attr_list(cpu, "thread_siblings_list",
+                                        &siblings)) {
+                        for (i = 0; i < cpu; i++) {
+                                if (CPU_ISSET(i, &siblings))
+                                        c->smt_index++;
+                        }
+                }
+                n++;
+        }
+        free(node_of);
+        return n;
+}
+
+/* Does an IRQ action name, like "eth0-TxRx-3" or "virtio1-input.0", belong to
+ * the device called prefix?
+ */
+static int irq_name_matches(const char *name, const char *prefix)
+{
+        size_t len = strlen(prefix);
+
+        if (!len || strncmp(name, prefix, len))
+                return 0;
+        return strchr("-.@", name[len]) != NULL;
+}
+
+static void add_irq_affinity(int irq, cpu_set_t *set)
+{
+        char path[64], buf[4096];
+        cpu_set_t affinity;
+        int cpu;
+
+        snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+        if (read_attr(path, buf, sizeof(buf)) || parse_cpulist(buf, &affinity))
+                return;
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &affinity))
+                        CPU_SET(cpu, set);
+        }
+}
+
+int get_irq_cpus(const char *ifname, cpu_set_t *set)
+{
+        char path[PATH_MAX], dev[PATH_MAX], *devname = "";
+        char line[4096], *name;
+        int irq, n = 0;
+        FILE *f;
+
+        CPU_ZERO(set);
+        snprintf(path, sizeof(path), "/sys/class/net/%s", ifname);
+        if (access(path, F_OK))
+                return -1;
+        /* IRQs of virtio and some other devices are named after the device
+         * rather than the interface.
+         */
+        snprintf(path, sizeof(path), "/sys/class/net/%s/device", ifname);
+        if (realpath(path, dev))
+                devname = basename(dev);
+
+        f = fopen("/proc/interrupts", "r");
+        if (!f)
+                return -1;
+        while (fgets(line, sizeof(line), f)) {
+                if (sscanf(line, " %d:", &irq) != 1)
+                        continue;
+                line[strcspn(line, "\n")] = '\0';
+                name = strrchr(line, ' ');
+                if (!name)
+                        continue;
+                name++;
+                if (strcmp(name, ifname) && !irq_name_matches(name, ifname) &&
+                    !irq_name_matches(name, devname))
+                        continue;
+                add_irq_affinity(irq, set);
                 n++;
         }
         fclose(f);
         return n;
 }
+
+int get_softirq_counts(const char *name, unsigned long *counts)
+{
+        char line[16384], *p, *end;
+        int cpus[CPU_SETSIZE];
+        int i, num_cols = 0;
+        size_t len = strlen(name);
+        FILE *f;
+
+        memset(counts, 0, CPU_SETSIZE * sizeof(*counts));
+        f = fopen("/proc/softirqs", "r");
+        if (!f)
+                return -1;
+        /* The header names the CPU of each column: "CPU0 CPU1 ...". */
+        if (!fgets(line, sizeof(line), f))
+                goto fail;
+        for (p = line; (p = strstr(p, "CPU")) && num_cols < CPU_SETSIZE;
+             p = end)
+                cpus[num_cols++] = strtol(p + 3, &end, 10);
+
+        while (fgets(line, sizeof(line), f)) {
+                p = line + strspn(line, " ");
+                if (strncmp(p, name, len) || p[len] != ':')
+                        continue;
+                p += len + 1;
+                for (i = 0; i < num_cols; i++) {
+                        unsigned long count = strtoul(p, &end, 10);
+
+                        if (end == p)
+                                break;
+                        if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE)
+                                counts[cpus[i]] = count;
+                        p = end;
+                }
+                fclose(f);
+                return 0;
+        }
+        errno = ENOENT;
+fail:
+        fclose(f);
+        return -1;
+}
@@ -17,19 +17,42 @@
 #ifndef NEPER_CPUINFO_H
 #define NEPER_CPUINFO_H
 
+#include <sched.h>
+
 struct cpuinfo {
         int processor;
         int physical_id;
-        int siblings;
         int core_id;
-        int cpu_cores;
+        int node;       /* NUMA node, 0 if the kernel has no NUMA support */
+        int smt_index;  /* position among the SMT siblings of the core */
 };
 
-/* Parse /proc/cpuinfo to get CPU topology.  cpus is a user-provided buffer to
- * be filled in.  max_cpus is the maximum number of items that can be filled in
- * cpus.  On success, the number of items filled in is returned.  Otherwise, -1
- * is returned and errno is set.
+/* Read the topology of the CPUs we are allowed to run on from sysfs.  cpus is
+ * a user-provided buffer to be filled in, sorted by processor number.
+ * max_cpus is the maximum number of items that can be filled in cpus.  On
+ * success, the number of items filled in is returned.  Otherwise, -1 is
+ * returned and errno is set.
  */
 int get_cpuinfo(struct cpuinfo *cpus, int max_cpus);
 
+/* Parse a CPU list in the kernel's cpulist format (e.g. "0-3,8,10-11") into
+ * set.  Returns 0 on success, or -1 with errno set to EINVAL on syntax error.
+ */
+int parse_cpulist(const char *str, cpu_set_t *set);
+
+/* Format set in the cpulist format into buf of size len. */
+char *format_cpulist(const cpu_set_t *set, char *buf, int len);
+
+/* Find the CPUs that service interrupts of network interface ifname, by
+ * matching its IRQs in /proc/interrupts and reading their smp_affinity_list.
+ * Returns the number of IRQs found, or -1 with errno set.
+ */
+int get_irq_cpus(const char *ifname, cpu_set_t *set);
+
+/* Read per-CPU counts of softirq name (e.g. "NET_RX") from /proc/softirqs.
+ * counts must have room for CPU_SETSIZE items.  Returns 0 on success, or -1
+ * with errno set.
+ */
+int get_softirq_counts(const char *name, unsigned long *counts);
+
 #endif
@@ -125,8 +125,9 @@ static void client_events(struct thread *t, int epfd,
                         ssize_t to_write = flow->bytes_to_write;
                         int flags = 0;
 
-                        num_bytes = do_write(t->script_slave, flow->fd, buf,
-                                             to_write, flags);
+                        num_bytes = do_write(t->script_slave, t->ops,
+                                             flow->fd, buf, to_write,
+                                             flags);
                         if (num_bytes < 0) {
                                 PLOG_ERROR(cb, "write failed with %zd",
                                            num_bytes);
@@ -136,8 +137,9 @@ static void client_events(struct thread *t, int epfd,
                         ssize_t to_read = flow->bytes_to_read;
                         int flags = 0;
 
-                        num_bytes = do_read(t->script_slave, flow->fd, buf,
-                                            to_read, flags);
+                        num_bytes = do_read(t->script_slave, t->ops,
+                                            flow->fd, buf, to_read,
+                                            flags);
                         if (num_bytes < 0) {
                                 PLOG_ERROR(cb, "read failed with %zd",
                                            num_bytes);
@@ -178,8 +180,9 @@ static void server_events(struct thread *t, int epfd,
                         ssize_t to_write = flow->bytes_to_write;
                         int flags = 0;
 
-                        num_bytes = do_write(t->script_slave, flow->fd, buf,
-                                             to_write, flags);
+                        num_bytes = do_write(t->script_slave, t->ops,
+                                             flow->fd, buf, to_write,
+                                             flags);
                         if (num_bytes < 0) {
                                 PLOG_ERROR(cb, "write failed with %zd",
                                            num_bytes);
@@ -189,8 +192,9 @@ static void server_events(struct thread *t, int epfd,
                         ssize_t to_read = flow->bytes_to_read;
                         int flags = 0;
 
-                        num_bytes = do_read(t->script_slave, flow->fd, buf,
-                                            to_read, flags);
+                        num_bytes = do_read(t->script_slave, t->ops,
+                                            flow->fd, buf, to_read,
+                                            flags);
                         if (num_bytes < 0) {
                                 PLOG_ERROR(cb, "read failed with %zd",
                                            num_bytes);
@@ -24,8 +24,8 @@ extern int dummy_test(struct options *opts, struct callbacks *cb);
 
 static void check_options(struct options *opts, struct callbacks *cb)
 {
-        CHECK(cb, opts->test_length >= 1,
-              "Test length must be at least 1 second.");
+        CHECK(cb, opts->test_length >= 0.001,
+              "Test length must be at least 1 millisecond.");
         CHECK(cb, opts->maxevents >= 1,
               "Number of epoll events must be positive.");
         CHECK(cb, opts->num_flows >= 1,
@@ -57,7 +57,7 @@ int main(int argc, char **argv)
         DEFINE_FLAG(fp, int,          num_threads,   1,       'T', "Number of threads");
         DEFINE_FLAG(fp, int,          num_flows,     1,       'F', "Total number of flows");
         DEFINE_FLAG(fp, int,          num_clients,   1,        0,  "Number of clients");
-        DEFINE_FLAG(fp, int,          test_length,   1,       'l', "Test length in seconds");
+        DEFINE_FLAG(fp, double,       test_length,   1.0,     'l', "Test length in seconds");
         DEFINE_FLAG(fp, int,          listen_backlog, 128,     0,  "Backlog size for listen()");
         DEFINE_FLAG(fp, bool,         ipv4,          false,   '4', "Set desired address family to AF_INET");
         DEFINE_FLAG(fp, bool,         ipv6,          false,   '6', "Set desired address family to AF_INET6");
@@ -69,6 +69,9 @@ int main(int argc, char **argv)
         DEFINE_FLAG(fp, const char *, host,          NULL,    'H', "Server hostname or IP address");
         DEFINE_FLAG(fp, const char *, control_port,  "12866", 'C', "Server control port");
         DEFINE_FLAG(fp, const char *, port,          "12867", 'P', "Server data port");
+        DEFINE_FLAG(fp, const char *, pin_policy,    NULL,     0,  "Policy for --pin-cpu: core, compact, scatter, node or nosmt");
+        DEFINE_FLAG(fp, const char *, cpus,          NULL,     0,  "Pin threads to these CPUs, e.g. 2-9,18-25");
+        DEFINE_FLAG(fp, const char *, skip_irq_cpus, NULL,     0,  "Do not pin threads to CPUs servicing IRQs of this interface");
         flags_parser_run(fp, argc, argv);
 
         /* Hangle unchecked options */
@@ -1,14 +1,15 @@
 --
--- Demonstration of collecting per socket packet drop counts
--- statistics reported by the network stack.
+-- Demonstration of collecting packet drop count statistics reported
+-- by the network stack.
 --
 
-local stats = collect({
-    -- Received packets
-    recv_pkts = 0,
-    -- Dropped packets
-    drop_pkts = 0,
-})
+-- Received packets
+local recv_pkts = collect_counter()
+-- Dropped packets
+local drop_pkts = collect_counter()
+
+-- Last drop count reported for each socket. Keyed by socket FD.
+local sock_drop_pkts = {}
 
 server_socket(
   function (sockfd)
@@ -23,19 +24,21 @@ server_recvmsg(
     local n_recv, err = recvmsg(sockfd, msg, flags)
     assert(n_recv, tostring(err))
 
-    stats.recv_pkts = stats.recv_pkts + 1
+    recv_pkts:add(1)
 
     local _, cmsg = msg:cmsg_firsthdr()
     if cmsg then
       if cmsg.cmsg_level == SOL_SOCKET and cmsg.cmsg_type == SO_RXQ_OVFL then
+        -- The socket reports the number of packets dropped so far
         local n_drop = tonumber(uint32_ptr(cmsg.cmsg_data)[0])
 
         -- Uncomment to see packet drops being reported
-        -- if n_drop > drop_pkts then
+        -- if n_drop > (sock_drop_pkts[sockfd] or 0) then
         --   io.stderr:write('.')
         -- end
 
-        stats.drop_pkts = n_drop
+        drop_pkts:add(n_drop - (sock_drop_pkts[sockfd] or 0))
+        sock_drop_pkts[sockfd] = n_drop
       end
     end
 
@@ -48,21 +51,6 @@ run()
 print()
 print(string.format("%10s %12s %12s", "", "Received", "Dropped"))
 print(string.format("%10s %12s %12s", "", "(packets)", "(packets)"))
-
-local total = {
-  recv_pkts = 0,
-  drop_pkts = 0,
-}
-
-for i = 1, #stats do
-  print(string.format("%10s %12d %12d",
-                      string.format("Thread-%02d:", i),
-                      stats[i].recv_pkts, stats[i].drop_pkts))
-
-  total.recv_pkts = total.recv_pkts + stats[i].recv_pkts
-  total.drop_pkts = total.drop_pkts + stats[i].drop_pkts
-end
-
 print(string.format("%10s %12d %12d",
-                    "Total:", total.recv_pkts, total.drop_pkts))
+                    "Total:", recv_pkts:value(), drop_pkts:value()))
 print()
@@ -86,6 +86,9 @@ struct flags_parser* flags_parser_create(struct options *opts,
 
         /* Common flags */
         DEFINE_FLAG(fp, const char *, script, NULL, 0, "Lua script file to run with the workload");
+        DEFINE_FLAG(fp, const char *, plugin, NULL, 0, "Shared object with native hooks, see plugin.h");
+        DEFINE_FLAG(fp, bool, profile_hooks, false, 0, "Report call counts and durations of script hooks");
+        DEFINE_FLAG(fp, const char *, script_gc, NULL, 0, "Lua GC of hooks: auto[:pause[:stepmul]], step[:kbytes] or interval");
 
         return fp;
 }
@@ -34,6 +34,7 @@ struct flow *addflow_lite(int epfd, int fd, uint32_t events,
 
         flow = calloc(1, sizeof(struct flow));
         flow->fd = fd;
+        flow->events = events;
         ev.events = events;
         ev.data.ptr = flow;
         epoll_ctl_or_die(epfd, EPOLL_CTL_ADD, fd, &ev, cb);
@@ -52,9 +53,11 @@ struct flow *addflow(int tid, int epfd, int fd, int flow_id, uint32_t events,
         flow = calloc(1, sizeof(struct flow));
         flow->fd = fd;
         flow->id = flow_id;
+        flow->tid = tid;
         flow->latency = numlist_create(cb);
 
-        ev.events = EPOLLRDHUP | events;
+        flow->events = EPOLLRDHUP | events;
+        ev.events = flow->events;
         ev.data.ptr = flow;
         epoll_ctl_or_die(epfd, EPOLL_CTL_ADD, fd, &ev, cb);
 
@@ -62,6 +65,22 @@ struct flow *addflow(int tid, int epfd, int fd, int flow_id, uint32_t events,
         return flow;
 }
 
+/**
+ * Changes the events a flow is interested in.  The interest set is kept in
+ * the flow, so that it can be registered again in another epoll set.
+ */
+int modflow(int epfd, struct flow *flow, uint32_t events)
+{
+        struct epoll_event ev;
+
+        ev.events = events;
+        ev.data.ptr = flow;
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, flow->fd, &ev))
+                return -1;
+        flow->events = events;
+        return 0;
+}
+
 void delflow(int tid, int epfd, struct flow *flow, struct callbacks *cb)
 {
         interval_destroy(flow->itv);
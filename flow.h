@@ -28,6 +28,7 @@ struct options;
 struct flow {
         int fd;
         int id;
+        int tid;                /* thread the flow id belongs to */
         ssize_t bytes_read;
         ssize_t bytes_to_read;
         ssize_t bytes_to_write;
@@ -35,12 +36,18 @@ struct flow {
         struct timespec write_time;
         struct numlist *latency;
         struct interval *itv;
+        int step;               /* position in the script's sequence */
+        unsigned long loops;    /* of the sequence, on this connection */
+        struct timespec wake_time; /* end of a think step */
+        uint32_t events;        /* epoll interest set */
+        struct flow *next;      /* link when handed over to another thread */
 };
 
 struct flow *addflow_lite(int epfd, int fd, uint32_t events,
                           struct callbacks *cb);
 struct flow *addflow(int tid, int epfd, int fd, int flow_id, uint32_t events,
                      struct callbacks *cb);
+int modflow(int epfd, struct flow *flow, uint32_t events);
 void delflow(int tid, int epfd, struct flow *flow, struct callbacks *cb);
 
 #endif
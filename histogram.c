@@ -0,0 +1,255 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "histogram.h"
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SUB_BITS 7
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define HALF_BUCKETS (SUB_BUCKETS / 2)
+/* Values below SUB_BUCKETS get a bucket each, every higher power of two gets
+ * HALF_BUCKETS of them.
+ */
+#define NUM_BUCKETS ((64 - SUB_BITS + 2) * HALF_BUCKETS)
+
+struct histogram {
+        double resolution;
+        unsigned long count;
+        double sum;
+        double min;
+        double max;
+        unsigned long buckets[NUM_BUCKETS];
+};
+
+static int bucket_index(uint64_t v)
+{
+        int shift;
+
+        if (v < SUB_BUCKETS)
+                return v;
+        shift = 63 - __builtin_clzll(v) - SUB_BITS + 1;
+        return shift * HALF_BUCKETS + (v >> shift);
+}
+
+/* Lowest value of a bucket and its width. */
+static uint64_t bucket_start(int i, uint64_t *width)
+{
+        int shift;
+
+        if (i < SUB_BUCKETS) {
+                *width = 1;
+                return i;
+        }
+        shift = i / HALF_BUCKETS - 1;
+        *width = (uint64_t)1 << shift;
+        return (uint64_t)(i - shift * HALF_BUCKETS) << shift;
+}
+
+struct histogram *histogram_create(double resolution)
+{
+        struct histogram *h;
+
+        if (!(resolution > 0))
+                return NULL;
+        h = calloc(1, sizeof(*h));
+        if (!h)
+                return NULL;
+        h->resolution = resolution;
+        return h;
+}
+
+void histogram_destroy(struct histogram *h)
+{
+        free(h);
+}
+
+static uint64_t to_units(const struct histogram *h, double val)
+{
+        double units = val / h->resolution;
+
+        if (!(units > 0))
+                return 0;
+        if (units >= 0x1p64)
+                return UINT64_MAX;
+        return units;
+}
+
+void histogram_add(struct histogram *h, double val)
+{
+        h->buckets[bucket_index(to_units(h, val))]++;
+        if (!h->count || val < h->min)
+                h->min = val;
+        if (!h->count || val > h->max)
+                h->max = val;
+        h->sum += val;
+        h->count++;
+}
+
+void histogram_reset(struct histogram *h)
+{
+        double resolution = h->resolution;
+
+        memset(h, 0, sizeof(*h));
+        h->resolution = resolution;
+}
+
+int histogram_merge(struct histogram *dst, const struct histogram *src)
+{
+        int i;
+
+        if (dst->resolution != src->resolution)
+                return -EINVAL;
+        if (!src->count)
+                return 0;
+        for (i = 0; i < NUM_BUCKETS; i++)
+                dst->buckets[i] += src->buckets[i];
+        if (!dst->count || src->min < dst->min)
+                dst->min = src->min;
+        if (!dst->count || src->max > dst->max)
+                dst->max = src->max;
+        dst->sum += src->sum;
+        dst->count += src->count;
+        return 0;
+}
+
+double histogram_resolution(const struct histogram *h)
+{
+        return h->resolution;
+}
+
+unsigned long histogram_count(const struct histogram *h)
+{
+        return h->count;
+}
+
+double histogram_min(const struct histogram *h)
+{
+        return h->count ? h->min : NAN;
+}
+
+double histogram_max(const struct histogram *h)
+{
+        return h->count ? h->max : NAN;
+}
+
+double histogram_mean(const struct histogram *h)
+{
+        return h->count ? h->sum / h->count : NAN;
+}
+
+/* Picks the same rank as numlist_percentile(), then answers with the middle
+ * of the bucket it falls in.
+ */
+double histogram_percentile(const struct histogram *h, int percentile)
+{
+        unsigned long rank, seen = 0;
+        uint64_t start, width;
+        double val;
+        int i;
+
+        if (!h->count)
+                return NAN;
+        if (percentile <= 0)
+                return h->min;
+        if (percentile >= 100)
+                return h->max;
+        rank = (h->count - 1) * percentile / 100;
+        for (i = 0; i < NUM_BUCKETS; i++) {
+                seen += h->buckets[i];
+                if (seen > rank)
+                        break;
+        }
+        start = bucket_start(i, &width);
+        val = (start + (width - 1) / 2.0) * h->resolution;
+        if (val < h->min)
+                return h->min;
+        if (val > h->max)
+                return h->max;
+        return val;
+}
+
+unsigned long histogram_count_below(const struct histogram *h, double val)
+{
+        unsigned long count = 0;
+        int i, end;
+
+        end = bucket_index(to_units(h, val));
+        for (i = 0; i < end; i++)
+                count += h->buckets[i];
+        return count;
+}
+
+/* resolution,count,sum,min,max followed by index:count of non-empty buckets */
+char *histogram_format(const struct histogram *h)
+{
+        char *text = NULL;
+        size_t len;
+        FILE *f;
+        int i;
+
+        f = open_memstream(&text, &len);
+        if (!f)
+                return NULL;
+        fprintf(f, "%.17g,%lu,%.17g,%.17g,%.17g", h->resolution, h->count,
+                h->sum, h->min, h->max);
+        for (i = 0; i < NUM_BUCKETS; i++) {
+                if (h->buckets[i])
+                        fprintf(f, ",%d:%lu", i, h->buckets[i]);
+        }
+        if (fclose(f)) {
+                free(text);
+                return NULL;
+        }
+        return text;
+}
+
+struct histogram *histogram_parse(const char *text)
+{
+        unsigned long count, n, total = 0;
+        double resolution, sum, min, max;
+        struct histogram *h;
+        const char *p;
+        int i, len;
+
+        if (sscanf(text, "%lg,%lu,%lg,%lg,%lg%n", &resolution, &count, &sum,
+                   &min, &max, &len) != 5)
+                return NULL;
+        h = histogram_create(resolution);
+        if (!h)
+                return NULL;
+        h->count = count;
+        h->sum = sum;
+        h->min = min;
+        h->max = max;
+        for (p = text + len; *p == ','; p += len) {
+                if (sscanf(p, ",%d:%lu%n", &i, &n, &len) != 2 ||
+                    i < 0 || i >= NUM_BUCKETS)
+                        goto invalid;
+                h->buckets[i] += n;
+                total += n;
+        }
+        if (total != count)
+                goto invalid;
+        return h;
+invalid:
+        histogram_destroy(h);
+        return NULL;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEPER_HISTOGRAM_H
+#define NEPER_HISTOGRAM_H
+
+/*
+ * Log-linear histogram of non-negative numbers.  Each power of two is split
+ * into equal-width buckets, so values are kept with about 1.5% precision
+ * whatever their magnitude.  Histograms with the same resolution can be
+ * merged, which makes it possible to compute percentiles over the numbers
+ * recorded by several threads or processes.
+ */
+
+struct histogram;
+
+/* Values are recorded in multiples of @resolution, e.g. 1e-9 for seconds
+ * measured with nanosecond precision.
+ */
+struct histogram *histogram_create(double resolution);
+void histogram_destroy(struct histogram *h);
+
+void histogram_add(struct histogram *h, double val);
+/* Forgets all the numbers recorded so far. */
+void histogram_reset(struct histogram *h);
+/* Adds the numbers of @src to @dst.  Returns -EINVAL if their resolutions
+ * differ.
+ */
+int histogram_merge(struct histogram *dst, const struct histogram *src);
+
+double histogram_resolution(const struct histogram *h);
+unsigned long histogram_count(const struct histogram *h);
+double histogram_min(const struct histogram *h);
+double histogram_max(const struct histogram *h);
+double histogram_mean(const struct histogram *h);
+double histogram_percentile(const struct histogram *h, int percentile);
+/* Number of values in the buckets below the one @val falls in, which is
+ * exact for values that start a bucket, e.g. powers of two times resolution.
+ */
+unsigned long histogram_count_below(const struct histogram *h, double val);
+
+/* A single-line text form, to be freed by the caller, and back. */
+char *histogram_format(const struct histogram *h);
+struct histogram *histogram_parse(const char *text);
+
+#endif
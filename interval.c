@@ -22,6 +22,7 @@
 #include "common.h"
 #include "flow.h"
 #include "sample.h"
+#include "script.h"
 #include "thread.h"
 
 struct interval {
@@ -97,7 +98,9 @@ void interval_collect(struct flow *flow, struct thread *t)
         duration = seconds_between(&itv->last_time, &now);
         if (duration < itv->seconds)
                 return;
-        add_sample(t->index, flow, &now, &t->samples, t->cb);
+        add_sample(flow->tid, flow, &now, &t->samples, t->cb);
+        script_slave_interval_gc(t->script_slave);
+        script_slave_interval_hook(t->script_slave, t->samples);
         get_next_time(itv, duration);
 }
 
@@ -59,7 +59,7 @@ struct options {
         int num_flows;
         int num_threads;
         int num_clients;
-        int test_length;
+        double test_length;
         int buffer_size;
         int listen_backlog;
         int suicide_length;
@@ -73,6 +73,10 @@ struct options {
         bool reuseport;
         bool logtostderr;
         bool nonblocking;
+        bool rebalance;
+        bool low_latency;
+        bool daemon;
+        bool null_transport;
         double interval;
         long long max_pacing_rate;
         const char *local_host;
@@ -81,6 +85,12 @@ struct options {
         const char *port;
         const char *all_samples;
         const char *script;
+        const char *plugin;
+        const char *script_gc;
+        bool profile_hooks;
+        const char *pin_policy;
+        const char *cpus;
+        const char *skip_irq_cpus;
 
         /* tcp_stream, udp_stream */
         bool enable_read;
@@ -88,9 +98,13 @@ struct options {
         bool edge_trigger;
         unsigned long delay;
 
+        /* udp_stream */
+        int batch_size;
+
         /* tcp_rr */
         int request_size;
         int response_size;
+        const char *server_model;
         struct percentiles percentiles;
 };
 
@@ -0,0 +1,821 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "null_transport.h"
+#include <errno.h>
+#include <linux/futex.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "flow.h"
+#include "lib.h"
+#include "logging.h"
+#include "ring.h"
+#include "thread.h"
+#include "workload.h"
+
+/* Bytes in flight each way, like a socket buffer */
+#define NULL_RING_SIZE (256 * 1024)
+/* How long connect() waits for the server threads to listen */
+#define NULL_CONNECT_TIMEOUT_MS 5000
+/* Longest sleep on a futex before the kernel descriptors of an epoll set
+ * are looked at again, e.g. the eventfd that stops the workers
+ */
+#define NULL_SLEEP_NS (1000 * 1000)
+
+/* Direction of the data, also the side reading it */
+enum { TO_SERVER, TO_CLIENT };
+
+/*
+ * An epoll set sleeping in null_epoll_wait().  Whoever makes one of its
+ * sockets ready bumps @seq and wakes it up with a futex, if it is @sleeping.
+ */
+struct null_waiter {
+        int seq;
+        int sleeping;
+};
+
+/*
+ * Each side of a connection has one end of a socketpair, which carries no
+ * data.  A byte is left in each end for them to be always readable, so that
+ * epoll_wait() returns all the sockets of an epoll set and null_epoll_wait()
+ * tells which of them are ready from the rings.  Closing an end still tells
+ * the other side that this one has gone.
+ */
+struct null_conn {
+        struct byte_ring *ring[2];      /* by direction */
+        struct null_waiter *waiter[2];  /* of the reader, by direction */
+        int closed;                     /* by either side */
+        int server_fd;                  /* for accept() to hand out */
+        int refs;                       /* sides using the connection */
+        struct null_conn *next;         /* in a listener's backlog */
+};
+
+struct null_listener {
+        in_port_t port;
+        int peer_fd;                    /* keeps the listener readable */
+        struct null_waiter *waiter;     /* of accept() */
+        pthread_mutex_t lock;
+        struct null_conn *backlog;      /* oldest connection first */
+        struct null_conn **backlog_end;
+        struct null_listener *next;
+};
+
+struct null_sock {
+        int fd;
+        int peer_fd;                    /* other end, until connected */
+        in_port_t port;                 /* bound to */
+        struct null_conn *conn;
+        int dir;                        /* the direction we read */
+        struct null_listener *listener;
+};
+
+/*
+ * Sockets by file descriptor, and waiters by epoll set.  Changes are made
+ * with socks_lock held, while lookups are not locked: a thread only looks up
+ * the descriptors it has opened or been handed.
+ */
+static struct null_sock **socks;
+static struct null_waiter **waiters;
+static int max_socks;
+static pthread_mutex_t socks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct null_listener *listeners;
+static unsigned int next_listener;
+static pthread_mutex_t listeners_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct null_sock *find_sock(int fd)
+{
+        if (fd < 0 || fd >= max_socks)
+                return NULL;
+        return __atomic_load_n(&socks[fd], __ATOMIC_ACQUIRE);
+}
+
+static struct null_sock *get_sock(int fd)
+{
+        struct null_sock *s = find_sock(fd);
+
+        if (!s)
+                errno = ENOTSOCK;
+        return s;
+}
+
+/* Wakes up the epoll set of @slot if it is sleeping.  The caller has made a
+ * socket ready just before, and the fence pairs with the one in sleep_on():
+ * either it sees the socket ready or we see it sleeping.
+ */
+static void wake_up(struct null_waiter **slot)
+{
+        struct null_waiter *w;
+
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        w = __atomic_load_n(slot, __ATOMIC_RELAXED);
+        if (!w || !__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED))
+                return;
+        __atomic_add_fetch(&w->seq, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &w->seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* Makes the other end of @peer_fd readable for good, with a byte */
+static int fill(int peer_fd)
+{
+        return send(peer_fd, "", 1, MSG_DONTWAIT | MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+static void put_conn(struct null_conn *c)
+{
+        int i;
+
+        if (__atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL))
+                return;
+        for (i = 0; i < 2; i++)
+                byte_ring_destroy(c->ring[i]);
+        free(c);
+}
+
+/* Forget @s.  Its fd is closed unless @fd_reused, when it was closed with
+ * close() rather than through the socket operations, and now is another
+ * socket's.  Called with socks_lock held.
+ */
+static void free_sock(struct null_sock *s, bool fd_reused)
+{
+        if (!fd_reused) {
+                __atomic_store_n(&socks[s->fd], NULL, __ATOMIC_RELEASE);
+                do_close(s->fd);
+        }
+        if (s->peer_fd != -1)
+                do_close(s->peer_fd);
+        if (s->conn)
+                put_conn(s->conn);
+        free(s);
+}
+
+static struct null_sock *new_sock(int fd, int peer_fd)
+{
+        struct null_sock *s;
+
+        s = calloc(1, sizeof(*s));
+        if (!s) {
+                errno = ENOMEM;
+                return NULL;
+        }
+        s->fd = fd;
+        s->peer_fd = peer_fd;
+        return s;
+}
+
+/* Publishes @s, for the other operations to find it by its fd */
+static void publish_sock(struct null_sock *s)
+{
+        pthread_mutex_lock(&socks_lock);
+        if (socks[s->fd])
+                free_sock(socks[s->fd], true);
+        __atomic_store_n(&socks[s->fd], s, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&socks_lock);
+}
+
+static int null_open(const struct addrinfo *hints)
+{
+        struct null_sock *s;
+        int sv[2];
+
+        UNUSED(hints);
+
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv))
+                return -1;
+        if (sv[0] >= max_socks || sv[1] >= max_socks) {
+                errno = EMFILE;
+                goto fail;
+        }
+        if (fill(sv[1]) || fill(sv[0]))
+                goto fail;
+        s = new_sock(sv[0], sv[1]);
+        if (!s)
+                goto fail;
+        publish_sock(s);
+        return sv[0];
+fail:
+        do_close(sv[0]);
+        do_close(sv[1]);
+        return -1;
+}
+
+static in_port_t addr_port(const struct sockaddr *addr)
+{
+        if (addr->sa_family == AF_INET6)
+                return ((const struct sockaddr_in6 *)addr)->sin6_port;
+        return ((const struct sockaddr_in *)addr)->sin_port;
+}
+
+static int null_bind(int sockfd, const struct sockaddr *addr,
+                     socklen_t addrlen)
+{
+        struct null_sock *s = get_sock(sockfd);
+
+        UNUSED(addrlen);
+
+        if (!s)
+                return -1;
+        s->port = addr_port(addr);
+        return 0;
+}
+
+/* Listeners on the same port share its connections, as with SO_REUSEPORT */
+static int null_listen(int sockfd, int backlog)
+{
+        struct null_sock *s = get_sock(sockfd);
+        struct null_listener *l;
+
+        UNUSED(backlog);
+
+        if (!s)
+                return -1;
+        l = calloc(1, sizeof(*l));
+        if (!l) {
+                errno = ENOMEM;
+                return -1;
+        }
+        l->port = s->port;
+        l->peer_fd = s->peer_fd;
+        pthread_mutex_init(&l->lock, NULL);
+        l->backlog_end = &l->backlog;
+        s->peer_fd = -1;
+        s->listener = l;
+
+        pthread_mutex_lock(&listeners_lock);
+        l->next = listeners;
+        listeners = l;
+        pthread_mutex_unlock(&listeners_lock);
+        return 0;
+}
+
+static struct null_conn *create_conn(int server_fd)
+{
+        struct null_conn *c;
+
+        c = calloc(1, sizeof(*c));
+        if (!c)
+                return NULL;
+        c->ring[TO_SERVER] = byte_ring_create(NULL_RING_SIZE);
+        c->ring[TO_CLIENT] = byte_ring_create(NULL_RING_SIZE);
+        c->server_fd = server_fd;
+        c->refs = 2;
+        if (!c->ring[TO_SERVER] || !c->ring[TO_CLIENT]) {
+                c->refs = 1;
+                put_conn(c);
+                return NULL;
+        }
+        return c;
+}
+
+/* Picks the next of the listeners on @port, round-robin.  Called with
+ * listeners_lock held.
+ */
+static struct null_listener *find_listener(in_port_t port)
+{
+        struct null_listener *l;
+        unsigned int n = 0, i;
+
+        for (l = listeners; l; l = l->next)
+                n += l->port == port;
+        if (!n)
+                return NULL;
+        i = next_listener++ % n;
+        for (l = listeners; l; l = l->next) {
+                if (l->port == port && i-- == 0)
+                        break;
+        }
+        return l;
+}
+
+static int null_connect(int sockfd, const struct sockaddr *addr,
+                        socklen_t addrlen)
+{
+        const struct timespec pause = { .tv_nsec = 1000 * 1000 };
+        struct null_sock *s = get_sock(sockfd);
+        struct null_listener *l;
+        struct null_conn *c;
+        int ms;
+
+        UNUSED(addrlen);
+
+        if (!s)
+                return -1;
+        c = create_conn(s->peer_fd);
+        if (!c) {
+                errno = ENOMEM;
+                return -1;
+        }
+        /* The server threads may not be listening yet */
+        for (ms = 0; ; ms++) {
+                pthread_mutex_lock(&listeners_lock);
+                l = find_listener(addr_port(addr));
+                if (l)
+                        break;
+                pthread_mutex_unlock(&listeners_lock);
+                if (ms == NULL_CONNECT_TIMEOUT_MS) {
+                        c->refs = 1;
+                        put_conn(c);
+                        errno = ECONNREFUSED;
+                        return -1;
+                }
+                nanosleep(&pause, NULL);
+        }
+        s->peer_fd = -1;
+        s->conn = c;
+        s->dir = TO_CLIENT;
+
+        pthread_mutex_lock(&l->lock);
+        __atomic_store_n(l->backlog_end, c, __ATOMIC_RELAXED);
+        l->backlog_end = &c->next;
+        pthread_mutex_unlock(&l->lock);
+        wake_up(&l->waiter);
+        pthread_mutex_unlock(&listeners_lock);
+        return 0;
+}
+
+static int null_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
+{
+        struct null_sock *s = get_sock(sockfd), *a;
+        struct null_listener *l;
+        struct null_conn *c;
+
+        UNUSED(addr);
+
+        if (!s)
+                return -1;
+        l = s->listener;
+        if (!l) {
+                errno = EINVAL;
+                return -1;
+        }
+        pthread_mutex_lock(&l->lock);
+        c = l->backlog;
+        if (c) {
+                __atomic_store_n(&l->backlog, c->next, __ATOMIC_RELAXED);
+                if (!l->backlog)
+                        l->backlog_end = &l->backlog;
+        }
+        pthread_mutex_unlock(&l->lock);
+        if (!c) {
+                errno = EAGAIN;
+                return -1;
+        }
+        if (addrlen)
+                *addrlen = 0;
+        a = new_sock(c->server_fd, -1);
+        if (!a) {
+                do_close(c->server_fd);
+                put_conn(c);
+                return -1;
+        }
+        a->conn = c;
+        a->dir = TO_SERVER;
+        publish_sock(a);
+        return c->server_fd;
+}
+
+/* Drops a listener with its backlog, telling the clients in it to go away */
+static void close_listener(struct null_listener *l)
+{
+        struct null_listener **p;
+        struct null_conn *c;
+
+        pthread_mutex_lock(&listeners_lock);
+        for (p = &listeners; *p != l; p = &(*p)->next)
+                ;
+        *p = l->next;
+        pthread_mutex_unlock(&listeners_lock);
+
+        while ((c = l->backlog)) {
+                l->backlog = c->next;
+                __atomic_store_n(&c->closed, 1, __ATOMIC_RELEASE);
+                wake_up(&c->waiter[TO_CLIENT]);
+                do_close(c->server_fd);
+                put_conn(c);
+        }
+        do_close(l->peer_fd);
+        pthread_mutex_destroy(&l->lock);
+        free(l);
+}
+
+static int null_close(int sockfd)
+{
+        struct null_sock *s;
+
+        pthread_mutex_lock(&socks_lock);
+        s = find_sock(sockfd);
+        if (!s) {
+                pthread_mutex_unlock(&socks_lock);
+                return do_close(sockfd);
+        }
+        if (s->listener)
+                close_listener(s->listener);
+        if (s->conn) {
+                __atomic_store_n(&s->conn->closed, 1, __ATOMIC_RELEASE);
+                wake_up(&s->conn->waiter[!s->dir]);
+        }
+        free_sock(s, false);
+        pthread_mutex_unlock(&socks_lock);
+        return 0;
+}
+
+static ssize_t null_write(int sockfd, const void *buf, size_t len)
+{
+        struct null_sock *s = get_sock(sockfd);
+        struct null_conn *c;
+        int dir;
+        size_t n;
+
+        if (!s)
+                return -1;
+        c = s->conn;
+        if (!c) {
+                errno = ENOTCONN;
+                return -1;
+        }
+        dir = !s->dir;
+        n = byte_ring_write(c->ring[dir], buf, len);
+        if (!n) {
+                errno = EAGAIN;
+                return -1;
+        }
+        wake_up(&c->waiter[dir]);
+        return n;
+}
+
+static ssize_t null_read(int sockfd, void *buf, size_t len)
+{
+        struct null_sock *s = get_sock(sockfd);
+        struct null_conn *c;
+        size_t n;
+
+        if (!s)
+                return -1;
+        c = s->conn;
+        if (!c) {
+                errno = ENOTCONN;
+                return -1;
+        }
+        n = byte_ring_read(c->ring[s->dir], buf, len);
+        if (n) {
+                /* The writer may be waiting for room */
+                wake_up(&c->waiter[!s->dir]);
+                return n;
+        }
+        /* Whatever was written before closing is read first */
+        if (__atomic_load_n(&c->closed, __ATOMIC_ACQUIRE))
+                return byte_ring_read(c->ring[s->dir], buf, len);
+        errno = EAGAIN;
+        return -1;
+}
+
+/* Sets the waiter in @slot to @w, with the fence of wake_up() if it changes */
+static void set_waiter(struct null_waiter **slot, struct null_waiter *w)
+{
+        if (__atomic_load_n(slot, __ATOMIC_RELAXED) == w)
+                return;
+        __atomic_store_n(slot, w, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/* The events of null socket @s that are ready, out of @kernel, those epoll
+ * reported for its descriptor: EPOLLIN and EPOLLOUT as asked for, plus
+ * EPOLLRDHUP and EPOLLHUP once the other end is closed.
+ */
+static uint32_t ready_events(struct null_sock *s, struct null_waiter *w,
+                             uint32_t kernel)
+{
+        struct null_listener *l = s->listener;
+        struct null_conn *c = s->conn;
+        uint32_t ready = kernel & (EPOLLHUP | EPOLLERR);
+
+        if (l) {
+                set_waiter(&l->waiter, w);
+                if (__atomic_load_n(&l->backlog, __ATOMIC_RELAXED))
+                        ready |= EPOLLIN;
+                return ready & kernel;
+        }
+        if (!c)
+                return kernel;
+        set_waiter(&c->waiter[s->dir], w);
+        /* The other side was closed with close() rather than null_close() */
+        if (kernel & (EPOLLHUP | EPOLLRDHUP))
+                __atomic_store_n(&c->closed, 1, __ATOMIC_RELEASE);
+        if (__atomic_load_n(&c->closed, __ATOMIC_ACQUIRE))
+                ready |= EPOLLIN | EPOLLRDHUP | EPOLLOUT;
+        if (!byte_ring_empty(c->ring[s->dir]))
+                ready |= EPOLLIN;
+        if (!byte_ring_full(c->ring[!s->dir]))
+                ready |= EPOLLOUT;
+        return ready & kernel;
+}
+
+/* What poll_events() found besides the events it kept */
+enum {
+        SAW_NULL = 1,   /* sockets that epoll reports ready all the time */
+        SAW_FULL = 2,   /* as many events as asked for, maybe not all */
+};
+
+static int poll_events(int epfd, struct null_waiter *w,
+                       struct epoll_event *events, int maxevents, int timeout,
+                       unsigned int *saw);
+
+/* True if epoll set @epfd, itself in the set being polled, has events that
+ * are ready.  These are taken off it, so that one-shot ones are armed again.
+ */
+static bool nested_ready(int epfd, struct null_waiter *w)
+{
+        struct epoll_event events[64], ev;
+        unsigned int saw;
+        struct flow *flow;
+        int n, i;
+
+        n = poll_events(epfd, w, events, ARRAY_SIZE(events), 0, &saw);
+        for (i = 0; i < n; i++) {
+                flow = events[i].data.ptr;
+                if (flow && (flow->events & EPOLLONESHOT)) {
+                        ev.events = flow->events;
+                        ev.data.ptr = flow;
+                        epoll_ctl(epfd, EPOLL_CTL_MOD, flow->fd, &ev);
+                }
+        }
+        return n || (saw & SAW_FULL);
+}
+
+/* Waits up to @timeout ms for epoll set @epfd, keeping only the events of
+ * null sockets that are ready.  Returns how many events are left in @events,
+ * with what else was found in @saw.
+ */
+static int poll_events(int epfd, struct null_waiter *w,
+                       struct epoll_event *events, int maxevents, int timeout,
+                       unsigned int *saw)
+{
+        struct epoll_event ev;
+        struct null_sock *s;
+        struct flow *flow;
+        int n, i, kept = 0;
+
+        n = epoll_wait(epfd, events, maxevents, timeout);
+        if (n == -1)
+                return -1;
+        *saw = n == maxevents ? SAW_FULL : 0;
+        for (i = 0; i < n; i++) {
+                flow = events[i].data.ptr;
+                s = flow ? find_sock(flow->fd) : NULL;
+                if (s) {
+                        *saw |= SAW_NULL;
+                        events[i].events = ready_events(s, w,
+                                                        events[i].events);
+                } else if (flow && flow->fd < max_socks &&
+                           __atomic_load_n(&waiters[flow->fd],
+                                           __ATOMIC_ACQUIRE)) {
+                        /* An epoll set with null sockets is always ready */
+                        *saw |= SAW_NULL;
+                        if (!nested_ready(flow->fd, w))
+                                events[i].events = 0;
+                }
+                if (!events[i].events || (flow->events & EPOLLET)) {
+                        /* Queued again, as epoll would not do it itself */
+                        if (flow->events & (EPOLLONESHOT | EPOLLET)) {
+                                ev.events = flow->events;
+                                ev.data.ptr = flow;
+                                epoll_ctl(epfd, EPOLL_CTL_MOD, flow->fd, &ev);
+                        }
+                        if (!events[i].events)
+                                continue;
+                }
+                events[kept++] = events[i];
+        }
+        return kept;
+}
+
+static struct null_waiter *get_waiter(int epfd)
+{
+        struct null_waiter *w;
+
+        if (epfd < 0 || epfd >= max_socks) {
+                errno = EBADF;
+                return NULL;
+        }
+        w = __atomic_load_n(&waiters[epfd], __ATOMIC_ACQUIRE);
+        if (w)
+                return w;
+        pthread_mutex_lock(&socks_lock);
+        w = waiters[epfd];
+        if (!w) {
+                w = calloc(1, sizeof(*w));
+                __atomic_store_n(&waiters[epfd], w, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&socks_lock);
+        if (!w)
+                errno = ENOMEM;
+        return w;
+}
+
+static long long now_ns(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Sleeps on the futex of @w until one of the null sockets of @epfd is made
+ * ready, or for at most @ns.  Polls once more after saying so, for whoever
+ * made one ready meanwhile.
+ */
+static int sleep_on(int epfd, struct null_waiter *w,
+                    struct epoll_event *events, int maxevents, long long ns)
+{
+        struct timespec ts = { .tv_nsec = ns };
+        unsigned int saw;
+        int n, seq;
+
+        seq = __atomic_load_n(&w->seq, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&w->sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        n = poll_events(epfd, w, events, maxevents, 0, &saw);
+        if (!n && ns > 0)
+                syscall(SYS_futex, &w->seq, FUTEX_WAIT_PRIVATE, seq, &ts,
+                        NULL, 0);
+        __atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+        return n;
+}
+
+/*
+ * Epoll reports null sockets ready all the time, for they are readable, and
+ * tells which of them are.  While any is in the set, the thread waits on the
+ * futex of the set's waiter for a null socket to be made ready, looking at
+ * the other descriptors of the set every NULL_SLEEP_NS.  Else it sleeps in
+ * epoll_wait(), which returns as soon as a null socket is armed in the set.
+ */
+static int null_epoll_wait(int epfd, struct epoll_event *events,
+                           int maxevents, int timeout)
+{
+        struct null_waiter *w = get_waiter(epfd);
+        long long deadline = 0, left = NULL_SLEEP_NS;
+        unsigned int saw;
+        int n, yielded = 0;
+
+        if (!w)
+                return -1;
+        if (timeout > 0)
+                deadline = now_ns() + timeout * 1000000LL;
+        for (;;) {
+                n = poll_events(epfd, w, events, maxevents, 0, &saw);
+                if (n || !timeout)
+                        return n;
+                if (timeout > 0) {
+                        left = deadline - now_ns();
+                        if (left <= 0)
+                                return 0;
+                }
+                if (saw & SAW_FULL || (saw & SAW_NULL && !yielded++)) {
+                        /* Not all sockets were looked at, or the peer may
+                         * be about to run on this CPU
+                         */
+                        sched_yield();
+                        continue;
+                }
+                if (saw & SAW_NULL) {
+                        n = sleep_on(epfd, w, events, maxevents,
+                                     left < NULL_SLEEP_NS ?
+                                     left : NULL_SLEEP_NS);
+                } else {
+                        n = poll_events(epfd, w, events, maxevents,
+                                        timeout > 0 ?
+                                        (left + 999999) / 1000000 : -1,
+                                        &saw);
+                }
+                if (n)
+                        return n;
+        }
+}
+
+const struct socket_ops null_socket_ops = {
+        .open = null_open,
+        .bind = null_bind,
+        .listen = null_listen,
+        .accept = null_accept,
+        .connect = null_connect,
+        .close = null_close,
+        .read = null_read,
+        .write = null_write,
+        .epoll_wait = null_epoll_wait,
+};
+
+struct server_side {
+        struct options opts;
+        struct callbacks cb;
+        void *(*thread_func)(void *);
+        void (*report_stats)(struct thread *);
+        int exit_code;
+};
+
+static void print_server(void *logger, const char *key, const char *value_fmt,
+                         ...)
+{
+        va_list argp;
+
+        fprintf(logger, "server_%s=", key);
+        va_start(argp, value_fmt);
+        vfprintf(logger, value_fmt, argp);
+        va_end(argp);
+        fputc('\n', logger);
+}
+
+static void *run_server_side(void *arg)
+{
+        struct server_side *s = arg;
+
+        s->exit_code = run_main_thread(&s->opts, &s->cb, s->thread_func,
+                                       s->report_stats);
+        return NULL;
+}
+
+int run_null_transport(struct options *opts, struct callbacks *cb,
+                       void *(*thread_func)(void *),
+                       void (*report_stats)(struct thread *))
+{
+        struct server_side server = {
+                .opts = *opts,
+                .cb = *cb,
+                .thread_func = thread_func,
+                .report_stats = report_stats,
+        };
+        CLEANUP(free) char *output = NULL;
+        size_t output_len;
+        struct rlimit rl;
+        pthread_t id;
+        FILE *out;
+        int r, i, exit_code;
+
+        if (getrlimit(RLIMIT_NOFILE, &rl))
+                PLOG_FATAL(cb, "getrlimit");
+        max_socks = rl.rlim_cur;
+        socks = calloc(max_socks, sizeof(*socks));
+        waiters = calloc(max_socks, sizeof(*waiters));
+        if (!socks || !waiters)
+                PLOG_FATAL(cb, "calloc socks");
+
+        out = open_memstream(&output, &output_len);
+        if (!out)
+                PLOG_FATAL(cb, "open_memstream");
+        server.cb.logger = out;
+        server.cb.print = print_server;
+        server.opts.client = false;
+        /* The server reads what the client writes, and the other way round */
+        server.opts.enable_read = opts->enable_write;
+        server.opts.enable_write = opts->enable_read;
+        server.opts.host = NULL;
+        server.opts.all_samples = NULL;
+        /* Not for AF_UNIX sockets, and listeners share connections anyway */
+        server.opts.reuseport = false;
+
+        if (!opts->host)
+                opts->host = "localhost";
+
+        r = pthread_create(&id, NULL, run_server_side, &server);
+        if (r)
+                LOG_FATAL(cb, "pthread_create: %s", strerror(r));
+        exit_code = run_main_thread(opts, cb, thread_func, report_stats);
+        r = pthread_join(id, NULL);
+        if (r)
+                LOG_FATAL(cb, "pthread_join: %s", strerror(r));
+
+        fclose(out);
+        fputs(output, stdout);
+        fflush(stdout);
+        for (i = 0; i < max_socks; i++)
+                free(waiters[i]);
+        free(waiters);
+        waiters = NULL;
+        free(socks);
+        socks = NULL;
+        return exit_code ? exit_code : server.exit_code;
+}
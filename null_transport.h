@@ -0,0 +1,42 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEPER_NULL_TRANSPORT_H
+#define NEPER_NULL_TRANSPORT_H
+
+/*
+ * In-memory transport, to measure the overhead of the tool itself.
+ *
+ * Client and server run in one process, and a connection is a pair of
+ * lock-free byte rings between a client thread and a server thread, see
+ * null_socket_ops.  A thread waiting in epoll for its idle connections
+ * sleeps on a futex, which whoever makes one of them ready wakes up.
+ */
+
+struct callbacks;
+struct options;
+struct thread;
+
+/* Runs the client side of the workload described by @opts in the calling
+ * thread and its server side in a thread of its own, over null_socket_ops.
+ * The server's results are printed after the client's, with keys prefixed by
+ * "server_".
+ */
+int run_null_transport(struct options *opts, struct callbacks *cb,
+                       void *(*thread_func)(void *),
+                       void (*report_stats)(struct thread *));
+
+#endif
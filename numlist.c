@@ -187,3 +187,13 @@ double numlist_percentile(struct numlist *lst, int percentile)
         free(values);
         return result;
 }
+
+void numlist_for_each(struct numlist *lst, void (*fn)(double val, void *arg),
+                      void *arg)
+{
+        struct memblock *blk;
+        double *n;
+
+        for_each(n, blk, lst)
+                fn(*n, arg);
+}
@@ -36,5 +36,8 @@ double numlist_max(struct numlist *lst);
 double numlist_mean(struct numlist *lst);
 double numlist_stddev(struct numlist *lst);
 double numlist_percentile(struct numlist *lst, int percentile);
+/* Calls @fn on each number of @lst. */
+void numlist_for_each(struct numlist *lst, void (*fn)(double val, void *arg),
+                      void *arg);
 
 #endif
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEPER_PLUGIN_H
+#define NEPER_PLUGIN_H
+
+/*
+ * Interface of plugins passed with --plugin.  A plugin is a shared object
+ * exporting hook functions under the names of the script API calls that
+ * register them, e.g. client_sendmsg() or server_recvmmsg().  They are called
+ * directly from the client/server threads, without entering Lua, and follow
+ * the same return convention as script hooks.
+ *
+ * Each hook gets the context plugin_thread_init() returned for the calling
+ * thread.  All the other functions below are optional as well.
+ */
+
+#include <sys/types.h>
+
+struct addrinfo;
+struct mmsghdr;
+struct msghdr;
+struct sample;
+
+typedef int (*plugin_socket_hook_t)(void *ctx, int sockfd,
+                                    struct addrinfo *ai);
+typedef ssize_t (*plugin_packet_hook_t)(void *ctx, int sockfd,
+                                        struct msghdr *msg, int flags);
+typedef int (*plugin_batch_hook_t)(void *ctx, int sockfd,
+                                   struct mmsghdr *msgvec, unsigned int vlen,
+                                   int flags);
+typedef int (*plugin_transaction_hook_t)(void *ctx, int flow_id,
+                                         double latency);
+typedef int (*plugin_interval_hook_t)(void *ctx, const struct sample *sample);
+
+/* Called from the main thread once per client/server thread, by index. */
+typedef void *(*plugin_thread_init_t)(int index);
+/* Called from the main thread for each thread after each test run. */
+typedef void (*plugin_thread_collect_t)(void *ctx);
+/* Called from the main thread after the results of each test are printed. */
+typedef void (*plugin_report_t)(void (*print)(void *logger, const char *key,
+                                              const char *value, ...),
+                                void *logger);
+/* Called from the main thread when the client/server thread is torn down. */
+typedef void (*plugin_thread_fini_t)(void *ctx);
+
+#endif
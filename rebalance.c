@@ -0,0 +1,317 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rebalance.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include "common.h"
+#include "flow.h"
+#include "lib.h"
+#include "logging.h"
+#include "sample.h"
+#include "thread.h"
+
+#define REBALANCE_PERIOD    0.1 /* seconds between decisions */
+#define REBALANCE_THRESHOLD 0.2 /* utilization gap that triggers migration */
+
+struct rebalance {
+        struct rebalance_group *group;
+        int index;
+        int epfd;
+
+        pthread_mutex_t inbox_lock;
+        struct flow *inbox;             /* flows handed over to us */
+        int inbox_efd;                  /* signaled when a flow arrives */
+        struct flow *inbox_fl;
+
+        struct timespec time_start;
+        struct timespec time_stop;
+        struct timespec period_start;
+        struct timespec busy_start;
+        double busy;                    /* seconds busy in this period */
+        double busy_total;
+        struct flow *active;            /* a flow with events this period */
+        bool many_active;               /* more than one flow had events */
+        int shed_to;                    /* thread to migrate a flow to */
+
+        /* Read by other threads. */
+        double utilization;             /* in the last period */
+        double updated;                 /* when utilization was updated */
+
+        unsigned long migrations_in;
+        unsigned long migrations_out;
+};
+
+struct rebalance_group {
+        int num_threads;
+        pthread_barrier_t stopped;
+        struct rebalance threads[];
+};
+
+struct rebalance_group *rebalance_group_create(int num_threads,
+                                               struct callbacks *cb)
+{
+        struct rebalance_group *g;
+        struct rebalance *rb;
+        int i, s;
+
+        g = calloc(1, sizeof(*g) + num_threads * sizeof(g->threads[0]));
+        if (!g)
+                PLOG_FATAL(cb, "calloc rebalance group");
+        g->num_threads = num_threads;
+        s = pthread_barrier_init(&g->stopped, NULL, num_threads);
+        if (s != 0)
+                LOG_FATAL(cb, "pthread_barrier_init: %s", strerror(s));
+
+        for (i = 0; i < num_threads; i++) {
+                rb = &g->threads[i];
+                rb->group = g;
+                rb->index = i;
+                rb->shed_to = -1;
+                pthread_mutex_init(&rb->inbox_lock, NULL);
+                rb->inbox_efd = eventfd(0, EFD_NONBLOCK);
+                if (rb->inbox_efd == -1)
+                        PLOG_FATAL(cb, "eventfd");
+        }
+        return g;
+}
+
+void rebalance_group_destroy(struct rebalance_group *g)
+{
+        int i;
+
+        if (!g)
+                return;
+        for (i = 0; i < g->num_threads; i++) {
+                do_close(g->threads[i].inbox_efd);
+                pthread_mutex_destroy(&g->threads[i].inbox_lock);
+        }
+        pthread_barrier_destroy(&g->stopped);
+        free(g);
+}
+
+struct rebalance *rebalance_get(struct rebalance_group *g, int tid)
+{
+        return &g->threads[tid];
+}
+
+void rebalance_report(struct rebalance_group *g, struct callbacks *cb)
+{
+        unsigned long migrations = 0;
+        struct rebalance *rb;
+        int i;
+
+        for (i = 0; i < g->num_threads; i++)
+                migrations += g->threads[i].migrations_out;
+        PRINT(cb, "migrations", "%lu", migrations);
+
+        for (i = 0; i < g->num_threads; i++) {
+                CLEANUP(free) char *key_util = NULL;
+                CLEANUP(free) char *key_in = NULL;
+                CLEANUP(free) char *key_out = NULL;
+                double elapsed;
+
+                rb = &g->threads[i];
+                elapsed = seconds_between(&rb->time_start, &rb->time_stop);
+                if (asprintf(&key_util, "utilization[%d]", i) == -1 ||
+                    asprintf(&key_in, "migrations_in[%d]", i) == -1 ||
+                    asprintf(&key_out, "migrations_out[%d]", i) == -1)
+                        PLOG_FATAL(cb, "asprintf");
+                PRINT(cb, key_util, "%.2f",
+                      elapsed > 0 ? rb->busy_total / elapsed : 0.0);
+                PRINT(cb, key_in, "%lu", rb->migrations_in);
+                PRINT(cb, key_out, "%lu", rb->migrations_out);
+        }
+}
+
+static inline double to_seconds(const struct timespec *ts)
+{
+        return ts->tv_sec + ts->tv_nsec * 1e-9;
+}
+
+void rebalance_start(struct thread *t, int epfd)
+{
+        struct rebalance *rb = t->rb;
+
+        rb->epfd = epfd;
+        rb->inbox_fl = addflow_lite(epfd, rb->inbox_efd, EPOLLIN, t->cb);
+        clock_gettime(CLOCK_MONOTONIC, &rb->time_start);
+        rb->period_start = rb->time_start;
+}
+
+static void adopt_flows(struct thread *t)
+{
+        struct rebalance *rb = t->rb;
+        struct epoll_event ev;
+        struct flow *flows, *flow;
+        eventfd_t n;
+
+        eventfd_read(rb->inbox_efd, &n);
+        pthread_mutex_lock(&rb->inbox_lock);
+        flows = rb->inbox;
+        rb->inbox = NULL;
+        pthread_mutex_unlock(&rb->inbox_lock);
+
+        LIST_FOR_EACH(flows, flow) {
+                flow->next = NULL;
+                flow->id = t->next_flow_id++;
+                flow->tid = t->index;
+                ev.events = flow->events;
+                ev.data.ptr = flow;
+                epoll_ctl_or_die(rb->epfd, EPOLL_CTL_ADD, flow->fd, &ev, t->cb);
+                rb->migrations_in++;
+                LOG_INFO(t->cb, "tid=%d, adopted flow_id=%d", t->index,
+                         flow->id);
+        }
+}
+
+static void migrate_flow(struct thread *t, struct flow *flow,
+                         struct rebalance *to)
+{
+        struct rebalance *rb = t->rb;
+        struct timespec now;
+
+        epoll_del_or_err(rb->epfd, flow->fd, t->cb);
+        LOG_INFO(t->cb, "tid=%d, flow_id=%d migrates to tid=%d", t->index,
+                 flow->id, to->index);
+
+        /* Close the flow's books in this thread.  The new owner counts from
+         * zero under a flow id of its own.
+         */
+        if (flow->bytes_read || flow->transactions) {
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                add_sample(flow->tid, flow, &now, &t->samples, t->cb);
+                flow->bytes_read = 0;
+                flow->transactions = 0;
+        }
+
+        pthread_mutex_lock(&to->inbox_lock);
+        flow->next = to->inbox;
+        to->inbox = flow;
+        pthread_mutex_unlock(&to->inbox_lock);
+        if (eventfd_write(to->inbox_efd, 1))
+                PLOG_ERROR(t->cb, "eventfd_write");
+        rb->migrations_out++;
+}
+
+int rebalance_events(struct thread *t, struct epoll_event *events, int nfds,
+                     int fd_listen)
+{
+        struct rebalance *rb = t->rb;
+        struct flow *flow;
+        int i, j;
+
+        clock_gettime(CLOCK_MONOTONIC, &rb->busy_start);
+        for (i = 0, j = 0; i < nfds; i++) {
+                flow = events[i].data.ptr;
+                if (flow == rb->inbox_fl) {
+                        adopt_flows(t);
+                        continue;
+                }
+                /* Only established flows can move, not control fds. */
+                if (flow->itv && flow->fd != fd_listen) {
+                        if (rb->shed_to >= 0) {
+                                migrate_flow(t, flow,
+                                             &rb->group->threads[rb->shed_to]);
+                                rb->shed_to = -1;
+                                continue;
+                        }
+                        if (!rb->active)
+                                rb->active = flow;
+                        else if (rb->active != flow)
+                                rb->many_active = true;
+                }
+                events[j++] = events[i];
+        }
+        return j;
+}
+
+/* Find the least utilized thread.  Threads that haven't reported for a while
+ * are sleeping in epoll_wait(), so they count as idle.
+ */
+static struct rebalance *least_utilized(struct rebalance *rb, double now,
+                                        double *min)
+{
+        struct rebalance_group *g = rb->group;
+        struct rebalance *peer, *best = NULL;
+        double u, updated;
+        int i;
+
+        for (i = 0; i < g->num_threads; i++) {
+                peer = &g->threads[i];
+                if (peer == rb)
+                        continue;
+                __atomic_load(&peer->utilization, &u, __ATOMIC_RELAXED);
+                __atomic_load(&peer->updated, &updated, __ATOMIC_RELAXED);
+                if (now - updated > 2 * REBALANCE_PERIOD)
+                        u = 0.0;
+                if (!best || u < *min) {
+                        best = peer;
+                        *min = u;
+                }
+        }
+        return best;
+}
+
+void rebalance_account(struct thread *t)
+{
+        struct rebalance *rb = t->rb;
+        struct rebalance *idle;
+        struct timespec now;
+        double period, u, min, updated;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        rb->busy += seconds_between(&rb->busy_start, &now);
+        period = seconds_between(&rb->period_start, &now);
+        if (period < REBALANCE_PERIOD)
+                return;
+
+        u = rb->busy / period;
+        updated = to_seconds(&now);
+        __atomic_store(&rb->utilization, &u, __ATOMIC_RELAXED);
+        __atomic_store(&rb->updated, &updated, __ATOMIC_RELAXED);
+
+        /* A single hot flow would just bounce between threads. */
+        idle = least_utilized(rb, updated, &min);
+        if (idle && rb->many_active && u - min > REBALANCE_THRESHOLD)
+                rb->shed_to = idle->index;
+
+        rb->busy_total += rb->busy;
+        rb->busy = 0.0;
+        rb->active = NULL;
+        rb->many_active = false;
+        rb->period_start = now;
+}
+
+void rebalance_stop(struct thread *t)
+{
+        struct rebalance *rb = t->rb;
+
+        clock_gettime(CLOCK_MONOTONIC, &rb->time_stop);
+        rb->busy_total += rb->busy;
+        pthread_barrier_wait(&rb->group->stopped);
+
+        /* Nobody hands over flows anymore, take in the last ones. */
+        adopt_flows(t);
+        epoll_del_or_err(rb->epfd, rb->inbox_efd, t->cb);
+        free(rb->inbox_fl);
+}
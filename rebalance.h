@@ -0,0 +1,65 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEPER_REBALANCE_H
+#define NEPER_REBALANCE_H
+
+/*
+ * Migration of flows from busy worker threads to idle ones.
+ *
+ * Each thread measures how much of its time goes into processing events.
+ * At the end of every period, a thread that is noticeably busier than the
+ * least busy one hands over one of its active flows.  The flow is removed
+ * from the thread's epoll set and passed through a mutex-protected inbox to
+ * the other thread, which adds it to its own epoll set.
+ */
+
+struct callbacks;
+struct epoll_event;
+struct rebalance;
+struct rebalance_group;
+struct thread;
+
+struct rebalance_group *rebalance_group_create(int num_threads,
+                                               struct callbacks *cb);
+void rebalance_group_destroy(struct rebalance_group *g);
+
+/* Per-thread state of thread with index tid. */
+struct rebalance *rebalance_get(struct rebalance_group *g, int tid);
+
+/* Print per-thread utilization and migration counts. */
+void rebalance_report(struct rebalance_group *g, struct callbacks *cb);
+
+/* Start accepting flows from other threads into epoll set epfd. */
+void rebalance_start(struct thread *t, int epfd);
+
+/* Filter events returned by epoll_wait() before processing them.  Adopts
+ * flows handed over by other threads and, if it's time to shed load, migrates
+ * one of the flows with pending events away.  Returns the number of events
+ * left to process.
+ */
+int rebalance_events(struct thread *t, struct epoll_event *events, int nfds,
+                     int fd_listen);
+
+/* Account for the time spent processing events since rebalance_events(). */
+void rebalance_account(struct thread *t);
+
+/* Wait until all threads stop processing events.  Flows that are still on
+ * their way are adopted, so that each flow belongs to some thread's epoll set.
+ */
+void rebalance_stop(struct thread *t);
+
+#endif
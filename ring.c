@@ -0,0 +1,148 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ring.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct ring {
+        unsigned int mask;
+        /* Keep producer and consumer positions on separate cache lines. */
+        unsigned int head __attribute__((aligned(64))); /* next to pop */
+        unsigned int tail __attribute__((aligned(64))); /* next to push */
+        void *items[] __attribute__((aligned(64)));
+};
+
+struct byte_ring {
+        size_t mask;
+        size_t head __attribute__((aligned(64)));       /* next to read */
+        size_t tail __attribute__((aligned(64)));       /* next to write */
+        char data[] __attribute__((aligned(64)));
+};
+
+struct ring *ring_create(unsigned int size)
+{
+        unsigned int n = 1;
+        size_t len;
+        void *r;
+
+        while (n < size)
+                n <<= 1;
+        len = sizeof(struct ring) + n * sizeof(void *);
+        if (posix_memalign(&r, 64, len))
+                return NULL;
+        memset(r, 0, len);
+        ((struct ring *)r)->mask = n - 1;
+        return r;
+}
+
+void ring_destroy(struct ring *r)
+{
+        free(r);
+}
+
+bool ring_push(struct ring *r, void *item)
+{
+        unsigned int tail = r->tail;
+        unsigned int head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+        if (tail - head > r->mask)
+                return false;
+        r->items[tail & r->mask] = item;
+        __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+        return true;
+}
+
+void *ring_pop(struct ring *r)
+{
+        unsigned int head = r->head;
+        unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        void *item;
+
+        if (head == tail)
+                return NULL;
+        item = r->items[head & r->mask];
+        __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+        return item;
+}
+
+struct byte_ring *byte_ring_create(size_t size)
+{
+        size_t n = 1;
+        void *r;
+
+        while (n < size)
+                n <<= 1;
+        if (posix_memalign(&r, 64, sizeof(struct byte_ring) + n))
+                return NULL;
+        memset(r, 0, sizeof(struct byte_ring));
+        ((struct byte_ring *)r)->mask = n - 1;
+        return r;
+}
+
+void byte_ring_destroy(struct byte_ring *r)
+{
+        free(r);
+}
+
+size_t byte_ring_write(struct byte_ring *r, const void *buf, size_t len)
+{
+        size_t tail = r->tail;
+        size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        size_t space = r->mask + 1 - (tail - head);
+        size_t off = tail & r->mask;
+        size_t chunk;
+
+        if (len > space)
+                len = space;
+        /* Wraps around the end of the buffer at most once */
+        chunk = r->mask + 1 - off;
+        if (chunk > len)
+                chunk = len;
+        memcpy(r->data + off, buf, chunk);
+        memcpy(r->data, (const char *)buf + chunk, len - chunk);
+        __atomic_store_n(&r->tail, tail + len, __ATOMIC_RELEASE);
+        return len;
+}
+
+size_t byte_ring_read(struct byte_ring *r, void *buf, size_t len)
+{
+        size_t head = r->head;
+        size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        size_t off = head & r->mask;
+        size_t chunk;
+
+        if (len > tail - head)
+                len = tail - head;
+        chunk = r->mask + 1 - off;
+        if (chunk > len)
+                chunk = len;
+        memcpy(buf, r->data + off, chunk);
+        memcpy((char *)buf + chunk, r->data, len - chunk);
+        __atomic_store_n(&r->head, head + len, __ATOMIC_RELEASE);
+        return len;
+}
+
+bool byte_ring_empty(struct byte_ring *r)
+{
+        return r->head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+bool byte_ring_full(struct byte_ring *r)
+{
+        return r->tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) >
+               r->mask;
+}
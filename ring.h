@@ -0,0 +1,67 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEPER_RING_H
+#define NEPER_RING_H
+
+/*
+ * Lock-free ring buffer of pointers for exactly one producer and one
+ * consumer thread.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct ring;
+
+/* Size is rounded up to a power of two. */
+struct ring *ring_create(unsigned int size);
+void ring_destroy(struct ring *r);
+
+/* Returns false if the ring is full.  Called only by the producer. */
+bool ring_push(struct ring *r, void *item);
+
+/* Returns NULL if the ring is empty.  Called only by the consumer. */
+void *ring_pop(struct ring *r);
+
+/*
+ * Lock-free ring buffer of bytes, with the same single producer and single
+ * consumer restriction.
+ */
+
+struct byte_ring;
+
+/* Size is rounded up to a power of two. */
+struct byte_ring *byte_ring_create(size_t size);
+void byte_ring_destroy(struct byte_ring *r);
+
+/* Copies in up to @len bytes, as many as fit.  Returns the number copied.
+ * Called only by the producer.
+ */
+size_t byte_ring_write(struct byte_ring *r, const void *buf, size_t len);
+
+/* Copies out up to @len bytes.  Returns the number copied, 0 if the ring is
+ * empty.  Called only by the consumer.
+ */
+size_t byte_ring_read(struct byte_ring *r, void *buf, size_t len);
+
+/* True if there is nothing to read.  Called only by the consumer. */
+bool byte_ring_empty(struct byte_ring *r);
+
+/* True if there is no room to write.  Called only by the producer. */
+bool byte_ring_full(struct byte_ring *r);
+
+#endif
@@ -115,6 +115,15 @@ int compare_samples(const void *a, const void *b)
         return 0;
 }
 
+bool sample_in_window(const struct sample *s, const struct timespec *end)
+{
+        if (!end || (!end->tv_sec && !end->tv_nsec))
+                return true;
+        if (s->timestamp.tv_sec != end->tv_sec)
+                return s->timestamp.tv_sec < end->tv_sec;
+        return s->timestamp.tv_nsec <= end->tv_nsec;
+}
+
 void free_samples(struct sample *samples)
 {
         struct sample *sample, *next;
@@ -17,6 +17,7 @@
 #ifndef NEPER_SAMPLE_H
 #define NEPER_SAMPLE_H
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <sys/resource.h>
 #include <sys/time.h>
@@ -26,6 +27,7 @@ struct flow;
 struct numlist;
 struct percentiles;
 
+/* Keep in sync with script_prelude.lua, which declares it for interval hooks */
 struct sample {
         int tid;                    /* Thread identifier. */
         int flow_id;                /* Flow (connection) identifier. */
@@ -45,6 +47,8 @@ void print_sample(FILE *csv, struct percentiles *percentiles,
 void print_samples(struct percentiles *percentiles, struct sample *samples,
                    int num, const char *filename, struct callbacks *cb);
 int compare_samples(const void *a, const void *b);
+/* Was the sample collected before the end of the measurement window, if any? */
+bool sample_in_window(const struct sample *s, const struct timespec *end);
 void free_samples(struct sample *samples);
 
 #endif
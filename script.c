@@ -17,12 +17,19 @@
 #include "script.h"
 
 #include <assert.h>
+#include <dlfcn.h>
 #include <errno.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "common.h"
+#include "histogram.h"
+#include "plugin.h"
+#include "sample.h"
 #include "serialize.h"
+#include "workload.h"
 
 #include "lua.h"
 #include "lauxlib.h"
@@ -36,10 +43,96 @@ struct collector {
         void *id;
 };
 
+/* How native collector slots merge, keep in sync with script_prelude.lua */
+enum slot_op {
+        SLOT_SUM = 0,
+        SLOT_MAX = 1,
+};
+
+/* GC pauses are measured in seconds, rounded to this */
+#define GC_PAUSE_RESOLUTION 1e-7
+/* Likewise for hook durations, with --profile-hooks */
+#define HOOK_PROFILE_RESOLUTION 1e-8
+
+static const char *const gc_mode_names[] = {
+        [SCRIPT_GC_AUTO]     = "auto",
+        [SCRIPT_GC_STEP]     = "step",
+        [SCRIPT_GC_INTERVAL] = "interval",
+};
+
+struct plugin {
+        void *handle;
+        int num_threads;        /* thread contexts handed out so far */
+        plugin_thread_init_t thread_init;
+        plugin_thread_collect_t thread_collect;
+        plugin_report_t report;
+        plugin_thread_fini_t thread_fini;
+};
+
+static struct hook_profile *create_hook_profiles(void)
+{
+        struct hook_profile *hp;
+        int i;
+
+        hp = calloc(SCRIPT_HOOK_MAX, sizeof(*hp));
+        if (!hp)
+                return NULL;
+        for (i = 0; i < SCRIPT_HOOK_MAX; i++) {
+                hp[i].durations = histogram_create(HOOK_PROFILE_RESOLUTION);
+                if (!hp[i].durations)
+                        goto fail;
+        }
+        return hp;
+fail:
+        while (i--)
+                histogram_destroy(hp[i].durations);
+        free(hp);
+        return NULL;
+}
+
+static void destroy_hook_profiles(struct hook_profile *hp)
+{
+        int i;
+
+        if (!hp)
+                return;
+        for (i = 0; i < SCRIPT_HOOK_MAX; i++)
+                histogram_destroy(hp[i].durations);
+        free(hp);
+}
+
 /*
  * Keys to Lua registry where we store hook functions and context.
  */
 static void *SCRIPT_ENGINE_KEY = &SCRIPT_ENGINE_KEY;
+static void *SOCKET_HOOK_CALLER_KEY = &SOCKET_HOOK_CALLER_KEY;
+static void *PACKET_HOOK_CALLER_KEY = &PACKET_HOOK_CALLER_KEY;
+static void *BATCH_HOOK_CALLER_KEY = &BATCH_HOOK_CALLER_KEY;
+static void *INTERVAL_HOOK_CALLER_KEY = &INTERVAL_HOOK_CALLER_KEY;
+
+/*
+ * Hooks are called through these, so that the C pointers they get are cast
+ * with a ctype resolved once per Lua state, and in the same pcall as the hook.
+ */
+static const char hook_callers[] =
+        "local ffi = require('ffi')\n"
+        "local cast = ffi.cast\n"
+        "local addrinfo_pt = ffi.typeof('struct addrinfo *')\n"
+        "local msghdr_pt = ffi.typeof('struct msghdr *')\n"
+        "local mmsghdr_pt = ffi.typeof('struct mmsghdr *')\n"
+        "local sample_pt = ffi.typeof('const struct sample *')\n"
+        "return function (hook, sockfd, ai)\n"
+        "         return hook(sockfd, cast(addrinfo_pt, ai))\n"
+        "       end,\n"
+        "       function (hook, sockfd, msg, flags)\n"
+        "         return hook(sockfd, cast(msghdr_pt, msg), flags)\n"
+        "       end,\n"
+        "       function (hook, sockfd, msgvec, vlen, flags)\n"
+        "         return hook(sockfd, cast(mmsghdr_pt, msgvec), vlen, flags)\n"
+        "       end,\n"
+        "       function (hook, tid, sample)\n"
+        "         return hook(tid, cast(sample_pt, sample))\n"
+        "       end\n";
 
 DEFINE_CLEANUP_FUNC(lua_close, lua_State *);
 
@@ -93,7 +186,7 @@ static int store_hook(lua_State *L, enum run_mode run_mode,
         se = get_context(L);
         if (se->run_mode == run_mode) {
                 h = script_engine_get_hook(se, hid);
-                if (h->function)
+                if (h->function || h->native)
                         LOG_FATAL(se->cb, "hook %s already set", h->name);
                 h->function = serialize_function(se->cb, L);
         }
@@ -151,6 +244,46 @@ static int server_recverr_cb(lua_State *L)
         return store_hook(L, SERVER, SCRIPT_HOOK_RECVERR);
 }
 
+static int client_sendmmsg_cb(lua_State *L)
+{
+        return store_hook(L, CLIENT, SCRIPT_HOOK_SENDMMSG);
+}
+
+static int client_recvmmsg_cb(lua_State *L)
+{
+        return store_hook(L, CLIENT, SCRIPT_HOOK_RECVMMSG);
+}
+
+static int server_sendmmsg_cb(lua_State *L)
+{
+        return store_hook(L, SERVER, SCRIPT_HOOK_SENDMMSG);
+}
+
+static int server_recvmmsg_cb(lua_State *L)
+{
+        return store_hook(L, SERVER, SCRIPT_HOOK_RECVMMSG);
+}
+
+static int client_transaction_cb(lua_State *L)
+{
+        return store_hook(L, CLIENT, SCRIPT_HOOK_TRANSACTION);
+}
+
+static int client_interval_cb(lua_State *L)
+{
+        return store_hook(L, CLIENT, SCRIPT_HOOK_INTERVAL);
+}
+
+static int server_transaction_cb(lua_State *L)
+{
+        return store_hook(L, SERVER, SCRIPT_HOOK_TRANSACTION);
+}
+
+static int server_interval_cb(lua_State *L)
+{
+        return store_hook(L, SERVER, SCRIPT_HOOK_INTERVAL);
+}
+
 static int is_client_cb(lua_State *L)
 {
         return 0;
@@ -183,6 +316,84 @@ static int register_collector_cb(lua_State *L)
         return 0;
 }
 
+static double slot_identity(int op)
+{
+        return op == SLOT_MAX ? -HUGE_VAL : 0;
+}
+
+/* Point native collectors in a Lua state at their slots and histograms. */
+static int set_collector_slots(lua_State *L, double *slots,
+                               struct histogram **histograms)
+{
+        lua_getglobal(L, "set_collector_slots__");
+        lua_pushlightuserdata(L, slots);
+        lua_pushlightuserdata(L, histograms);
+        return lua_pcall(L, 2, 0, 0);
+}
+
+/* Count the time hooks spend in system calls in @syscall_time. */
+static int profile_syscalls(lua_State *L, double *syscall_time)
+{
+        lua_getglobal(L, "profile_syscalls__");
+        lua_pushlightuserdata(L, syscall_time);
+        return lua_pcall(L, 1, 0, 0);
+}
+
+static int alloc_collector_slots_cb(lua_State *L)
+{
+        struct script_engine *se;
+        int op, n, first, i;
+
+        op = luaL_checkinteger(L, 1);
+        n = luaL_checkinteger(L, 2);
+        luaL_argcheck(L, op == SLOT_SUM || op == SLOT_MAX, 1, "unknown op");
+        luaL_argcheck(L, n > 0, 2, "no slots");
+
+        se = get_context(L);
+        first = se->num_slots;
+        se->slots = realloc(se->slots, (first + n) * sizeof(*se->slots));
+        se->slot_ops = realloc(se->slot_ops,
+                               (first + n) * sizeof(*se->slot_ops));
+        if (!se->slots || !se->slot_ops)
+                LOG_FATAL(se->cb, "realloc failed");
+        for (i = first; i < first + n; i++) {
+                se->slot_ops[i] = op;
+                se->slots[i] = slot_identity(op);
+        }
+        se->num_slots = first + n;
+
+        if (set_collector_slots(L, se->slots, se->histograms))
+                return lua_error(L);
+
+        lua_pushinteger(L, first);
+        return 1;
+}
+
+static int alloc_collector_histogram_cb(lua_State *L)
+{
+        struct script_engine *se;
+        struct histogram *h;
+        int i;
+
+        h = histogram_create(luaL_checknumber(L, 1));
+        luaL_argcheck(L, h, 1, "invalid resolution");
+
+        se = get_context(L);
+        i = se->num_histograms;
+        se->histograms = realloc(se->histograms,
+                                 (i + 1) * sizeof(*se->histograms));
+        if (!se->histograms)
+                LOG_FATAL(se->cb, "realloc failed");
+        se->histograms[i] = h;
+        se->num_histograms = i + 1;
+
+        if (set_collector_slots(L, se->slots, se->histograms))
+                return lua_error(L);
+
+        lua_pushinteger(L, i);
+        return 1;
+}
+
 static void empty_collectors(struct collector *collectors, lua_State *L)
 {
         struct collector *c;
@@ -223,12 +434,124 @@ static int tid_iter_cb(lua_State *L)
         return 0;
 }
 
+/* Compiles the step at @idx, a table with one of send, recv or think set. */
+static struct seq_step compile_step(lua_State *L, int idx, const char *part,
+                                    int n)
+{
+        static const char *const ops[] = {
+                [SEQ_SEND] = "send",
+                [SEQ_RECV] = "recv",
+                [SEQ_THINK] = "think",
+        };
+        struct seq_step step = { .op = SEQ_THINK + 1 };
+        lua_Number v, max;
+        uint32_t op;
+
+        if (!lua_istable(L, idx))
+                luaL_error(L, "%s step %d: not a table", part, n);
+        for (op = SEQ_SEND; op <= SEQ_THINK; op++) {
+                lua_getfield(L, idx, ops[op]);
+                if (lua_isnil(L, -1)) {
+                        lua_pop(L, 1);
+                        continue;
+                }
+                if (step.op <= SEQ_THINK || !lua_isnumber(L, -1))
+                        luaL_error(L, "%s step %d: expected one of send, "
+                                   "recv or think set to a number", part, n);
+                v = lua_tonumber(L, -1);
+                lua_pop(L, 1);
+
+                /* Think times are in seconds, stored in microseconds */
+                if (op == SEQ_THINK)
+                        v = round(v * 1e6);
+                max = op == SEQ_THINK ? UINT32_MAX : INT_MAX;
+                if (v < (op == SEQ_THINK ? 0 : 1) || v > max || v != floor(v))
+                        luaL_error(L, "%s step %d: invalid %s", part, n,
+                                   ops[op]);
+                step.op = op;
+                step.arg = v;
+        }
+        if (step.op > SEQ_THINK)
+                luaL_error(L, "%s step %d: expected one of send, recv or "
+                           "think", part, n);
+        return step;
+}
+
+/* Compiles the steps in the array at @idx into @steps, returns how many. */
+static int compile_steps(lua_State *L, int idx, const char *part,
+                         struct seq_step *steps)
+{
+        int i, n = lua_objlen(L, idx);
+
+        for (i = 0; i < n; i++) {
+                lua_rawgeti(L, idx, i + 1);
+                steps[i] = compile_step(L, lua_gettop(L), part, i + 1);
+                lua_pop(L, 1);
+        }
+        return n;
+}
+
+static int sequence_cb(lua_State *L)
+{
+        struct script_engine *se;
+        struct sequence *seq;
+        lua_Number reuse;
+        bool loops_io = false;
+        size_t len;
+        int i, n;
+
+        luaL_checktype(L, 1, LUA_TTABLE);
+        lua_getfield(L, 1, "setup");
+        if (lua_isnil(L, -1)) {
+                lua_pop(L, 1);
+                lua_newtable(L);
+        }
+        luaL_argcheck(L, lua_istable(L, 2), 1, "setup is not a table");
+        lua_getfield(L, 1, "reuse");
+        reuse = luaL_optnumber(L, 3, 0);
+        luaL_argcheck(L, reuse >= 0 && reuse == floor(reuse), 1,
+                      "reuse is not a count");
+
+        /* Build it in a userdata, so it gets collected if compiling fails */
+        n = lua_objlen(L, 2) + lua_objlen(L, 1);
+        len = sizeof(*seq) + n * sizeof(seq->steps[0]);
+        seq = lua_newuserdata(L, len);
+        memset(seq, 0, sizeof(*seq));
+        seq->reuse = reuse;
+        seq->loop_start = compile_steps(L, 2, "setup", seq->steps);
+        seq->num_steps = seq->loop_start +
+                compile_steps(L, 1, "sequence", seq->steps + seq->loop_start);
+        for (i = 0; i < seq->num_steps; i++) {
+                if (seq->steps[i].op == SEQ_THINK)
+                        continue;
+                if (i >= seq->loop_start)
+                        loops_io = true;
+                if (seq->steps[i].arg > seq->max_msg)
+                        seq->max_msg = seq->steps[i].arg;
+        }
+        luaL_argcheck(L, loops_io, 1, "no send or recv step to loop over");
+
+        se = get_context(L);
+        free(se->sequence);
+        se->sequence = malloc(len);
+        if (!se->sequence)
+                LOG_FATAL(se->cb, "malloc failed");
+        memcpy(se->sequence, seq, len);
+
+        return 0;
+}
+
 static const struct luaL_Reg client_callbacks[] = {
         [SCRIPT_HOOK_SOCKET] =  { "client_socket",  client_socket_cb },
         [SCRIPT_HOOK_CLOSE] =   { "client_close",   client_close_cb },
         [SCRIPT_HOOK_SENDMSG] = { "client_sendmsg", client_sendmsg_cb },
         [SCRIPT_HOOK_RECVMSG] = { "client_recvmsg", client_recvmsg_cb },
         [SCRIPT_HOOK_RECVERR] = { "client_recverr", client_recverr_cb },
+        [SCRIPT_HOOK_SENDMMSG] = { "client_sendmmsg", client_sendmmsg_cb },
+        [SCRIPT_HOOK_RECVMMSG] = { "client_recvmmsg", client_recvmmsg_cb },
+        [SCRIPT_HOOK_TRANSACTION] = { "client_transaction",
+                                      client_transaction_cb },
+        [SCRIPT_HOOK_INTERVAL] = { "client_interval", client_interval_cb },
         { NULL, NULL },
 };
 
@@ -238,6 +561,11 @@ static const struct luaL_Reg server_callbacks[] = {
         [SCRIPT_HOOK_SENDMSG] = { "server_sendmsg", server_sendmsg_cb },
         [SCRIPT_HOOK_RECVMSG] = { "server_recvmsg", server_recvmsg_cb },
         [SCRIPT_HOOK_RECVERR] = { "server_recverr", server_recverr_cb },
+        [SCRIPT_HOOK_SENDMMSG] = { "server_sendmmsg", server_sendmmsg_cb },
+        [SCRIPT_HOOK_RECVMMSG] = { "server_recvmmsg", server_recvmmsg_cb },
+        [SCRIPT_HOOK_TRANSACTION] = { "server_transaction",
+                                      server_transaction_cb },
+        [SCRIPT_HOOK_INTERVAL] = { "server_interval", server_interval_cb },
         { NULL, NULL },
 };
 
@@ -245,7 +573,10 @@ static const struct luaL_Reg common_callbacks[] = {
         { "is_client", is_client_cb },
         { "is_server", is_server_cb },
         { "register_collector__", register_collector_cb },
+        { "alloc_collector_slots__", alloc_collector_slots_cb },
+        { "alloc_collector_histogram__", alloc_collector_histogram_cb },
         { "run",       run_cb },
+        { "sequence",  sequence_cb },
         { "tid_iter",  tid_iter_cb },
         { NULL, NULL } /* sentinel */
 };
@@ -284,6 +615,36 @@ static int load_prelude(struct callbacks *cb, lua_State *L)
         return 0;
 }
 
+/* Keep the hook callers in the registry. */
+static int load_hook_callers(struct callbacks *cb, lua_State *L)
+{
+        int err;
+
+        err = luaL_loadbuffer(L, hook_callers, sizeof(hook_callers) - 1,
+                              "hook_callers");
+        if (!err)
+                err = lua_pcall(L, 0, 4, 0);
+        if (err) {
+                LOG_ERROR(cb, "hook_callers: %s", lua_tostring(L, -1));
+                lua_pop(L, 1);
+                return -errno_lua(err);
+        }
+        lua_pushlightuserdata(L, INTERVAL_HOOK_CALLER_KEY);
+        lua_insert(L, -2);
+        lua_settable(L, LUA_REGISTRYINDEX);
+        lua_pushlightuserdata(L, BATCH_HOOK_CALLER_KEY);
+        lua_insert(L, -2);
+        lua_settable(L, LUA_REGISTRYINDEX);
+        lua_pushlightuserdata(L, PACKET_HOOK_CALLER_KEY);
+        lua_insert(L, -2);
+        lua_settable(L, LUA_REGISTRYINDEX);
+        lua_pushlightuserdata(L, SOCKET_HOOK_CALLER_KEY);
+        lua_insert(L, -2);
+        lua_settable(L, LUA_REGISTRYINDEX);
+
+        return 0;
+}
+
 /**
  * Create an instance of a script engine
  */
@@ -343,6 +704,7 @@ struct script_engine *script_engine_destroy(struct script_engine *se)
 {
         struct script_hook *h;
         struct collector *c;
+        int i;
 
         assert(se);
 
@@ -354,11 +716,69 @@ struct script_engine *script_engine_destroy(struct script_engine *se)
 
         LIST_FOR_EACH (se->collectors, c)
                 free(c);
+        free(se->slots);
+        free(se->slot_ops);
+        for (i = 0; i < se->num_histograms; i++)
+                histogram_destroy(se->histograms[i]);
+        free(se->histograms);
+        for (i = 0; se->gc_pauses && i < se->num_slaves; i++)
+                histogram_destroy(se->gc_pauses[i]);
+        free(se->gc_pauses);
+        for (i = 0; se->hook_profiles && i < se->num_slaves; i++)
+                destroy_hook_profiles(se->hook_profiles[i]);
+        free(se->hook_profiles);
+
+        free(se->sequence);
+
+        if (se->plugin) {
+                dlclose(se->plugin->handle);
+                free(se->plugin);
+        }
 
         free(se);
         return NULL;
 }
 
+void script_engine_reset(struct script_engine *se)
+{
+        struct script_hook *h;
+        struct collector *c;
+        int i;
+
+        assert(se);
+
+        for (h = se->hooks; h < se->hooks + SCRIPT_HOOK_MAX; h++) {
+                free_sfunction(h->function);
+                h->function = NULL;
+        }
+
+        LIST_FOR_EACH (se->collectors, c) {
+                /* Let the collector's table be garbage */
+                lua_pushlightuserdata(se->L, c->id);
+                lua_pushnil(se->L);
+                lua_rawset(se->L, LUA_REGISTRYINDEX);
+                free(c);
+        }
+        se->collectors = NULL;
+
+        free(se->slots);
+        se->slots = NULL;
+        free(se->slot_ops);
+        se->slot_ops = NULL;
+        se->num_slots = 0;
+        for (i = 0; i < se->num_histograms; i++)
+                histogram_destroy(se->histograms[i]);
+        free(se->histograms);
+        se->histograms = NULL;
+        se->num_histograms = 0;
+        if (set_collector_slots(se->L, NULL, NULL))
+                LOG_FATAL(se->cb, "set_collector_slots__: %s",
+                          lua_tostring(se->L, -1));
+
+        free(se->sequence);
+        se->sequence = NULL;
+}
+
 static int run_script(struct script_engine *se,
                       int (*load_func)(lua_State *, const char *),
                       const char *input,
@@ -389,6 +809,185 @@ static int run_script(struct script_engine *se,
 }
 
 
+/**
+ * Look up the hooks and the optional functions a plugin exports.
+ */
+int script_engine_load_plugin(struct script_engine *se, const char *path)
+{
+        CLEANUP(free) struct plugin *p = NULL;
+        struct script_hook *h;
+
+        assert(se);
+        assert(!se->plugin);
+
+        p = calloc(1, sizeof(*p));
+        if (!p)
+                return -ENOMEM;
+
+        p->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (!p->handle) {
+                LOG_ERROR(se->cb, "dlopen: %s", dlerror());
+                return -ELIBACC;
+        }
+
+        for (h = se->hooks; h < se->hooks + SCRIPT_HOOK_MAX; h++)
+                h->native = dlsym(p->handle, h->name);
+
+        p->thread_init = dlsym(p->handle, "plugin_thread_init");
+        p->thread_collect = dlsym(p->handle, "plugin_thread_collect");
+        p->report = dlsym(p->handle, "plugin_report");
+        p->thread_fini = dlsym(p->handle, "plugin_thread_fini");
+
+        se->plugin = p;
+        p = NULL;
+
+        return 0;
+}
+
+int script_engine_set_gc(struct script_engine *se, const char *spec)
+{
+        static const int max_args[] = {
+                [SCRIPT_GC_AUTO]     = 2,       /* pause, stepmul */
+                [SCRIPT_GC_STEP]     = 1,       /* kbytes */
+                [SCRIPT_GC_INTERVAL] = 0,
+        };
+        int mode, end = 0, num_args = 0, args[2] = { 0, 0 };
+        const char *rest;
+        char name[16], *end_p;
+        long v;
+
+        assert(se);
+        assert(!se->num_slaves);
+
+        if (sscanf(spec, "%15[a-z]%n", name, &end) != 1)
+                return -EINVAL;
+        for (mode = 0; mode < ARRAY_SIZE(gc_mode_names); mode++) {
+                if (!strcmp(name, gc_mode_names[mode]))
+                        break;
+        }
+        if (mode == ARRAY_SIZE(gc_mode_names))
+                return -EINVAL;
+
+        rest = spec + end;
+        while (*rest == ':') {
+                if (num_args == max_args[mode])
+                        return -EINVAL;
+                v = strtol(rest + 1, &end_p, 10);
+                if (end_p == rest + 1 || v < 0 || v > INT_MAX)
+                        return -EINVAL;
+                args[num_args++] = v;
+                rest = end_p;
+        }
+        if (*rest)
+                return -EINVAL;
+
+        se->gc_mode = mode;
+        if (mode == SCRIPT_GC_AUTO) {
+                se->gc_pause = args[0];
+                se->gc_stepmul = args[1];
+                return 0;
+        }
+        se->gc_step_kb = args[0];
+        return 0;
+}
+
+int script_engine_profile_hooks(struct script_engine *se)
+{
+        assert(se);
+        assert(!se->num_slaves);
+
+        se->profile_hooks = true;
+        return 0;
+}
+
+static void report_hook_profile(struct script_engine *se,
+                                enum script_hook_id hid, int index,
+                                struct hook_profile *hp)
+{
+        const char *name = get_hook_name(se->run_mode, hid);
+        struct callbacks *cb = se->cb;
+        char key[64];
+
+        snprintf(key, sizeof(key), "%s_calls[%d]", name, index);
+        PRINT(cb, key, "%lu", hp->calls);
+        snprintf(key, sizeof(key), "%s_time[%d]", name, index);
+        PRINT(cb, key, "%f", hp->time);
+        /* a plugin's system calls are not told apart from the rest */
+        if (!se->hooks[hid].native) {
+                snprintf(key, sizeof(key), "%s_lua_time[%d]", name, index);
+                PRINT(cb, key, "%f", hp->time - hp->syscall_time);
+                snprintf(key, sizeof(key), "%s_syscall_time[%d]", name,
+                         index);
+                PRINT(cb, key, "%f", hp->syscall_time);
+        }
+        snprintf(key, sizeof(key), "%s_mean[%d]", name, index);
+        PRINT(cb, key, "%.9f", hp->time / hp->calls);
+        snprintf(key, sizeof(key), "%s_p99[%d]", name, index);
+        PRINT(cb, key, "%.9f", histogram_percentile(hp->durations, 99));
+        snprintf(key, sizeof(key), "%s_max[%d]", name, index);
+        PRINT(cb, key, "%.9f", histogram_max(hp->durations));
+}
+
+static void report_hook_profiles(struct script_engine *se)
+{
+        struct hook_profile *hp;
+        int i, hid;
+
+        for (i = 0; se->hook_profiles && i < se->num_slaves; i++) {
+                for (hid = 0; hid < SCRIPT_HOOK_MAX; hid++) {
+                        hp = &se->hook_profiles[i][hid];
+                        if (!hp->calls)
+                                continue;
+                        report_hook_profile(se, hid, i, hp);
+
+                        hp->calls = 0;
+                        hp->time = 0;
+                        hp->syscall_time = 0;
+                        histogram_reset(hp->durations);
+                }
+        }
+}
+
+/* Each thread's pauses on their own, as merging them would hide a thread
+ * that pauses for longer than the others.
+ */
+static void report_gc_pauses(struct script_engine *se)
+{
+        struct callbacks *cb = se->cb;
+        struct histogram *h;
+        char key[64];
+        int i;
+
+        for (i = 0; se->gc_pauses && i < se->num_slaves; i++) {
+                h = se->gc_pauses[i];
+                if (!histogram_count(h))
+                        continue;
+
+                snprintf(key, sizeof(key), "script_gc_pause_count[%d]", i);
+                PRINT(cb, key, "%lu", histogram_count(h));
+                snprintf(key, sizeof(key), "script_gc_pause_mean[%d]", i);
+                PRINT(cb, key, "%f", histogram_mean(h));
+                snprintf(key, sizeof(key), "script_gc_pause_p50[%d]", i);
+                PRINT(cb, key, "%f", histogram_percentile(h, 50));
+                snprintf(key, sizeof(key), "script_gc_pause_p99[%d]", i);
+                PRINT(cb, key, "%f", histogram_percentile(h, 99));
+                snprintf(key, sizeof(key), "script_gc_pause_max[%d]", i);
+                PRINT(cb, key, "%f", histogram_max(h));
+                histogram_reset(h);
+        }
+}
+
+void script_engine_report(struct script_engine *se)
+{
+        struct plugin *p = se->plugin;
+
+        report_gc_pauses(se);
+        report_hook_profiles(se);
+
+        if (p && p->report)
+                p->report(se->cb->print, se->cb->logger);
+}
+
 /**
  * Runs the script passed in a string.
  */
@@ -416,21 +1015,161 @@ int script_engine_run_file(struct script_engine *se, const char *filename,
 }
 
 
+/* Slaves get a Lua state only if the script has hooks for them to run. */
+static lua_State *slave_lua_state(struct script_slave *ss)
+{
+        CLEANUP(lua_close) lua_State *L = NULL;
+        int err;
+
+        if (ss->L)
+                return ss->L;
+
+        L = luaL_newstate();
+        if (!L)
+                LOG_FATAL(ss->cb, "luaL_newstate failed");
+        luaL_openlibs(L);
+        err = load_prelude(ss->cb, L);
+        if (!err)
+                err = load_hook_callers(ss->cb, L);
+        if (err)
+                LOG_FATAL(ss->cb, "failed to set up slave Lua state: %s",
+                          script_strerror(-err));
+        if ((ss->num_slots || ss->num_histograms) &&
+            set_collector_slots(L, ss->slots, ss->histograms)) {
+                LOG_FATAL(ss->cb, "set_collector_slots__: %s",
+                          lua_tostring(L, -1));
+        }
+        if (ss->hook_profiles && profile_syscalls(L, &ss->syscall_time))
+                LOG_FATAL(ss->cb, "profile_syscalls__: %s",
+                          lua_tostring(L, -1));
+
+        if (ss->se->gc_pause)
+                lua_gc(L, LUA_GCSETPAUSE, ss->se->gc_pause);
+        if (ss->se->gc_stepmul)
+                lua_gc(L, LUA_GCSETSTEPMUL, ss->se->gc_stepmul);
+        /* The collector runs only when we say so */
+        if (ss->se->gc_mode != SCRIPT_GC_AUTO)
+                lua_gc(L, LUA_GCSTOP, 0);
+
+        ss->L = L;
+        L = NULL;
+        return ss->L;
+}
+
+/* Give the slave its own copy of native collectors' values */
+static void push_collector_slots(struct script_engine *se,
+                                 struct script_slave *ss)
+{
+        int i;
+
+        if (ss->num_slots == se->num_slots &&
+            ss->num_histograms == se->num_histograms)
+                return;
+
+        ss->slots = realloc(ss->slots, se->num_slots * sizeof(*ss->slots));
+        if (se->num_slots && !ss->slots)
+                LOG_FATAL(ss->cb, "realloc failed");
+        for (i = ss->num_slots; i < se->num_slots; i++)
+                ss->slots[i] = slot_identity(se->slot_ops[i]);
+        ss->num_slots = se->num_slots;
+
+        ss->histograms = realloc(ss->histograms, se->num_histograms *
+                                                 sizeof(*ss->histograms));
+        if (se->num_histograms && !ss->histograms)
+                LOG_FATAL(ss->cb, "realloc failed");
+        for (i = ss->num_histograms; i < se->num_histograms; i++) {
+                ss->histograms[i] = histogram_create(
+                        histogram_resolution(se->histograms[i]));
+                if (!ss->histograms[i])
+                        LOG_FATAL(ss->cb, "histogram_create failed");
+        }
+        ss->num_histograms = se->num_histograms;
+
+        /* Otherwise the Lua state picks them up when it gets created */
+        if (ss->L && set_collector_slots(ss->L, ss->slots, ss->histograms)) {
+                LOG_FATAL(ss->cb, "set_collector_slots__: %s",
+                          lua_tostring(ss->L, -1));
+        }
+}
+
+static bool has_lua_hooks(struct script_engine *se)
+{
+        int i;
+
+        for (i = 0; i < SCRIPT_HOOK_MAX; i++) {
+                if (se->hooks[i].function)
+                        return true;
+        }
+        return false;
+}
+
 void script_engine_push_data(struct script_engine *se, struct script_slave *ss)
 {
         /* TODO: Transfer hooks & their upvalues to slave */
-        (void) se;
-        (void) ss;
+
+        push_collector_slots(se, ss);
+
+        /* Hooks may run within the timed part of the test, which should not
+         * include setting up the state.
+         */
+        if (has_lua_hooks(se))
+                slave_lua_state(ss);
+}
+
+/* Merge the slave's native collector values, then reset them. */
+static void pull_collector_slots(struct script_engine *se,
+                                 struct script_slave *ss)
+{
+        double *v;
+        int i;
+
+        for (i = 0; i < ss->num_slots; i++) {
+                v = &ss->slots[i];
+                if (se->slot_ops[i] == SLOT_MAX)
+                        se->slots[i] = fmax(se->slots[i], *v);
+                else
+                        se->slots[i] += *v;
+                *v = slot_identity(se->slot_ops[i]);
+        }
+
+        for (i = 0; i < ss->num_histograms; i++) {
+                histogram_merge(se->histograms[i], ss->histograms[i]);
+                histogram_reset(ss->histograms[i]);
+        }
+
+        if (ss->gc_pauses) {
+                histogram_merge(se->gc_pauses[ss->index], ss->gc_pauses);
+                histogram_reset(ss->gc_pauses);
+        }
+
+        for (i = 0; ss->hook_profiles && i < SCRIPT_HOOK_MAX; i++) {
+                struct hook_profile *from = &ss->hook_profiles[i];
+                struct hook_profile *to = &se->hook_profiles[ss->index][i];
+
+                to->calls += from->calls;
+                to->time += from->time;
+                to->syscall_time += from->syscall_time;
+                histogram_merge(to->durations, from->durations);
+                from->calls = 0;
+                from->time = 0;
+                from->syscall_time = 0;
+                histogram_reset(from->durations);
+        }
 }
 
+/* Returns NULL if the slave hasn't loaded any hook using the collector. */
 static struct svalue *get_collected_value(struct script_slave *ss, void *collector_id)
 {
         lua_State *L = ss->L;
         struct svalue *sv = NULL;
 
+        if (!L)
+                return NULL;
+
         push_collected_value(ss->cb, L, ss->hook_upvalues,
                              LUA_REGISTRYINDEX, collector_id);
-        sv = serialize_value(ss->cb, L);
+        if (!lua_isnil(L, -1))
+                sv = serialize_value(ss->cb, L);
         lua_pop(L, 1); /* collected value */
 
         return sv;
@@ -464,6 +1203,11 @@ void script_engine_pull_data(struct script_engine *se, struct script_slave *ss)
         assert(se);
         assert(ss);
 
+        if (se->plugin && se->plugin->thread_collect)
+                se->plugin->thread_collect(ss->plugin_ctx);
+
+        pull_collector_slots(se, ss);
+
         cache = upvalue_cache_new();
         lua_newtable(se->L);
         cache_idx = lua_gettop(se->L);
@@ -472,6 +1216,8 @@ void script_engine_pull_data(struct script_engine *se, struct script_slave *ss)
                 struct svalue *sv;
 
                 sv = get_collected_value(ss, c->id);
+                if (!sv)
+                        continue;
                 add_collected_value(se, cache, cache_idx, c->id, sv);
                 free_svalue(sv);
         }
@@ -480,14 +1226,40 @@ void script_engine_pull_data(struct script_engine *se, struct script_slave *ss)
         free_upvalue_cache(cache);
 }
 
+/* Room in the engine for the GC pauses of the slave about to be created. */
+static int add_gc_pauses(struct script_engine *se)
+{
+        struct histogram **h;
+
+        h = realloc(se->gc_pauses, (se->num_slaves + 1) * sizeof(*h));
+        if (!h)
+                return -ENOMEM;
+        se->gc_pauses = h;
+        h[se->num_slaves] = histogram_create(GC_PAUSE_RESOLUTION);
+        return h[se->num_slaves] ? 0 : -ENOMEM;
+}
+
+/* Room in the engine for the hook profiles of the slave about to be
+ * created.
+ */
+static int add_hook_profiles(struct script_engine *se)
+{
+        struct hook_profile **hp;
+
+        hp = realloc(se->hook_profiles, (se->num_slaves + 1) * sizeof(*hp));
+        if (!hp)
+                return -ENOMEM;
+        se->hook_profiles = hp;
+        hp[se->num_slaves] = create_hook_profiles();
+        return hp[se->num_slaves] ? 0 : -ENOMEM;
+}
+
 /**
  * Create an instance of a slave script engine
  */
 int script_slave_create(struct script_slave **ssp, struct script_engine *se)
 {
         CLEANUP(free) struct script_slave *ss = NULL;
-        CLEANUP(lua_close) lua_State *L = NULL;
-        int err;
 
         assert(ssp);
         assert(se);
@@ -496,24 +1268,43 @@ int script_slave_create(struct script_slave **ssp, struct script_engine *se)
         if (!ss)
                 return -ENOMEM;
 
-        L = luaL_newstate();
-        if (!L)
+        ss->hook_upvalues = upvalue_cache_new();
+        if (!ss->hook_upvalues)
                 return -ENOMEM;
-        luaL_openlibs(L);
-        err = load_prelude(se->cb, L);
-        if (err)
-                return err;
 
-        /* TODO: Install hooks */
+        if (se->gc_mode != SCRIPT_GC_AUTO) {
+                ss->gc_pauses = histogram_create(GC_PAUSE_RESOLUTION);
+                if (!ss->gc_pauses) {
+                        free_upvalue_cache(ss->hook_upvalues);
+                        return -ENOMEM;
+                }
+        }
 
-        ss->hook_upvalues = upvalue_cache_new();
-        if (!ss->hook_upvalues)
+        if (se->profile_hooks) {
+                ss->hook_profiles = create_hook_profiles();
+                if (!ss->hook_profiles) {
+                        if (ss->gc_pauses)
+                                histogram_destroy(ss->gc_pauses);
+                        free_upvalue_cache(ss->hook_upvalues);
+                        return -ENOMEM;
+                }
+        }
+
+        if ((ss->gc_pauses && add_gc_pauses(se)) ||
+            (ss->hook_profiles && add_hook_profiles(se))) {
+                destroy_hook_profiles(ss->hook_profiles);
+                histogram_destroy(ss->gc_pauses);
+                free_upvalue_cache(ss->hook_upvalues);
                 return -ENOMEM;
+        }
+
+        if (se->plugin && se->plugin->thread_init)
+                ss->plugin_ctx = se->plugin->thread_init(
+                        se->plugin->num_threads++);
 
         ss->se = se;
         ss->cb = se->cb;
-        ss->L = L;
-        L = NULL;
+        ss->index = se->num_slaves++;
 
         *ssp = ss;
         ss = NULL;
@@ -526,64 +1317,55 @@ int script_slave_create(struct script_slave **ssp, struct script_engine *se)
  */
 struct script_slave *script_slave_destroy(struct script_slave *ss)
 {
+        int i;
+
         assert(ss);
 
-        lua_close(ss->L);
+        if (ss->se->plugin && ss->se->plugin->thread_fini)
+                ss->se->plugin->thread_fini(ss->plugin_ctx);
+
+        if (ss->L)
+                lua_close(ss->L);
         ss->L = NULL;
         ss->se = NULL;
 
         free_upvalue_cache(ss->hook_upvalues);
+        free(ss->slots);
+        for (i = 0; i < ss->num_histograms; i++)
+                histogram_destroy(ss->histograms[i]);
+        free(ss->histograms);
+        if (ss->gc_pauses)
+                histogram_destroy(ss->gc_pauses);
+        destroy_hook_profiles(ss->hook_profiles);
 
         free(ss);
         return NULL;
 }
 
-/**
- * Equivalent of:
- *
- * function (proto, ptr)
- *   return ffi.cast(ffi.typeof(proto), ptr)
- * end
- *
- * TODO: Move to script_prelude.lua?
- */
-static int push_cpointer(struct callbacks *cb, lua_State *L, const char *proto, void *ptr)
+void script_slave_reset(struct script_slave *ss)
 {
-        int err;
+        int i;
 
-        /* Get ffi */
-        lua_getglobal(L, "require");
-        lua_pushliteral(L, "ffi");
-        err = lua_pcall(L, 1, 1, 0);
-        if (err) {
-                LOG_ERROR(cb, "lua_pcall(require 'ffi'): %s", lua_tostring(L, -1));
-                return -errno_lua(err);
-        }
-
-        lua_getfield(L, -1, "cast");
-        lua_getfield(L, -2, "typeof");
-
-        /* Call ffi.typeof */
-        lua_pushstring(L, proto);
-        err = lua_pcall(L, 1, 1, 0);
-        if (err) {
-                lua_pop(L, 3);
-                LOG_ERROR(cb, "lua_pcall(ffi.typeof): %s", lua_tostring(L, -1));
-                return -errno_lua(err);
-        }
-
-        /* Call ffi.cast*/
-        lua_pushlightuserdata(L, ptr);
-        err = lua_pcall(L, 2, 1, 0);
-        if (err) {
-                lua_pop(L, 2);
-                LOG_ERROR(cb, "lua_pcall(ffi.cast): %s", lua_tostring(L, -1));
-                return -errno_lua(err);
-        }
+        assert(ss);
 
-        /* Remove ffi module */
-        lua_remove(L, -2);
-        return  0;
+        if (ss->L)
+                lua_close(ss->L);
+        ss->L = NULL;
+        memset(ss->hook_keys, 0, sizeof(ss->hook_keys));
+        free_upvalue_cache(ss->hook_upvalues);
+        ss->hook_upvalues = upvalue_cache_new();
+        if (!ss->hook_upvalues)
+                LOG_FATAL(ss->cb, "upvalue_cache_new failed");
+        ss->gc_kb = 0;
+
+        free(ss->slots);
+        ss->slots = NULL;
+        ss->num_slots = 0;
+        for (i = 0; i < ss->num_histograms; i++)
+                histogram_destroy(ss->histograms[i]);
+        free(ss->histograms);
+        ss->histograms = NULL;
+        ss->num_histograms = 0;
 }
 
 /* Load a serialized hook function. Return a key to it in the registry. */
@@ -599,7 +1381,9 @@ static int load_hook(struct callbacks *cb, lua_State *L,
                                     hook->function, hook->name, key);
 }
 
-static int push_hook(struct script_slave *ss, enum script_hook_id hid)
+/* Push the caller, if any, then the hook it calls. */
+static int push_hook(struct script_slave *ss, enum script_hook_id hid,
+                     void *caller_key)
 {
         CLEANUP(script_engine_put_hook) struct script_hook *h = NULL;
         lua_State *L;
@@ -608,7 +1392,9 @@ static int push_hook(struct script_slave *ss, enum script_hook_id hid)
         assert(ss);
 
         h = script_engine_get_hook(ss->se, hid);
-        L = ss->L;
+        if (!h->function)
+                return -EHOOKEMPTY;
+        L = slave_lua_state(ss);
 
         if (!ss->hook_keys[hid]) {
                 err = load_hook(ss->cb, L, h, ss->hook_upvalues,
@@ -617,17 +1403,77 @@ static int push_hook(struct script_slave *ss, enum script_hook_id hid)
                         return err;
         }
 
+        if (caller_key) {
+                lua_pushlightuserdata(L, caller_key);
+                lua_rawget(L, LUA_REGISTRYINDEX);
+        }
         lua_pushlightuserdata(L, ss->hook_keys[hid]);
-        lua_gettable(L, LUA_REGISTRYINDEX);
+        lua_rawget(L, LUA_REGISTRYINDEX);
 
         return 0;
 }
 
+static void timed_gc(struct script_slave *ss, int what, int data)
+{
+        struct timespec start, end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        lua_gc(ss->L, what, data);
+        /* Explicit collections restart the collector, stop it again */
+        lua_gc(ss->L, LUA_GCSTOP, 0);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        histogram_add(ss->gc_pauses, seconds_between(&start, &end));
+}
+
+void script_slave_interval_gc(struct script_slave *ss)
+{
+        if (ss->L && ss->se->gc_mode == SCRIPT_GC_INTERVAL)
+                timed_gc(ss, LUA_GCCOLLECT, 0);
+}
+
+double script_clock(void)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/* Hooks are timed only with --profile-hooks. */
+static void start_profile(struct script_slave *ss, struct timespec *start)
+{
+        if (!ss->hook_profiles)
+                return;
+        ss->syscall_time = 0;
+        clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static void profile_hook(struct script_slave *ss, enum script_hook_id hid,
+                         const struct timespec *start)
+{
+        struct hook_profile *hp;
+        struct timespec end;
+        double duration;
+
+        if (!ss->hook_profiles)
+                return;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        duration = seconds_between(start, &end);
+        hp = &ss->hook_profiles[hid];
+        hp->calls++;
+        hp->time += duration;
+        hp->syscall_time += ss->syscall_time;
+        histogram_add(hp->durations, duration);
+}
+
 static int call_hook(struct script_slave *ss, enum script_hook_id hid, int nargs)
 {
+        struct timespec start;
         int err, res;
 
+        start_profile(ss, &start);
         err = lua_pcall(ss->L, nargs, 1, 0);
+        profile_hook(ss, hid, &start);
         if (err) {
                 LOG_FATAL(ss->cb, "%s: lua_pcall: %s",
                           get_hook_name(ss->se->run_mode, hid),
@@ -641,40 +1487,95 @@ static int call_hook(struct script_slave *ss, enum script_hook_id hid, int nargs
                 res = -EHOOKRETVAL;
         lua_pop(ss->L, 1);
 
+        if (ss->se->gc_mode == SCRIPT_GC_STEP &&
+            lua_gc(ss->L, LUA_GCCOUNT, 0) - ss->gc_kb >= ss->se->gc_step_kb) {
+                timed_gc(ss, LUA_GCSTEP, 0);
+                ss->gc_kb = lua_gc(ss->L, LUA_GCCOUNT, 0);
+        }
+
         return res;
 }
 
 static int run_socket_hook(struct script_slave *ss, enum script_hook_id hid,
                            int sockfd, struct addrinfo *ai)
 {
+        void *native = ss->se->hooks[hid].native;
+        struct timespec start;
         int err;
 
-        err = push_hook(ss, hid);
+        if (native) {
+                start_profile(ss, &start);
+                err = ((plugin_socket_hook_t) native)(ss->plugin_ctx, sockfd,
+                                                      ai);
+                profile_hook(ss, hid, &start);
+                return err;
+        }
+
+        err = push_hook(ss, hid, SOCKET_HOOK_CALLER_KEY);
         if (err)
                 return err;
 
         /* Push arguments */
         lua_pushinteger(ss->L, sockfd);
-        push_cpointer(ss->cb, ss->L, "struct addrinfo *", ai);
+        lua_pushlightuserdata(ss->L, ai);
 
-        return call_hook(ss, hid, 2);
+        return call_hook(ss, hid, 3);
 }
 
 static int run_packet_hook(struct script_slave *ss, enum script_hook_id hid,
                            int sockfd, struct msghdr *msg, int flags)
 {
+        void *native = ss->se->hooks[hid].native;
+        struct timespec start;
         int err;
 
-        err = push_hook(ss, hid);
+        if (native) {
+                start_profile(ss, &start);
+                err = ((plugin_packet_hook_t) native)(ss->plugin_ctx, sockfd,
+                                                      msg, flags);
+                profile_hook(ss, hid, &start);
+                return err;
+        }
+
+        err = push_hook(ss, hid, PACKET_HOOK_CALLER_KEY);
         if (err)
                 return err;
 
         /* Push arguments */
         lua_pushinteger(ss->L, sockfd);
-        push_cpointer(ss->cb, ss->L, "struct msghdr *", msg);
+        lua_pushlightuserdata(ss->L, msg);
         lua_pushinteger(ss->L, flags);
 
-        return call_hook(ss, hid, 3);
+        return call_hook(ss, hid, 4);
+}
+
+static int run_batch_hook(struct script_slave *ss, enum script_hook_id hid,
+                          int sockfd, struct mmsghdr *msgvec,
+                          unsigned int vlen, int flags)
+{
+        void *native = ss->se->hooks[hid].native;
+        struct timespec start;
+        int err;
+
+        if (native) {
+                start_profile(ss, &start);
+                err = ((plugin_batch_hook_t) native)(ss->plugin_ctx, sockfd,
+                                                     msgvec, vlen, flags);
+                profile_hook(ss, hid, &start);
+                return err;
+        }
+
+        err = push_hook(ss, hid, BATCH_HOOK_CALLER_KEY);
+        if (err)
+                return err;
+
+        /* Push arguments */
+        lua_pushinteger(ss->L, sockfd);
+        lua_pushlightuserdata(ss->L, msgvec);
+        lua_pushinteger(ss->L, vlen);
+        lua_pushinteger(ss->L, flags);
+
+        return call_hook(ss, hid, 5);
 }
 
 int script_slave_socket_hook(struct script_slave *ss, int sockfd,
@@ -707,6 +1608,78 @@ ssize_t script_slave_recverr_hook(struct script_slave *ss, int sockfd,
         return run_packet_hook(ss, SCRIPT_HOOK_RECVERR, sockfd, msg, flags);
 }
 
+int script_slave_sendmmsg_hook(struct script_slave *ss, int sockfd,
+                               struct mmsghdr *msgvec, unsigned int vlen,
+                               int flags)
+{
+        return run_batch_hook(ss, SCRIPT_HOOK_SENDMMSG, sockfd, msgvec, vlen,
+                              flags);
+}
+
+int script_slave_recvmmsg_hook(struct script_slave *ss, int sockfd,
+                               struct mmsghdr *msgvec, unsigned int vlen,
+                               int flags)
+{
+        return run_batch_hook(ss, SCRIPT_HOOK_RECVMMSG, sockfd, msgvec, vlen,
+                              flags);
+}
+
+int script_slave_transaction_hook(struct script_slave *ss, int flow_id,
+                                  double latency)
+{
+        void *native = ss->se->hooks[SCRIPT_HOOK_TRANSACTION].native;
+        struct timespec start;
+        int err;
+
+        if (native) {
+                start_profile(ss, &start);
+                err = ((plugin_transaction_hook_t) native)(ss->plugin_ctx,
+                                                           flow_id, latency);
+                profile_hook(ss, SCRIPT_HOOK_TRANSACTION, &start);
+                return err;
+        }
+
+        /* Plain numbers, no caller needed to cast them */
+        err = push_hook(ss, SCRIPT_HOOK_TRANSACTION, NULL);
+        if (err)
+                return err;
+
+        /* Push arguments */
+        lua_pushinteger(ss->L, flow_id);
+        if (isnan(latency))
+                lua_pushnil(ss->L);
+        else
+                lua_pushnumber(ss->L, latency);
+
+        return call_hook(ss, SCRIPT_HOOK_TRANSACTION, 2);
+}
+
+int script_slave_interval_hook(struct script_slave *ss,
+                               const struct sample *sample)
+{
+        void *native = ss->se->hooks[SCRIPT_HOOK_INTERVAL].native;
+        struct timespec start;
+        int err;
+
+        if (native) {
+                start_profile(ss, &start);
+                err = ((plugin_interval_hook_t) native)(ss->plugin_ctx,
+                                                        sample);
+                profile_hook(ss, SCRIPT_HOOK_INTERVAL, &start);
+                return err;
+        }
+
+        err = push_hook(ss, SCRIPT_HOOK_INTERVAL, INTERVAL_HOOK_CALLER_KEY);
+        if (err)
+                return err;
+
+        /* Push arguments */
+        lua_pushinteger(ss->L, sample->tid);
+        lua_pushlightuserdata(ss->L, (void *) sample);
+
+        return call_hook(ss, SCRIPT_HOOK_INTERVAL, 3);
+}
+
 const char *script_strerror(int errnum)
 {
         switch (errnum) {
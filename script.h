@@ -21,11 +21,16 @@
 #include <stdbool.h>
 
 struct addrinfo;
+struct mmsghdr;
 struct msghdr;
 
 struct lua_State;
 struct byte_array;
 struct l_upvalue;
+struct plugin;
+struct histogram;
+struct sample;
+struct sequence;
 
 /* Stay out of errno range */
 #define SCRIPT_HOOK_ERROR_BASE (1 << 8)
@@ -51,12 +56,32 @@ enum script_hook_id {
         SCRIPT_HOOK_SENDMSG,
         SCRIPT_HOOK_RECVMSG,
         SCRIPT_HOOK_RECVERR,
+        SCRIPT_HOOK_SENDMMSG,
+        SCRIPT_HOOK_RECVMMSG,
+        SCRIPT_HOOK_TRANSACTION,
+        SCRIPT_HOOK_INTERVAL,
         SCRIPT_HOOK_MAX
 };
 
+/* How slaves run the Lua garbage collector, see --script-gc */
+enum script_gc_mode {
+        SCRIPT_GC_AUTO = 0,     /* incremental steps, within hooks */
+        SCRIPT_GC_STEP,         /* a step after hooks, every gc_step_kb */
+        SCRIPT_GC_INTERVAL,     /* a full cycle at each interval sample */
+};
+
+/* Calls of a hook, with --profile-hooks */
+struct hook_profile {
+        unsigned long calls;
+        double time;            /* seconds, in total */
+        double syscall_time;    /* of the above, in system calls from Lua */
+        struct histogram *durations;
+};
+
 struct script_hook {
         const char *name;
         struct sfunction *function;
+        void *native;                   /* from a plugin */
 };
 
 struct script_engine {
@@ -67,14 +92,42 @@ struct script_engine {
         void *run_data;
         int run_mode;
         struct collector *collectors;
+        struct plugin *plugin;
+        /* Native collectors' values, merged from all slaves */
+        double *slots;
+        unsigned char *slot_ops;
+        int num_slots;
+        struct histogram **histograms;
+        int num_histograms;
+        struct sequence *sequence;      /* declared with sequence() */
+        int num_slaves;                 /* created so far */
+        /* Garbage collector settings, and the pauses of each slave */
+        int gc_mode;
+        int gc_pause;
+        int gc_stepmul;
+        int gc_step_kb;
+        struct histogram **gc_pauses;   /* by slave, unless SCRIPT_GC_AUTO */
+        bool profile_hooks;
+        struct hook_profile **hook_profiles;    /* by slave, then hook */
 };
 
 struct script_slave {
         struct script_engine *se;
+        int index;                      /* in the order of creation */
         struct lua_State *L;
         struct callbacks *cb;
         void *hook_keys[SCRIPT_HOOK_MAX];
         struct upvalue_cache *hook_upvalues;
+        void *plugin_ctx;
+        /* Native collectors' values for this slave */
+        double *slots;
+        int num_slots;
+        struct histogram **histograms;
+        int num_histograms;
+        struct histogram *gc_pauses;    /* seconds, unless SCRIPT_GC_AUTO */
+        int gc_kb;                      /* in use after the last GC step */
+        struct hook_profile *hook_profiles;     /* by script_hook_id */
+        double syscall_time;    /* in the hook running, from the prelude */
 };
 
 int script_engine_create(struct script_engine **sep, struct callbacks *cb,
@@ -91,6 +144,50 @@ int script_engine_run_file(struct script_engine *se, const char *filename,
                            void (*run_func)(struct script_engine *, void *),
                            void *data);
 
+/**
+ * Load native hooks from a shared object, see plugin.h.
+ *
+ * To be called before any slave engine is created.
+ */
+int script_engine_load_plugin(struct script_engine *se, const char *path);
+
+/**
+ * Set how slaves collect garbage, from a --script-gc option:
+ * auto[:pause[:stepmul]], step[:kbytes] or interval.
+ *
+ * To be called before any slave engine is created.
+ */
+int script_engine_set_gc(struct script_engine *se, const char *spec);
+
+/**
+ * Time each call of the script's hooks, for script_engine_report().
+ *
+ * To be called before any slave engine is created.
+ */
+int script_engine_profile_hooks(struct script_engine *se);
+
+/**
+ * Print the hook profiles and garbage collection pauses, if measured, and let
+ * the plugin, if any, print its results.
+ */
+void script_engine_report(struct script_engine *se);
+
+/**
+ * Forget the hooks, collectors and sequence the script declared, so that it
+ * can run again for the next test of a --daemon.  Native hooks stay.
+ *
+ * To be called from the main context once the results have been reported.
+ */
+void script_engine_reset(struct script_engine *se);
+
+/**
+ * Drop the slave's Lua state and native collector values, which belong to
+ * the last run of the script.
+ *
+ * To be called from the main context when slave engine is no longer running.
+ */
+void script_slave_reset(struct script_slave *ss);
+
 /**
  * Push script values needed to execute hook functions to slave engine.
  *
@@ -133,6 +230,47 @@ ssize_t script_slave_recvmsg_hook(struct script_slave *ss, int sockfd,
 ssize_t script_slave_recverr_hook(struct script_slave *ss, int sockfd,
                                   struct msghdr *msg, int flags);
 
+/**
+ * Run batched send message hook, on up to @vlen messages.  Returns how many
+ * were sent, like sendmmsg().
+ */
+int script_slave_sendmmsg_hook(struct script_slave *ss, int sockfd,
+                               struct mmsghdr *msgvec, unsigned int vlen,
+                               int flags);
+
+/**
+ * Run batched receive message hook, on up to @vlen messages.  Returns how
+ * many were received, like recvmmsg().
+ */
+int script_slave_recvmmsg_hook(struct script_slave *ss, int sockfd,
+                               struct mmsghdr *msgvec, unsigned int vlen,
+                               int flags);
+
+/*
+ * Run transaction hook, when a request/response exchange of flow @flow_id
+ * has completed.  @latency is in seconds, NAN where it isn't measured (on
+ * the server), which the hook gets as nil.
+ */
+int script_slave_transaction_hook(struct script_slave *ss, int flow_id,
+                                  double latency);
+
+/*
+ * Run a full garbage collection cycle in SCRIPT_GC_INTERVAL mode.
+ */
+void script_slave_interval_gc(struct script_slave *ss);
+
+/*
+ * Run interval hook, on each @sample taken every --interval seconds.
+ */
+int script_slave_interval_hook(struct script_slave *ss,
+                               const struct sample *sample);
+
+/*
+ * Seconds on CLOCK_MONOTONIC, for the prelude to time system calls made by
+ * hooks, through the FFI.
+ */
+double script_clock(void);
+
 enum script_hook_error errno_lua(int err);
 const char *script_strerror(int errnum);
 
@@ -18,6 +18,186 @@ function collect(value)
   return collector;
 end
 
+--
+-- Log-linear histogram implemented in C (histogram.c). Recording a value
+-- costs a few nanoseconds, so it can be done for every packet.
+--
+F.cdef[[
+struct histogram;
+struct histogram *histogram_create(double resolution);
+void histogram_destroy(struct histogram *h);
+void histogram_add(struct histogram *h, double val);
+void histogram_reset(struct histogram *h);
+int histogram_merge(struct histogram *dst, const struct histogram *src);
+double histogram_resolution(const struct histogram *h);
+unsigned long histogram_count(const struct histogram *h);
+double histogram_min(const struct histogram *h);
+double histogram_max(const struct histogram *h);
+double histogram_mean(const struct histogram *h);
+double histogram_percentile(const struct histogram *h, int percentile);
+unsigned long histogram_count_below(const struct histogram *h, double val);
+]]
+
+local function bar(val, max, width)
+  if max == 0 then
+    return ""
+  end
+  return string.rep("=", math.ceil(width * val / max))
+end
+
+local histogram_methods = {
+  add = F.C.histogram_add,
+  reset = F.C.histogram_reset,
+  min = F.C.histogram_min,
+  max = F.C.histogram_max,
+  mean = F.C.histogram_mean,
+  percentile = F.C.histogram_percentile,
+
+  count = function (h)
+    return tonumber(F.C.histogram_count(h))
+  end,
+
+  -- Adds the values recorded in another histogram of the same resolution.
+  merge = function (h, other)
+    assert(F.C.histogram_merge(h, other) == 0, "resolutions differ")
+  end,
+
+  -- Prints counts of values between powers of two times the resolution.
+  print = function (h, unit)
+    local res = F.C.histogram_resolution(h)
+    local rows = {}
+    local max = 0
+    local lower, upper = 0, res
+    local below = 0
+
+    while below < h:count() do
+      local n = tonumber(F.C.histogram_count_below(h, upper))
+      table.insert(rows, { lower, upper, n - below })
+      max = math.max(max, n - below)
+      below = n
+      lower, upper = upper, upper * 2
+    end
+
+    print(string.format("\n%10s .. %-10s: %-10s |%-40s|\n",
+                        ">=", "< [" .. (unit or "") .. "]",
+                        "Count", "Distribution"))
+    for _, r in ipairs(rows) do
+      print(string.format("%10g -> %-10g: %-10d |%-40s|",
+                          r[1], r[2], r[3], bar(r[3], max, 40)))
+    end
+    print()
+  end,
+}
+
+F.metatype("struct histogram", { __index = histogram_methods })
+
+-- Creates a histogram recording values in multiples of resolution (1 by
+-- default), e.g. 1e-6 for seconds measured with microsecond precision.
+function histogram(resolution)
+  local h = F.C.histogram_create(resolution or 1)
+  assert(h ~= nil, "invalid resolution")
+  return F.gc(h, F.C.histogram_destroy)
+end
+
+--
+-- Native collectors keep their values in C, in slots of a double array each
+-- Lua state has. Hooks update the slots of their thread, and the main thread
+-- merges them after run(), so that the collectors' values are totals over all
+-- threads.
+--
+local SLOT_SUM = 0 -- keep in sync with enum slot_op in script.c
+local SLOT_MAX = 1
+local double_pt = F.typeof("double *")
+local histogram_ppt = F.typeof("struct histogram **")
+
+-- Called from C when the slot or histogram array of this Lua state moves.
+function set_collector_slots__(slots, histograms)
+  collector_slots__ = F.cast(double_pt, slots)
+  collector_histograms__ = F.cast(histogram_ppt, histograms)
+end
+
+-- Counter summed over all threads.
+function collect_counter()
+  local i = alloc_collector_slots__(SLOT_SUM, 1)
+
+  return {
+    add = function (self, n)
+      local s = collector_slots__
+      s[i] = s[i] + (n or 1)
+    end,
+    value = function (self)
+      return collector_slots__[i]
+    end,
+  }
+end
+
+-- Maximum of the values added in all threads, -math.huge if none.
+function collect_max()
+  local i = alloc_collector_slots__(SLOT_MAX, 1)
+
+  return {
+    add = function (self, v)
+      local s = collector_slots__
+      if v > s[i] then
+        s[i] = v
+      end
+    end,
+    value = function (self)
+      return collector_slots__[i]
+    end,
+  }
+end
+
+-- Histogram with buckets delimited by the given ascending upper bounds
+-- (exclusive). Values past the last bound are counted in an extra bucket.
+function collect_histogram(bounds)
+  local n = #bounds
+  local first = alloc_collector_slots__(SLOT_SUM, n + 1)
+
+  bounds = { unpack(bounds) }
+
+  return {
+    bounds = bounds,
+    add = function (self, v)
+      -- Binary search for the first bound above v
+      local lo, hi = 1, n + 1
+      while lo < hi do
+        local mid = bit.rshift(lo + hi, 1)
+        if v < bounds[mid] then
+          hi = mid
+        else
+          lo = mid + 1
+        end
+      end
+      local s = collector_slots__
+      s[first + lo - 1] = s[first + lo - 1] + 1
+    end,
+    -- Returns the list of bucket counts.
+    counts = function (self)
+      local counts = {}
+      for b = 1, n + 1 do
+        counts[b] = collector_slots__[first + b - 1]
+      end
+      return counts
+    end,
+  }
+end
+
+-- Log-linear histogram merged over all threads, see histogram().
+function collect_log_histogram(resolution)
+  local i = alloc_collector_histogram__(resolution or 1)
+
+  return {
+    add = function (self, v)
+      collector_histograms__[i]:add(v)
+    end,
+    -- Returns the histogram of this thread, or the merged one after run().
+    value = function (self)
+      return collector_histograms__[i]
+    end,
+  }
+end
+
 -- XXX: Push to ljsyscall?
 F.cdef[[
 struct addrinfo {
@@ -32,6 +212,46 @@ struct addrinfo {
 };
 ]]
 
+--
+-- Samples taken every --interval seconds (sample.h), which the
+-- {client,server}_interval hooks get a pointer to. Latencies are kept in a
+-- list (numlist.c) while the sample is being reported.
+--
+F.cdef[[
+struct numlist;
+size_t numlist_size(struct numlist *lst);
+double numlist_min(struct numlist *lst);
+double numlist_max(struct numlist *lst);
+double numlist_mean(struct numlist *lst);
+double numlist_stddev(struct numlist *lst);
+double numlist_percentile(struct numlist *lst, int percentile);
+
+/* keep in sync with struct sample in sample.h */
+struct sample {
+        int tid;
+        int flow_id;
+        ssize_t bytes_read;
+        unsigned long transactions;
+        struct numlist *latency;
+        struct timespec timestamp;
+        struct rusage rusage;
+        struct sample *next;
+};
+]]
+
+F.metatype("struct numlist", {
+  __index = {
+    min = F.C.numlist_min,
+    max = F.C.numlist_max,
+    mean = F.C.numlist_mean,
+    stddev = F.C.numlist_stddev,
+    percentile = F.C.numlist_percentile,
+    size = function (l)
+      return tonumber(F.C.numlist_size(l))
+    end,
+  },
+})
+
 --
 -- Types
 --
@@ -47,8 +267,8 @@ sockaddr_storage = T.sockaddr_storage
 uint32_ptr = PT.uint32
 scm_timestamping_ptr = PT.scm_timestamping
 
--- Returns a list of (name, function) pairs, sorted by function name, with all
--- system calls (functions) wrapped by ljsyscall.
+-- Returns a list of (name, function) pairs with all system calls (functions)
+-- wrapped by ljsyscall.
 local function get_sys_funcs(sys)
   local funcs = {}
 
@@ -58,7 +278,6 @@ local function get_sys_funcs(sys)
     end
   end
 
-  table.sort(funcs, function (f1, f2) return f1.name < f2.name end)
   return funcs
 end
 
@@ -173,9 +392,7 @@ end
 -- Returns a list of (name, value) all functions wrapped by ljsyscall.
 -- Constants names are sanitized to match kernel headers.
 local function get_sys_consts(sys)
-  local consts = walk_consts_group(sys.c, "")
-  table.sort(consts, function (c1, c2) return c1.name < c2.name end)
-  return consts
+  return walk_consts_group(sys.c, "")
 end
 
 -- Pull in all (name, value) pairs into a global namespace
@@ -191,9 +408,69 @@ local sys_consts = get_sys_consts(S)
 import(sys_funcs)
 import(sys_consts)
 
+-- Batched system calls for the {client,server}_{send,recv}mmsg hooks, which get
+-- a pointer to an array of struct mmsghdr and its length.  Like recvmsg() and
+-- sendmsg(), they return a number, of messages here, or nil and an error.
+F.cdef[[
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+             struct timespec *timeout);
+]]
+
+function sendmmsg(sockfd, msgvec, vlen, flags)
+  local n = F.C.sendmmsg(sockfd, msgvec, vlen, flags or 0)
+  if n == -1 then return nil, T.error(F.errno()) end
+  return n
+end
+
+function recvmmsg(sockfd, msgvec, vlen, flags)
+  local n = F.C.recvmmsg(sockfd, msgvec, vlen, flags or 0, nil)
+  if n == -1 then return nil, T.error(F.errno()) end
+  return n
+end
+
+--
+-- With --profile-hooks, the time hooks spend in system calls is counted apart
+-- from the rest of their time.
+--
+F.cdef[[
+double script_clock(void);
+]]
+
+-- Called from C, with the slave's counter of seconds spent in system calls.
+function profile_syscalls__(time)
+  local clock = F.C.script_clock
+  local syscall_time = F.cast(double_pt, time)
+
+  local function done(start, ...)
+    syscall_time[0] = syscall_time[0] + (clock() - start)
+    return ...
+  end
+
+  local function timed(func)
+    return function(...)
+      local start = clock()
+      return done(start, func(...))
+    end
+  end
+
+  for _, s in pairs(sys_funcs) do
+    _G[s.name] = timed(s.value)
+  end
+  sendmmsg = timed(sendmmsg)
+  recvmmsg = timed(recvmmsg)
+end
+
+-- Sorting is left until here, as every Lua state builds the lists.
 local function list_syms(syms)
+  local names = {}
+
   for _, s in ipairs(syms) do
-    print(s.name)
+    table.insert(names, s.name)
+  end
+  table.sort(names)
+  for _, name in ipairs(names) do
+    print(name)
   end
 end
 
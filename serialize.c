@@ -17,6 +17,7 @@
 #include "serialize.h"
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -45,7 +46,6 @@ struct supvalue {
 };
 
 struct stable_entry {
-        struct stable_entry *next;
         struct svalue key;
         struct svalue value;
         /* Collector object for the entry value */
@@ -55,6 +55,10 @@ struct stable_entry {
 struct stable {
         void *id;
         struct stable_entry *entries;
+        int num_entries;
+        int max_entries;
+        /* Entries with keys 1..n, which go to the array part of a table */
+        int num_array_entries;
 };
 
 struct sfunction {
@@ -63,24 +67,37 @@ struct sfunction {
         struct supvalue *upvalues;
 };
 
-struct upvalue_mapping {
-        struct upvalue_mapping *next;
+/*
+ * Hash map of nodes keyed by object ids, i.e. pointers. Nodes are embedded
+ * as the first member of the mappings below. Among nodes with equal keys,
+ * the one added last is found first.
+ */
+struct id_node {
+        struct id_node *next;
         void *key;
+};
+
+struct id_map {
+        struct id_node **buckets;
+        size_t num_buckets;     /* power of two */
+        size_t count;
+};
+
+struct upvalue_mapping {
+        struct id_node node;
         void *function_id;
         int upvalue_num;
 };
 
 struct object_mapping {
-        struct object_mapping *next;
-        void *key;
+        struct id_node node;
         void *object_id;
 };
 
 /* Keyed by collector object ID */
 struct collector_mapping {
-        struct collector_mapping *next;
-        /* collector object from which value was extracted */
-        void *key;
+        /* keyed by collector object from which value was extracted */
+        struct id_node node;
         /* function or table */
         void *object_id;
         /* upvalue number or table key */
@@ -90,11 +107,11 @@ struct collector_mapping {
 struct upvalue_cache {
         /* Map of serialized upvalue ids to deserialized (function id, upvalue
          * number) tuples */
-        struct upvalue_mapping *upvalue_map;
+        struct id_map upvalue_map;
         /* Map of serialized object ids to deserialized object ids */
-        struct object_mapping *object_map;
+        struct id_map object_map;
         /* Map of collector object ids to (function, upvalue number) or (table, key) pairs */
-        struct collector_mapping *collector_map;
+        struct id_map collector_map;
         /* Lua store for deserialized objects indexed by their id */
         int object_tbl_idx;
 };
@@ -112,25 +129,98 @@ static void push_object(struct callbacks *cb, lua_State *L,
                         const struct svalue *object);
 
 
-static void free_table_entry(struct stable_entry *e)
+static size_t id_hash(const void *key, size_t num_buckets)
 {
-        free_value_data(&e->key);
-        free_value_data(&e->value);
-        free(e);
+        uint64_t h = (uintptr_t) key;
+
+        /* Fibonacci hashing, the upper bits are the well mixed ones */
+        h *= 0x9e3779b97f4a7c15ULL;
+        return (h >> 32) & (num_buckets - 1);
 }
 
-static void free_table_entries(struct stable_entry *entries)
+static void id_map_grow(struct id_map *m)
 {
-        struct stable_entry *e;
+        struct id_node **buckets;
+        struct id_node *n;
+        size_t num_buckets;
+        size_t i;
+
+        num_buckets = m->num_buckets ? 2 * m->num_buckets : 16;
+        buckets = calloc(num_buckets, sizeof(*buckets));
+        assert(buckets);
+
+        for (i = 0; i < m->num_buckets; i++) {
+                struct id_node *reversed = NULL;
+
+                /* Keep the order of equal keys by moving a reversed chain */
+                LIST_FOR_EACH (m->buckets[i], n) {
+                        n->next = reversed;
+                        reversed = n;
+                }
+                LIST_FOR_EACH (reversed, n) {
+                        size_t h = id_hash(n->key, num_buckets);
+
+                        n->next = buckets[h];
+                        buckets[h] = n;
+                }
+        }
+
+        free(m->buckets);
+        m->buckets = buckets;
+        m->num_buckets = num_buckets;
+}
+
+static void id_map_add(struct id_map *m, struct id_node *n, void *key)
+{
+        size_t h;
+
+        if (m->count >= m->num_buckets)
+                id_map_grow(m);
+
+        h = id_hash(key, m->num_buckets);
+        n->key = key;
+        n->next = m->buckets[h];
+        m->buckets[h] = n;
+        m->count++;
+}
+
+static struct id_node *id_map_find(const struct id_map *m, const void *key)
+{
+        struct id_node *n;
+
+        if (!m->count)
+                return NULL;
+
+        for (n = m->buckets[id_hash(key, m->num_buckets)]; n; n = n->next) {
+                if (n->key == key)
+                        return n;
+        }
+        return NULL;
+}
+
+static void id_map_clear(struct id_map *m, void (*free_node)(struct id_node *))
+{
+        struct id_node *n;
+        size_t i;
 
-        LIST_FOR_EACH (entries, e)
-                free_table_entry(e);
+        for (i = 0; i < m->num_buckets; i++) {
+                LIST_FOR_EACH (m->buckets[i], n)
+                        free_node(n);
+        }
+        free(m->buckets);
+        memset(m, 0, sizeof(*m));
 }
 
 static void free_table(struct stable *t)
 {
+        struct stable_entry *e;
+
         if (t) {
-                free_table_entries(t->entries);
+                for (e = t->entries; e < t->entries + t->num_entries; e++) {
+                        free_value_data(&e->key);
+                        free_value_data(&e->value);
+                }
+                free(t->entries);
                 free(t);
         }
 }
@@ -276,27 +366,45 @@ static void *unwrap_collector_maybe(lua_State *L)
         return collector_id;
 }
 
-static struct stable_entry *dump_table_entries(struct callbacks *cb,
-                                                lua_State *L)
+static struct stable_entry *add_table_entry(struct callbacks *cb,
+                                            struct stable *t)
+{
+        struct stable_entry *e;
+
+        if (t->num_entries == t->max_entries) {
+                t->max_entries = t->max_entries ? 2 * t->max_entries : 8;
+                t->entries = realloc(t->entries,
+                                     t->max_entries * sizeof(*t->entries));
+                if (!t->entries)
+                        LOG_FATAL(cb, "realloc failed");
+        }
+
+        e = &t->entries[t->num_entries++];
+        memset(e, 0, sizeof(*e));
+        return e;
+}
+
+static void dump_table_entries(struct callbacks *cb, lua_State *L,
+                               struct stable *t)
 {
-        struct stable_entry *head = NULL;
+        /* Number of keys the array part holds, for sizing the copy */
+        size_t len = lua_objlen(L, -1);
 
         lua_pushnil(L);
         while (lua_next(L, -2)) {
-                struct stable_entry *e = calloc(1, sizeof(*e));
-                if (!e)
-                        LOG_FATAL(cb, "calloc failed");
-                e->next = head;
-                head = e;
+                struct stable_entry *e = add_table_entry(cb, t);
 
                 e->collector_id = unwrap_collector_maybe(L);
                 serialize_object(cb, L, &e->value);
                 lua_pop(L, 1);
                 serialize_object(cb, L, &e->key);
                 /* leave key on stack */
-        }
 
-        return head;
+                if (e->key.type == LUA_TNUMBER && e->key.number >= 1 &&
+                    e->key.number <= len &&
+                    e->key.number == (lua_Integer) e->key.number)
+                        t->num_array_entries++;
+        }
 }
 
 static struct stable *serialize_table(struct callbacks *cb, lua_State *L)
@@ -307,7 +415,7 @@ static struct stable *serialize_table(struct callbacks *cb, lua_State *L)
         assert(t);
 
         t->id = (void *) lua_topointer(L, -1);
-        t->entries = dump_table_entries(cb, L);
+        dump_table_entries(cb, L, t);
 
         return t;
 }
@@ -416,11 +524,9 @@ static void map_object(struct upvalue_cache *cache, void *key,
 
         m = calloc(1, sizeof(*m));
         assert(m);
-        m->key = key;
         m->object_id = object_id;
 
-        m->next = cache->object_map;
-        cache->object_map = m;
+        id_map_add(&cache->object_map, &m->node, key);
 }
 
 static void copy_value(const struct svalue *src, struct svalue *dst)
@@ -442,24 +548,16 @@ static void map_collector(struct upvalue_cache *cache,
 
         m = calloc(1, sizeof(*m));
         assert(m);
-        m->key = key;
         m->object_id = object_id;
         copy_value(value_key, &m->value_key);
 
-        m->next = cache->collector_map;
-        cache->collector_map = m;
+        id_map_add(&cache->collector_map, &m->node, key);
 }
 
 static const struct object_mapping *lookup_object(struct upvalue_cache *cache,
                                                   void *key)
 {
-        struct object_mapping *m;
-
-        LIST_FOR_EACH (cache->object_map, m) {
-                if (m->key == key)
-                        return m;
-        }
-        return NULL;
+        return (struct object_mapping *) id_map_find(&cache->object_map, key);
 }
 
 static void *cache_object(struct upvalue_cache *cache, lua_State *L)
@@ -501,24 +599,16 @@ static void map_upvalue(struct upvalue_cache *cache,
 
         m = calloc(1, sizeof(*m));
         assert(m);
-        m->key = upvalue->id;
         m->function_id = function_id;
         m->upvalue_num = upvalue->number;
 
-        m->next = cache->upvalue_map;
-        cache->upvalue_map = m;
+        id_map_add(&cache->upvalue_map, &m->node, upvalue->id);
 }
 
 static const struct upvalue_mapping *lookup_upvalue(struct upvalue_cache *cache,
                                                     void *key)
 {
-        struct upvalue_mapping *m;
-
-        LIST_FOR_EACH (cache->upvalue_map, m) {
-                if (m->key == key)
-                        return m;
-        }
-        return NULL;
+        return (struct upvalue_mapping *) id_map_find(&cache->upvalue_map, key);
 }
 
 static void push_table(struct callbacks *cb, lua_State *L,
@@ -528,12 +618,13 @@ static void push_table(struct callbacks *cb, lua_State *L,
         struct stable_entry *e;
         void *tid;
 
-        lua_newtable(L);
+        lua_createtable(L, table->num_array_entries,
+                        table->num_entries - table->num_array_entries);
 
         tid = cache_object(cache, L);
         map_object(cache, table->id, tid);
 
-        LIST_FOR_EACH (table->entries, e) {
+        for (e = table->entries; e < table->entries + table->num_entries; e++) {
                 push_object(cb, L, cache, &e->key);
                 push_object(cb, L, cache, &e->value);
                 lua_rawset(L, -3);
@@ -589,38 +680,25 @@ struct upvalue_cache *upvalue_cache_new(void)
         return calloc(1, sizeof(struct upvalue_cache));
 }
 
-static void free_object_mappings(struct object_mapping *mappings)
+static void free_mapping(struct id_node *n)
 {
-        struct object_mapping *m;
-
-        LIST_FOR_EACH (mappings, m)
-                free(m);
+        free(n);
 }
 
-static void free_upvalue_mappings(struct upvalue_mapping *mappings)
+static void free_collector_mapping(struct id_node *n)
 {
-        struct upvalue_mapping *m;
+        struct collector_mapping *m = (struct collector_mapping *) n;
 
-        LIST_FOR_EACH (mappings, m)
-                free(m);
-}
-
-static void free_collector_mappings(struct collector_mapping *mappings)
-{
-        struct collector_mapping *m;
-
-        LIST_FOR_EACH (mappings, m) {
-                free_value_data(&m->value_key);
-                free(m);
-        }
+        free_value_data(&m->value_key);
+        free(m);
 }
 
 void free_upvalue_cache(struct upvalue_cache *c)
 {
         if (c) {
-                free_object_mappings(c->object_map);
-                free_upvalue_mappings(c->upvalue_map);
-                free_collector_mappings(c->collector_map);
+                id_map_clear(&c->object_map, free_mapping);
+                id_map_clear(&c->upvalue_map, free_mapping);
+                id_map_clear(&c->collector_map, free_collector_mapping);
                 free(c);
         }
 }
@@ -742,26 +820,25 @@ void push_collected_value(struct callbacks *cb, lua_State *L,
 
         cache->object_tbl_idx = cache_idx;
 
-        LIST_FOR_EACH (cache->collector_map, m) {
-                if (m->key != collector_id)
-                        continue;
-
-                fetch_object(cache, L, m->object_id);
-                if (lua_isfunction(L, -1)) {
-                        const char *name;
-
-                        name = lua_getupvalue(L, -1, m->value_key.number);
-                        assert(name);
-                } else if (lua_istable(L, -1)) {
-                        push_object(cb, L, cache, &m->value_key);
-                        lua_rawget(L, -2);
-                } else {
-                        LOG_FATAL(cb, "Expected function or table object but got %s",
-                                  lua_typename(L, lua_type(L, -1)));
-                }
-                lua_remove(L, -2); /* fetched object */
-                return; /* got it */
+        m = (struct collector_mapping *) id_map_find(&cache->collector_map,
+                                                     collector_id);
+        if (!m) {
+                lua_pushnil(L); /* not found */
+                return;
         }
 
-        lua_pushnil(L); /* not found */
+        fetch_object(cache, L, m->object_id);
+        if (lua_isfunction(L, -1)) {
+                const char *name;
+
+                name = lua_getupvalue(L, -1, m->value_key.number);
+                assert(name);
+        } else if (lua_istable(L, -1)) {
+                push_object(cb, L, cache, &m->value_key);
+                lua_rawget(L, -2);
+        } else {
+                LOG_FATAL(cb, "Expected function or table object but got %s",
+                          lua_typename(L, lua_type(L, -1)));
+        }
+        lua_remove(L, -2); /* fetched object */
 }
@@ -0,0 +1,425 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "server_pool.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "common.h"
+#include "flow.h"
+#include "lib.h"
+#include "logging.h"
+#include "ring.h"
+#include "thread.h"
+
+#define QUEUE_SIZE 4096 /* flows waiting for a worker */
+
+enum server_model {
+        SERVER_RTC,
+        SERVER_DISPATCH,
+        SERVER_SHARED,
+};
+
+static const char *const server_model_names[] = {
+        [SERVER_RTC]      = "rtc",
+        [SERVER_DISPATCH] = "dispatch",
+        [SERVER_SHARED]   = "shared",
+};
+
+struct server_pool {
+        enum server_model model;
+        int num_threads;
+        pthread_barrier_t barrier;      /* listen socket set up or closed */
+        int epfd;                       /* shared epoll set */
+        struct flow *listen_fl;
+        struct ring **queues;           /* dispatch: one per worker */
+        int *queue_efds;                /* dispatch: wake up a worker */
+};
+
+static enum server_model get_server_model(const char *name,
+                                          struct callbacks *cb)
+{
+        int i;
+
+        for (i = 0; i < ARRAY_SIZE(server_model_names); i++) {
+                if (!strcmp(name, server_model_names[i]))
+                        return i;
+        }
+        LOG_FATAL(cb, "unknown server model: %s", name);
+        return SERVER_RTC;
+}
+
+struct server_pool *server_pool_create(const char *model, int num_threads,
+                                       struct callbacks *cb)
+{
+        struct server_pool *p;
+        int i, s;
+
+        if (get_server_model(model, cb) == SERVER_RTC)
+                return NULL;
+
+        p = calloc(1, sizeof(*p));
+        if (!p)
+                PLOG_FATAL(cb, "calloc server pool");
+        p->model = get_server_model(model, cb);
+        p->num_threads = num_threads;
+        s = pthread_barrier_init(&p->barrier, NULL, num_threads);
+        if (s != 0)
+                LOG_FATAL(cb, "pthread_barrier_init: %s", strerror(s));
+        p->epfd = epoll_create1(0);
+        if (p->epfd == -1)
+                PLOG_FATAL(cb, "epoll_create1");
+
+        if (p->model != SERVER_DISPATCH)
+                return p;
+        if (num_threads < 2)
+                LOG_FATAL(cb, "dispatch server model needs at least 2 threads");
+
+        /* Queue 0 stays unused, thread 0 is the dispatcher. */
+        p->queues = calloc(num_threads, sizeof(p->queues[0]));
+        p->queue_efds = calloc(num_threads, sizeof(p->queue_efds[0]));
+        if (!p->queues || !p->queue_efds)
+                PLOG_FATAL(cb, "calloc worker queues");
+        for (i = 1; i < num_threads; i++) {
+                p->queues[i] = ring_create(QUEUE_SIZE);
+                if (!p->queues[i])
+                        PLOG_FATAL(cb, "ring_create");
+                p->queue_efds[i] = eventfd(0, EFD_NONBLOCK);
+                if (p->queue_efds[i] == -1)
+                        PLOG_FATAL(cb, "eventfd");
+        }
+        return p;
+}
+
+void server_pool_destroy(struct server_pool *p)
+{
+        int i;
+
+        if (!p)
+                return;
+        if (p->queues) {
+                for (i = 1; i < p->num_threads; i++) {
+                        ring_destroy(p->queues[i]);
+                        do_close(p->queue_efds[i]);
+                }
+        }
+        free(p->queues);
+        free(p->queue_efds);
+        do_close(p->epfd);
+        pthread_barrier_destroy(&p->barrier);
+        free(p);
+}
+
+/* One-shot flows have to be re-armed after every event.  Drop the flow if
+ * that fails.
+ */
+static void rearm(struct thread *t, int epfd, struct flow *flow,
+                  uint32_t events)
+{
+        if (modflow(epfd, flow, events | EPOLLONESHOT))
+                delflow(t->index, epfd, flow, t->cb);
+}
+
+static int wait_for_events(struct thread *t, const struct socket_ops *ops,
+                           int epfd, struct epoll_event *events, int maxevents,
+                           int timeout)
+{
+        int nfds;
+
+        nfds = do_epoll_wait(ops, epfd, events, maxevents, timeout);
+        if (nfds == -1) {
+                if (errno == EINTR)
+                        return 0;
+                PLOG_FATAL(t->cb, "epoll_wait");
+        }
+        return nfds;
+}
+
+static void listen_start(struct thread *t, const struct socket_ops *ops,
+                         uint32_t flags)
+{
+        struct server_pool *p = t->pool;
+        int fd_listen;
+
+        fd_listen = server_socket_open(t, ops);
+        p->listen_fl = addflow(t->index, p->epfd, fd_listen,
+                               t->next_flow_id++, EPOLLIN | flags, t->cb);
+}
+
+static void listen_stop(struct thread *t, const struct socket_ops *ops)
+{
+        struct server_pool *p = t->pool;
+
+        server_socket_close(t, ops, p->listen_fl->fd);
+        delflow(t->index, p->epfd, p->listen_fl, t->cb);
+}
+
+/* Leader/follower: whoever wakes up first takes the ready flows, the others
+ * go back to sleep.
+ */
+static void run_shared(struct thread *t, const struct socket_ops *ops,
+                       accept_flow_t accept_flow, process_flow_t process_flow)
+{
+        struct server_pool *p = t->pool;
+        struct options *opts = t->opts;
+        struct callbacks *cb = t->cb;
+        struct epoll_event wakeup[2], *events;
+        struct flow *stop_fl, *shared_fl, *flow;
+        int ms = opts->nonblocking ? 10 /* milliseconds */ : -1;
+        int epfd, nfds, i;
+        uint32_t next;
+        char *buf;
+
+        if (t->index == 0)
+                listen_start(t, ops, EPOLLONESHOT);
+        pthread_barrier_wait(&p->barrier);
+
+        epfd = epoll_create1(0);
+        if (epfd == -1)
+                PLOG_FATAL(cb, "epoll_create1");
+        stop_fl = addflow_lite(epfd, t->stop_efd, EPOLLIN, cb);
+        shared_fl = addflow_lite(epfd, p->epfd, EPOLLIN, cb);
+        events = calloc(opts->maxevents, sizeof(struct epoll_event));
+        buf = buf_alloc(t);
+        if (!buf)
+                PLOG_FATAL(cb, "buf_alloc");
+        thread_wait_start(t);
+        while (!t->stop) {
+                nfds = wait_for_events(t, ops, epfd, wakeup,
+                                       ARRAY_SIZE(wakeup), ms);
+                for (i = 0; i < nfds; i++) {
+                        if (wakeup[i].data.ptr == stop_fl)
+                                t->stop = 1;
+                }
+                if (t->stop)
+                        break;
+
+                nfds = wait_for_events(t, ops, p->epfd, events,
+                                       opts->maxevents, 0);
+                for (i = 0; i < nfds; i++) {
+                        flow = events[i].data.ptr;
+                        if (flow == p->listen_fl) {
+                                accept_flow(t, flow->fd, p->epfd,
+                                            EPOLLONESHOT);
+                                rearm(t, p->epfd, flow, EPOLLIN);
+                                continue;
+                        }
+                        next = process_flow(t, p->epfd, flow,
+                                            events[i].events, buf);
+                        if (next)
+                                rearm(t, p->epfd, flow, next);
+                }
+        }
+
+        pthread_barrier_wait(&p->barrier);
+        if (t->index == 0)
+                listen_stop(t, ops);
+
+        free(buf);
+        free(events);
+        free(shared_fl);
+        free(stop_fl);
+        do_close(epfd);
+}
+
+static void wake_worker(struct thread *t, int worker)
+{
+        if (eventfd_write(t->pool->queue_efds[worker], 1))
+                PLOG_FATAL(t->cb, "eventfd_write");
+}
+
+/* Thread 0 reads requests and dispatches flows with a complete request to
+ * workers.  A flow always goes to the same worker.
+ */
+static void run_dispatcher(struct thread *t, const struct socket_ops *ops,
+                           accept_flow_t accept_flow,
+                           process_flow_t process_flow)
+{
+        struct server_pool *p = t->pool;
+        struct options *opts = t->opts;
+        struct callbacks *cb = t->cb;
+        const int num_workers = p->num_threads - 1;
+        struct epoll_event *events;
+        struct flow *stop_fl, *flow;
+        int ms = opts->nonblocking ? 10 /* milliseconds */ : -1;
+        int nfds, i, w;
+        uint32_t next;
+        bool *wake;
+        char *buf;
+
+        listen_start(t, ops, 0);
+        pthread_barrier_wait(&p->barrier);
+
+        stop_fl = addflow_lite(p->epfd, t->stop_efd, EPOLLIN, cb);
+        wake = calloc(p->num_threads, sizeof(*wake));
+        events = calloc(opts->maxevents, sizeof(struct epoll_event));
+        buf = buf_alloc(t);
+        if (!buf)
+                PLOG_FATAL(cb, "buf_alloc");
+        thread_wait_start(t);
+        while (!t->stop) {
+                nfds = wait_for_events(t, ops, p->epfd, events,
+                                       opts->maxevents, ms);
+                for (i = 0; i < nfds; i++) {
+                        flow = events[i].data.ptr;
+                        if (flow == stop_fl) {
+                                t->stop = 1;
+                                break;
+                        }
+                        if (flow == p->listen_fl) {
+                                accept_flow(t, flow->fd, p->epfd,
+                                            EPOLLONESHOT);
+                                continue;
+                        }
+                        next = process_flow(t, p->epfd, flow,
+                                            events[i].events, buf);
+                        if (!next)
+                                continue;
+                        if (!(next & EPOLLOUT)) {
+                                rearm(t, p->epfd, flow, next);
+                                continue;
+                        }
+                        w = 1 + flow->id % num_workers;
+                        while (!ring_push(p->queues[w], flow)) {
+                                wake_worker(t, w);
+                                sched_yield();
+                        }
+                        wake[w] = true;
+                }
+                /* One wake-up per worker and batch of events. */
+                for (w = 1; w < p->num_threads; w++) {
+                        if (wake[w]) {
+                                wake_worker(t, w);
+                                wake[w] = false;
+                        }
+                }
+        }
+
+        pthread_barrier_wait(&p->barrier);
+        listen_stop(t, ops);
+        epoll_del_or_err(p->epfd, t->stop_efd, cb);
+
+        free(buf);
+        free(events);
+        free(wake);
+        free(stop_fl);
+}
+
+/* Writes out a response.  If the socket buffer fills up, the flow waits in
+ * the worker's own epoll set @epfd.  Once the response is complete the flow
+ * goes back to the dispatcher.
+ */
+static void respond(struct thread *t, int epfd, struct flow *flow,
+                    uint32_t events, bool waiting,
+                    process_flow_t process_flow, char *buf)
+{
+        struct server_pool *p = t->pool;
+        struct epoll_event ev;
+        uint32_t next;
+
+        next = process_flow(t, waiting ? epfd : p->epfd, flow, events, buf);
+        if (!next)
+                return;
+        if (next & EPOLLOUT) {
+                if (!waiting) {
+                        flow->events = EPOLLOUT;
+                        ev.events = flow->events;
+                        ev.data.ptr = flow;
+                        epoll_ctl_or_die(epfd, EPOLL_CTL_ADD, flow->fd, &ev,
+                                         t->cb);
+                }
+                return;
+        }
+        if (waiting)
+                epoll_del_or_err(epfd, flow->fd, t->cb);
+        rearm(t, p->epfd, flow, next);
+}
+
+static void run_worker(struct thread *t, const struct socket_ops *ops,
+                       process_flow_t process_flow)
+{
+        struct server_pool *p = t->pool;
+        struct ring *queue = p->queues[t->index];
+        struct options *opts = t->opts;
+        struct callbacks *cb = t->cb;
+        struct epoll_event *events;
+        struct flow *stop_fl, *queue_fl, *flow;
+        int ms = opts->nonblocking ? 10 /* milliseconds */ : -1;
+        int epfd, nfds, i;
+        eventfd_t n;
+        char *buf;
+
+        pthread_barrier_wait(&p->barrier);
+
+        epfd = epoll_create1(0);
+        if (epfd == -1)
+                PLOG_FATAL(cb, "epoll_create1");
+        stop_fl = addflow_lite(epfd, t->stop_efd, EPOLLIN, cb);
+        queue_fl = addflow_lite(epfd, p->queue_efds[t->index], EPOLLIN, cb);
+        events = calloc(opts->maxevents, sizeof(struct epoll_event));
+        buf = buf_alloc(t);
+        if (!buf)
+                PLOG_FATAL(cb, "buf_alloc");
+        thread_wait_start(t);
+        while (!t->stop) {
+                nfds = wait_for_events(t, ops, epfd, events, opts->maxevents,
+                                       ms);
+                for (i = 0; i < nfds; i++) {
+                        flow = events[i].data.ptr;
+                        if (flow == stop_fl) {
+                                t->stop = 1;
+                                break;
+                        }
+                        if (flow == queue_fl) {
+                                eventfd_read(queue_fl->fd, &n);
+                                while ((flow = ring_pop(queue)))
+                                        respond(t, epfd, flow, EPOLLOUT, false,
+                                                process_flow, buf);
+                                continue;
+                        }
+                        respond(t, epfd, flow, events[i].events, true,
+                                process_flow, buf);
+                }
+        }
+
+        pthread_barrier_wait(&p->barrier);
+
+        free(buf);
+        free(events);
+        free(queue_fl);
+        free(stop_fl);
+        do_close(epfd);
+}
+
+void run_server_pool(struct thread *t, const struct socket_ops *ops,
+                     accept_flow_t accept_flow, process_flow_t process_flow)
+{
+        struct server_pool *p = t->pool;
+
+        t->ops = ops;
+        if (p->model == SERVER_SHARED)
+                run_shared(t, ops, accept_flow, process_flow);
+        else if (t->index == 0)
+                run_dispatcher(t, ops, accept_flow, process_flow);
+        else
+                run_worker(t, ops, process_flow);
+}
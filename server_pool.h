@@ -0,0 +1,46 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEPER_SERVER_POOL_H
+#define NEPER_SERVER_POOL_H
+
+/*
+ * Server threading models other than run-to-completion, where each thread
+ * serves its own connections from start to end:
+ *
+ * dispatch - thread 0 accepts connections and reads requests, then hands
+ *            each flow over a lock-free queue to one of the other threads,
+ *            which writes the response and gives the flow back,
+ * shared   - all threads wait on a single epoll set, each flow registered
+ *            with EPOLLONESHOT so that only one thread at a time serves it.
+ */
+
+#include "workload.h"
+
+struct callbacks;
+struct server_pool;
+struct thread;
+
+/* Returns NULL for the run-to-completion model. */
+struct server_pool *server_pool_create(const char *model, int num_threads,
+                                       struct callbacks *cb);
+void server_pool_destroy(struct server_pool *p);
+
+/* Main routine for server threads in a pool */
+void run_server_pool(struct thread *t, const struct socket_ops *ops,
+                     accept_flow_t accept_flow, process_flow_t process_flow);
+
+#endif
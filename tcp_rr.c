@@ -28,9 +28,12 @@
 #include "flow.h"
 #include "interval.h"
 #include "lib.h"
+#include "null_transport.h"
 #include "numlist.h"
 #include "percentiles.h"
 #include "sample.h"
+#include "script.h"
+#include "server_pool.h"
 #include "thread.h"
 #include "workload.h"
 
@@ -40,13 +43,16 @@ static inline void track_write_time(struct options *opts, struct flow *flow)
                 clock_gettime(CLOCK_MONOTONIC, &flow->write_time);
 }
 
-static inline void track_finish_time(struct flow *flow)
+/* Returns the latency of the transaction just finished, in seconds. */
+static inline double track_finish_time(struct flow *flow)
 {
         struct timespec finish_time;
+        double latency;
 
         clock_gettime(CLOCK_MONOTONIC, &finish_time);
-        numlist_add(flow->latency, seconds_between(&flow->write_time,
-                                                   &finish_time));
+        latency = seconds_between(&flow->write_time, &finish_time);
+        numlist_add(flow->latency, latency);
+        return latency;
 }
 
 static void client_events(struct thread *t, int epfd,
@@ -58,6 +64,7 @@ static void client_events(struct thread *t, int epfd,
         struct callbacks *cb = t->cb;
         struct flow *flow;
         ssize_t num_bytes;
+        double latency;
         int i;
 
         UNUSED(listen_fd);
@@ -81,45 +88,49 @@ static void client_events(struct thread *t, int epfd,
                                 flags |= MSG_MORE;
                         }
                         track_write_time(opts, flow);
-                        num_bytes = do_write(ss, flow->fd, buf, to_write, flags);
+                        num_bytes = do_write(ss, t->ops, flow->fd, buf,
+                                             to_write, flags);
                         if (num_bytes == -1) {
-                                PLOG_ERROR(cb, "write");
+                                if (errno != EAGAIN)
+                                        PLOG_ERROR(cb, "write");
                                 continue;
                         }
                         flow->bytes_to_write -= num_bytes;
                         if (flow->bytes_to_write > 0)
                                 continue;
                         /* Successfully sent request, now wait for response */
-                        events[i].events = EPOLLRDHUP | EPOLLIN;
-                        epoll_ctl_or_die(epfd, EPOLL_CTL_MOD, flow->fd,
-                                         &events[i], cb);
+                        if (modflow(epfd, flow, EPOLLRDHUP | EPOLLIN))
+                                PLOG_FATAL(cb, "epoll_ctl");
                         flow->bytes_to_read = opts->response_size;
                 } else if (events[i].events & EPOLLIN) {
                         ssize_t to_read = flow->bytes_to_read;
 
                         if (to_read > opts->buffer_size)
                                 to_read = opts->buffer_size;
-                        num_bytes = do_read(ss, flow->fd, buf, to_read, 0);
+                        num_bytes = do_read(ss, t->ops, flow->fd, buf,
+                                            to_read, 0);
                         if (num_bytes == -1) {
-                                PLOG_ERROR(cb, "read");
+                                if (errno != EAGAIN)
+                                        PLOG_ERROR(cb, "read");
                                 continue;
                         }
                         if (num_bytes == 0) {
                                 delflow(t->index, epfd, flow, cb);
                                 continue;
                         }
+                        t->bytes_read += num_bytes;
                         flow->bytes_read += num_bytes;
                         flow->bytes_to_read -= num_bytes;
                         if (flow->bytes_to_read > 0)
                                 continue;
                         t->transactions++;
                         flow->transactions++;
-                        track_finish_time(flow);
+                        latency = track_finish_time(flow);
+                        script_slave_transaction_hook(ss, flow->id, latency);
                         interval_collect(flow, t);
                         /* Successfully read resp., now wait to send request */
-                        events[i].events = EPOLLRDHUP | EPOLLOUT;
-                        epoll_ctl_or_die(epfd, EPOLL_CTL_MOD, flow->fd,
-                                         &events[i], cb);
+                        if (modflow(epfd, flow, EPOLLRDHUP | EPOLLOUT))
+                                PLOG_FATAL(cb, "epoll_ctl");
                         flow->bytes_to_write = opts->request_size;
                 }
         }
@@ -132,9 +143,10 @@ static void client_events(struct thread *t, int epfd,
  *
  * After a client socket fd is obtained, a new flow is created as part
  * of the thread @t.  The state of the flow is set to "waiting for a
- * request".
+ * request".  @flags are added to the flow's epoll events.
  */
-static void server_accept(int fd_listen, int epfd, struct thread *t)
+static void server_accept(struct thread *t, int fd_listen, int epfd,
+                          uint32_t flags)
 {
         struct options *opts = t->opts;
         struct callbacks *cb = t->cb;
@@ -144,7 +156,8 @@ static void server_accept(int fd_listen, int epfd, struct thread *t)
         int client;
 
         cli_len = sizeof(cli_addr);
-        client = accept(fd_listen, (struct sockaddr *)&cli_addr, &cli_len);
+        client = socket_accept(t->ops, fd_listen, (struct sockaddr *)&cli_addr,
+                               &cli_len);
         if (client == -1) {
                 if (errno == EINTR || errno == ECONNABORTED)
                         return;
@@ -154,19 +167,87 @@ static void server_accept(int fd_listen, int epfd, struct thread *t)
         setup_connected_socket(client, opts, cb);
 
         flow = addflow(t->index, epfd, client, t->next_flow_id++,
-                       EPOLLIN, cb);
+                       EPOLLIN | flags, cb);
         flow->bytes_to_read = opts->request_size;
         flow->itv = interval_create(opts->interval, t);
 }
 
-static void server_events(struct thread *t, int epfd,
-                          struct epoll_event *events, int nfds, int fd_listen,
-                          char *buf)
+/**
+ * Advances the request/response state machine of a server flow on @events.
+ * Returns the events the flow waits for next, or 0 if the flow has been
+ * deleted.
+ */
+static uint32_t server_flow(struct thread *t, int epfd, struct flow *flow,
+                            uint32_t events, char *buf)
 {
         struct script_slave *ss = t->script_slave;
         struct options *opts = t->opts;
         struct callbacks *cb = t->cb;
         ssize_t num_bytes;
+
+        if (events & EPOLLRDHUP) {
+                delflow(t->index, epfd, flow, cb);
+                return 0;
+        }
+        if (events & EPOLLIN) {
+                ssize_t to_read = flow->bytes_to_read;
+
+                if (to_read > opts->buffer_size)
+                        to_read = opts->buffer_size;
+                num_bytes = do_read(ss, t->ops, flow->fd, buf, to_read,
+                                    0);
+                if (num_bytes == -1) {
+                        if (errno != EAGAIN)
+                                PLOG_ERROR(cb, "read");
+                        return EPOLLRDHUP | EPOLLIN;
+                }
+                if (num_bytes == 0) {
+                        delflow(t->index, epfd, flow, cb);
+                        return 0;
+                }
+                t->bytes_read += num_bytes;
+                flow->bytes_read += num_bytes;
+                flow->bytes_to_read -= num_bytes;
+                if (flow->bytes_to_read > 0)
+                        return EPOLLRDHUP | EPOLLIN;
+                /* Successfully read request, now send a response */
+                flow->bytes_to_write = opts->response_size;
+                return EPOLLRDHUP | EPOLLOUT;
+        } else if (events & EPOLLOUT) {
+                ssize_t to_write = flow->bytes_to_write;
+                int flags = 0;
+
+                if (to_write > opts->buffer_size) {
+                        to_write = opts->buffer_size;
+                        flags |= MSG_MORE;
+                }
+                num_bytes = do_write(ss, t->ops, flow->fd, buf, to_write,
+                                     flags);
+                if (num_bytes == -1) {
+                        if (errno != EAGAIN)
+                                PLOG_ERROR(cb, "write");
+                        return EPOLLRDHUP | EPOLLOUT;
+                }
+                flow->bytes_to_write -= num_bytes;
+                if (flow->bytes_to_write > 0)
+                        return EPOLLRDHUP | EPOLLOUT;
+                t->transactions++;
+                flow->transactions++;
+                script_slave_transaction_hook(ss, flow->id, NAN);
+                interval_collect(flow, t);
+                /* Successfully write response, now read a request */
+                flow->bytes_to_read = opts->request_size;
+                return EPOLLRDHUP | EPOLLIN;
+        }
+        return flow->events;
+}
+
+static void server_events(struct thread *t, int epfd,
+                          struct epoll_event *events, int nfds, int fd_listen,
+                          char *buf)
+{
+        struct callbacks *cb = t->cb;
+        uint32_t next;
         int i;
 
         for (i = 0; i < nfds; i++) {
@@ -176,68 +257,13 @@ static void server_events(struct thread *t, int epfd,
                         break;
                 }
                 if (flow->fd == fd_listen) {
-                        server_accept(fd_listen, epfd, t);
+                        server_accept(t, fd_listen, epfd, 0);
                         continue;
                 }
-                if (events[i].events & EPOLLRDHUP) {
+                next = server_flow(t, epfd, flow, events[i].events, buf);
+                if (next && next != flow->events && modflow(epfd, flow, next)) {
+                        /* not necessarily fatal, just drop */
                         delflow(t->index, epfd, flow, cb);
-                        continue;
-                }
-                if (events[i].events & EPOLLIN) {
-                        ssize_t to_read = flow->bytes_to_read;
-
-                        if (to_read > opts->buffer_size)
-                                to_read = opts->buffer_size;
-                        num_bytes = do_read(ss, flow->fd, buf, to_read, 0);
-                        if (num_bytes == -1) {
-                                PLOG_ERROR(cb, "read");
-                                continue;
-                        }
-                        if (num_bytes == 0) {
-                                delflow(t->index, epfd, flow, cb);
-                                continue;
-                        }
-                        flow->bytes_read += num_bytes;
-                        flow->bytes_to_read -= num_bytes;
-                        if (flow->bytes_to_read > 0)
-                                continue;
-                        /* Successfully read request, now send a response */
-                        events[i].events = EPOLLRDHUP | EPOLLOUT;
-                        if (epoll_ctl(epfd, EPOLL_CTL_MOD, flow->fd,
-                                      &events[i])) {
-                                /* not necessarily fatal, just drop */
-                                delflow(t->index, epfd, flow, cb);
-                                continue;
-                        }
-                        flow->bytes_to_write = opts->response_size;
-                } else if (events[i].events & EPOLLOUT) {
-                        ssize_t to_write = flow->bytes_to_write;
-                        int flags = 0;
-
-                        if (to_write > opts->buffer_size) {
-                                to_write = opts->buffer_size;
-                                flags |= MSG_MORE;
-                        }
-                        num_bytes = do_write(ss, flow->fd, buf, to_write, flags);
-                        if (num_bytes == -1) {
-                                PLOG_ERROR(cb, "write");
-                                continue;
-                        }
-                        flow->bytes_to_write -= num_bytes;
-                        if (flow->bytes_to_write > 0)
-                                continue;
-                        t->transactions++;
-                        flow->transactions++;
-                        interval_collect(flow, t);
-                        /* Successfully write response, now read a request */
-                        events[i].events = EPOLLRDHUP | EPOLLIN;
-                        if (epoll_ctl(epfd, EPOLL_CTL_MOD, flow->fd,
-                                      &events[i])) {
-                                /* not necessarily fatal, just drop */
-                                delflow(t->index, epfd, flow, cb);
-                                continue;
-                        }
-                        flow->bytes_to_read = opts->request_size;
                 }
         }
 }
@@ -245,11 +271,25 @@ static void server_events(struct thread *t, int epfd,
 static void *thread_start(void *arg)
 {
         struct thread *t = arg;
+        const struct socket_ops *ops = t->opts->null_transport ?
+                                       &null_socket_ops : &tcp_socket_ops;
+
         reset_port(t->ai, atoi(t->opts->port), t->cb);
-        if (t->opts->client)
-                run_client(t, &tcp_socket_ops, client_events);
-        else
-                run_server(t, &tcp_socket_ops, server_events);
+        if (thread_sequence(t)) {
+                if (t->opts->client)
+                        run_sequence_client(t, ops);
+                else if (t->pool)
+                        run_server_pool(t, ops, sequence_server_accept,
+                                        sequence_server_flow);
+                else
+                        run_server(t, ops, sequence_server_events);
+        } else if (t->opts->client) {
+                run_client(t, ops, client_events);
+        } else if (t->pool) {
+                run_server_pool(t, ops, server_accept, server_flow);
+        } else {
+                run_server(t, ops, server_events);
+        }
         return NULL;
 }
 
@@ -279,6 +319,27 @@ static void report_latency(struct sample *samples, int start, int end,
         }
 }
 
+/* Split the throughput between nodes by each thread's share of work. */
+static void report_throughput_per_node(struct thread *tinfo, double throughput)
+{
+        struct options *opts = tinfo[0].opts;
+        CLEANUP(free) double *per_thread = NULL;
+        unsigned long total = 0;
+        int i;
+
+        for (i = 0; i < opts->num_threads; i++)
+                total += tinfo[i].transactions;
+        if (!total)
+                return;
+        per_thread = calloc(i, sizeof(*per_thread));
+        if (!per_thread)
+                return;
+        for (i = 0; i < opts->num_threads; i++)
+                per_thread[i] = throughput * tinfo[i].transactions / total;
+        print_throughput_per_node(tinfo[0].cb, tinfo, opts->num_threads,
+                                  per_thread, "throughput");
+}
+
 static void report_stats(struct thread *tinfo)
 {
         struct sample *p, *samples;
@@ -290,15 +351,18 @@ static void report_stats(struct thread *tinfo)
         struct options *opts = tinfo[0].opts;
         struct callbacks *cb = tinfo[0].cb;
 
+        /* Only transactions in the measurement window count, that is up to
+         * the last sample of each flow in it.
+         */
         num_samples = 0;
-        current_total = 0;
         for (i = 0; i < opts->num_threads; i++) {
-                for (p = tinfo[i].samples; p; p = p->next)
-                        num_samples++;
-                current_total += tinfo[i].transactions;
+                for (p = tinfo[i].samples; p; p = p->next) {
+                        if (sample_in_window(p, tinfo[i].window_end))
+                                num_samples++;
+                }
         }
-        PRINT(cb, "num_transactions", "%lu", current_total);
         if (num_samples == 0) {
+                PRINT(cb, "num_transactions", "%d", 0);
                 LOG_WARN(cb, "no sample collected");
                 return;
         }
@@ -306,9 +370,12 @@ static void report_stats(struct thread *tinfo)
         if (!samples)
                 LOG_FATAL(cb, "calloc samples");
         j = 0;
-        for (i = 0; i < opts->num_threads; i++)
-                for (p = tinfo[i].samples; p; p = p->next)
-                        samples[j++] = *p;
+        for (i = 0; i < opts->num_threads; i++) {
+                for (p = tinfo[i].samples; p; p = p->next) {
+                        if (sample_in_window(p, tinfo[i].window_end))
+                                samples[j++] = *p;
+                }
+        }
         qsort(samples, num_samples, sizeof(samples[0]), compare_samples);
         if (opts->all_samples) {
                 print_samples(&opts->percentiles, samples, num_samples,
@@ -320,6 +387,8 @@ static void report_stats(struct thread *tinfo)
         PRINT(cb, "end_index", "%d", end_index);
         PRINT(cb, "num_samples", "%d", num_samples);
         if (start_index >= end_index) {
+                PRINT(cb, "num_transactions", "%lu",
+                      samples[start_index].transactions);
                 LOG_WARN(cb, "insufficient number of samples");
                 return;
         }
@@ -331,9 +400,11 @@ static void report_stats(struct thread *tinfo)
                 LOG_FATAL(cb, "calloc per_flow");
         for (i = 0; i < opts->num_threads; i++) {
                 int max_flow_id = 0;
-                for (p = tinfo[i].samples; p; p = p->next) {
-                        if (p->flow_id > max_flow_id)
-                                max_flow_id = p->flow_id;
+                /* Flows may be sampled by threads other than their own. */
+                for (j = 0; j < num_samples; j++) {
+                        if (samples[j].tid == i &&
+                            samples[j].flow_id > max_flow_id)
+                                max_flow_id = samples[j].flow_id;
                 }
                 per_flow[i] = calloc(max_flow_id + 1, sizeof(unsigned long));
                 if (!per_flow[i])
@@ -356,10 +427,12 @@ static void report_stats(struct thread *tinfo)
                 sum_xx += duration * duration;
                 sum_yy += total_work * total_work;
         }
+        PRINT(cb, "num_transactions", "%lu", current_total);
         throughput = total_work / duration;
         correlation_coefficient = sum_xy / sqrt(sum_xx * sum_yy);
         PRINT(cb, "throughput", "%.2f", throughput);
         PRINT(cb, "correlation_coefficient", "%.2f", correlation_coefficient);
+        report_throughput_per_node(tinfo, throughput);
         for (i = 0; i < opts->num_threads; i++)
                 free(per_flow[i]);
         free(per_flow);
@@ -371,5 +444,8 @@ static void report_stats(struct thread *tinfo)
 
 int tcp_rr(struct options *opts, struct callbacks *cb)
 {
+        if (opts->null_transport)
+                return run_null_transport(opts, cb, thread_start,
+                                          report_stats);
         return run_main_thread(opts, cb, thread_start, report_stats);
 }
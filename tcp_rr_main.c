@@ -20,8 +20,8 @@
 
 static void check_options(struct options *opts, struct callbacks *cb)
 {
-        CHECK(cb, opts->test_length >= 1,
-              "Test length must be at least 1 second.");
+        CHECK(cb, opts->test_length >= 0.001,
+              "Test length must be at least 1 millisecond.");
         CHECK(cb, opts->maxevents >= 1,
               "Number of epoll events must be positive.");
         CHECK(cb, opts->num_flows >= 1,
@@ -50,6 +50,12 @@ static void check_options(struct options *opts, struct callbacks *cb)
               "Buffer size must be positive.");
         CHECK(cb, opts->client || (opts->local_host == NULL),
               "local_host may only be set for clients.");
+        CHECK(cb, !opts->null_transport || !opts->daemon,
+              "The null transport runs a single test.");
+        CHECK(cb, !opts->null_transport || (!opts->script && !opts->plugin),
+              "Script and plugin hooks do not run over the null transport.");
+        CHECK(cb, !opts->client || !opts->daemon,
+              "Only servers can run as daemons.");
         CHECK(cb, opts->listen_backlog <= procfile_int(PROCFILE_SOMAXCONN, cb),
               "listen() backlog cannot exceed " PROCFILE_SOMAXCONN);
 }
@@ -70,7 +76,7 @@ int main(int argc, char **argv)
         DEFINE_FLAG(fp, int,          num_flows,     1,       'F', "Total number of flows");
         DEFINE_FLAG(fp, int,          num_threads,   1,       'T', "Number of threads");
         DEFINE_FLAG(fp, int,          num_clients,   1,        0,  "Number of clients");
-        DEFINE_FLAG(fp, int,          test_length,   10,      'l', "Test length in seconds");
+        DEFINE_FLAG(fp, double,       test_length,   10.0,    'l', "Test length in seconds");
         DEFINE_FLAG(fp, int,          request_size,  1,       'Q', "Number of bytes in a request from client to server");
         DEFINE_FLAG(fp, int,          response_size, 1,       'R', "Number of bytes in a response from server to client");
         DEFINE_FLAG(fp, int,          buffer_size,   65536,   'B', "Number of bytes that each read()/send() can transfer at once");
@@ -84,6 +90,11 @@ int main(int argc, char **argv)
         DEFINE_FLAG(fp, bool,         pin_cpu,       false,   'U', "Pin threads to CPU cores");
         DEFINE_FLAG(fp, bool,         logtostderr,   false,   'V', "Log to stderr");
         DEFINE_FLAG(fp, bool,         nonblocking,   false,    0,  "Make sure syscalls are all nonblocking");
+        DEFINE_FLAG(fp, bool,         rebalance,     false,    0,  "Move flows from busy threads to idle ones");
+        DEFINE_FLAG(fp, bool,         low_latency,   false,    0,  "Real-time threads, locked memory and no deep C-states");
+        DEFINE_FLAG(fp, bool,         daemon,        false,    0,  "Server: keep serving tests, with parameters from the clients");
+        DEFINE_FLAG(fp, bool,         null_transport, false,   0,  "Run client and server in one process over in-memory rings");
+        DEFINE_FLAG(fp, const char *, server_model,  NULL,     0,  "Server threads: rtc (default), dispatch or shared");
         DEFINE_FLAG(fp, double,       interval,      1.0,     'I', "For how many seconds that a sample is generated");
         DEFINE_FLAG(fp, long long,    max_pacing_rate, 0,     'm', "SO_MAX_PACING_RATE value; use as 32-bit unsigned");
         DEFINE_FLAG_PARSER(fp, max_pacing_rate, parse_max_pacing_rate);
@@ -91,6 +102,9 @@ int main(int argc, char **argv)
         DEFINE_FLAG(fp, const char *, host,          NULL,    'H', "Server hostname or IP address");
         DEFINE_FLAG(fp, const char *, control_port,  "12866", 'C', "Server control port");
         DEFINE_FLAG(fp, const char *, port,          "12867", 'P', "Server data port");
+        DEFINE_FLAG(fp, const char *, pin_policy,    NULL,     0,  "Policy for --pin-cpu: core, compact, scatter, node or nosmt");
+        DEFINE_FLAG(fp, const char *, cpus,          NULL,     0,  "Pin threads to these CPUs, e.g. 2-9,18-25");
+        DEFINE_FLAG(fp, const char *, skip_irq_cpus, NULL,     0,  "Do not pin threads to CPUs servicing IRQs of this interface");
         DEFINE_FLAG(fp, const char *, all_samples,   NULL,    'A', "Print all samples? If yes, this is the output file name");
         DEFINE_FLAG_HAS_OPTIONAL_ARGUMENT(fp, all_samples);
         DEFINE_FLAG_PARSER(fp, all_samples, parse_all_samples);
@@ -100,6 +114,9 @@ int main(int argc, char **argv)
         flags_parser_run(fp, argc, argv);
         if (opts.logtostderr)
                 cb.logtostderr(cb.logger);
+        /* The server side is run by run_null_transport() */
+        if (opts.null_transport)
+                opts.client = true;
         flags_parser_dump(fp);
         flags_parser_destroy(fp);
 
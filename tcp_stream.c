@@ -28,6 +28,7 @@
 #include "interval.h"
 #include "lib.h"
 #include "logging.h"
+#include "null_transport.h"
 #include "sample.h"
 #include "thread.h"
 #include "workload.h"
@@ -50,7 +51,8 @@ static void server_accept(int fd_listen, int epfd, struct thread *t)
         int client;
 
         cli_len = sizeof(cli_addr);
-        client = accept(fd_listen, (struct sockaddr *)&cli_addr, &cli_len);
+        client = socket_accept(t->ops, fd_listen, (struct sockaddr *)&cli_addr,
+                               &cli_len);
         if (client == -1) {
                 if (errno == EINTR || errno == ECONNABORTED)
                         return;
@@ -91,7 +93,7 @@ static void process_events(struct thread *t, int epfd,
                 }
                 if (opts->enable_read && (events[i].events & EPOLLIN)) {
 read_again:
-                        num_bytes = do_read(ss, flow->fd, buf,
+                        num_bytes = do_read(ss, t->ops, flow->fd, buf,
                                             opts->buffer_size, 0);
                         if (num_bytes == -1) {
                                 if (errno != EAGAIN)
@@ -102,6 +104,7 @@ read_again:
                                 delflow(t->index, epfd, flow, cb);
                                 continue;
                         }
+                        t->bytes_read += num_bytes;
                         flow->bytes_read += num_bytes;
                         flow->transactions++;
                         interval_collect(flow, t);
@@ -110,7 +113,7 @@ read_again:
                 }
                 if (opts->enable_write && (events[i].events & EPOLLOUT)) {
 write_again:
-                        num_bytes = do_write(ss, flow->fd, buf,
+                        num_bytes = do_write(ss, t->ops, flow->fd, buf,
                                              opts->buffer_size, 0);
                         if (num_bytes == -1) {
                                 if (errno != EAGAIN)
@@ -140,11 +143,14 @@ write_again:
 static void *worker_thread(void *arg)
 {
         struct thread *t = arg;
+        const struct socket_ops *ops = t->opts->null_transport ?
+                                       &null_socket_ops : &tcp_socket_ops;
+
         reset_port(t->ai, atoi(t->opts->port), t->cb);
         if (t->opts->client)
-                run_client(t, &tcp_socket_ops, process_events);
+                run_client(t, ops, process_events);
         else
-                run_server(t, &tcp_socket_ops, process_events);
+                run_server(t, ops, process_events);
         return NULL;
 }
 
@@ -152,5 +158,8 @@ int tcp_stream(struct options *opts, struct callbacks *cb)
 {
         if (opts->delay)
                 prctl(PR_SET_TIMERSLACK, 1UL);
+        if (opts->null_transport)
+                return run_null_transport(opts, cb, worker_thread,
+                                          report_stream_stats);
         return run_main_thread(opts, cb, worker_thread, report_stream_stats);
 }
@@ -30,8 +30,8 @@ static void check_options(struct options *opts, struct callbacks *cb)
                 CHECK(cb, opts->num_flows >= opts->num_threads,
                       "There should not be less flows than threads.");
         }
-        CHECK(cb, opts->test_length >= 1,
-              "Test length must be at least 1 second.");
+        CHECK(cb, opts->test_length >= 0.001,
+              "Test length must be at least 1 millisecond.");
         CHECK(cb, opts->buffer_size > 0,
               "Buffer size must be positive.");
         CHECK(cb, opts->interval > 0,
@@ -46,6 +46,12 @@ static void check_options(struct options *opts, struct callbacks *cb)
               "Max pacing rate cannot exceed 32 bits.");
         CHECK(cb, opts->client || (opts->local_host == NULL),
               "local_host may only be set for clients.");
+        CHECK(cb, !opts->null_transport || !opts->daemon,
+              "The null transport runs a single test.");
+        CHECK(cb, !opts->null_transport || (!opts->script && !opts->plugin),
+              "Script and plugin hooks do not run over the null transport.");
+        CHECK(cb, !opts->client || !opts->daemon,
+              "Only servers can run as daemons.");
         CHECK(cb, opts->listen_backlog <= procfile_int(PROCFILE_SOMAXCONN, cb),
               "listen() backlog cannot exceed " PROCFILE_SOMAXCONN);
 }
@@ -66,7 +72,7 @@ int main(int argc, char **argv)
         DEFINE_FLAG(fp, int,           num_flows,       1,       'F', "Total number of flows");
         DEFINE_FLAG(fp, int,           num_threads,     1,       'T', "Number of threads");
         DEFINE_FLAG(fp, int,           num_clients,     1,        0,  "Number of clients");
-        DEFINE_FLAG(fp, int,           test_length,     10,      'l', "Test length in seconds");
+        DEFINE_FLAG(fp, double,        test_length,     10.0,    'l', "Test length in seconds");
         DEFINE_FLAG(fp, int,           buffer_size,     16384,   'B', "Number of bytes that each read/write uses as the buffer");
         DEFINE_FLAG(fp, int,           listen_backlog,  128,      0,  "Backlog size for listen()");
         DEFINE_FLAG(fp, int,           suicide_length,  0,       's', "Suicide length in seconds");
@@ -79,6 +85,10 @@ int main(int argc, char **argv)
         DEFINE_FLAG(fp, bool,          reuseaddr,       false,   'R', "Use SO_REUSEADDR on sockets");
         DEFINE_FLAG(fp, bool,          logtostderr,     false,   'V', "Log to stderr");
         DEFINE_FLAG(fp, bool,          nonblocking,     false,    0,  "Make sure syscalls are all nonblocking");
+        DEFINE_FLAG(fp, bool,          rebalance,       false,    0,  "Move flows from busy threads to idle ones");
+        DEFINE_FLAG(fp, bool,          low_latency,     false,    0,  "Real-time threads, locked memory and no deep C-states");
+        DEFINE_FLAG(fp, bool,          daemon,          false,    0,  "Server: keep serving tests, with parameters from the clients");
+        DEFINE_FLAG(fp, bool,          null_transport,  false,    0,  "Run client and server in one process over in-memory rings");
         DEFINE_FLAG(fp, bool,          enable_read,     false,   'r', "Read from flows? enabled by default for the server");
         DEFINE_FLAG(fp, bool,          enable_write,    false,   'w', "Write to flows? Enabled by default for the client");
         DEFINE_FLAG(fp, bool,          edge_trigger,    false,   'E', "Edge-triggered epoll");
@@ -90,12 +100,18 @@ int main(int argc, char **argv)
         DEFINE_FLAG(fp, const char *,  host,            NULL,    'H', "Server hostname or IP address");
         DEFINE_FLAG(fp, const char *,  control_port,    "12866", 'C', "Server control port");
         DEFINE_FLAG(fp, const char *,  port,            "12867", 'P', "Server data port");
+        DEFINE_FLAG(fp, const char *,  pin_policy,      NULL,     0,  "Policy for --pin-cpu: core, compact, scatter, node or nosmt");
+        DEFINE_FLAG(fp, const char *,  cpus,            NULL,     0,  "Pin threads to these CPUs, e.g. 2-9,18-25");
+        DEFINE_FLAG(fp, const char *,  skip_irq_cpus,   NULL,     0,  "Do not pin threads to CPUs servicing IRQs of this interface");
         DEFINE_FLAG(fp, const char *,  all_samples,     NULL,    'A', "Print all samples? If yes, this is the output file name");
         DEFINE_FLAG_HAS_OPTIONAL_ARGUMENT(fp, all_samples);
         DEFINE_FLAG_PARSER(fp, all_samples, parse_all_samples);
         flags_parser_run(fp, argc, argv);
         if (opts.logtostderr)
                 cb.logtostderr(cb.logger);
+        /* The server side is run by run_null_transport() */
+        if (opts.null_transport)
+                opts.client = true;
 
         if (opts.client)
                 opts.enable_write = true;
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The data path: a small message written to and read back from a socket,
+ * straight through the system calls and through Lua socket hooks.
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "common.h"
+#include "logging.h"
+#include "script.h"
+
+#define MSG_SIZE 64
+
+static const char hooks_src[] =
+        "client_sendmsg(\n"
+        "  function (sockfd, msg, flags)\n"
+        "    return sendmsg(sockfd, msg, flags)\n"
+        "  end\n"
+        ")\n"
+        "client_recvmsg(\n"
+        "  function (sockfd, msg, flags)\n"
+        "    return recvmsg(sockfd, msg, flags)\n"
+        "  end\n"
+        ")\n";
+
+struct io {
+        struct callbacks *cb;
+        struct script_slave *ss;
+        int fds[2];
+        char buf[MSG_SIZE];
+};
+
+static void bench_write_read(void *arg, long n)
+{
+        struct io *io = arg;
+        long i;
+
+        for (i = 0; i < n; i++) {
+                if (do_write(io->ss, NULL, io->fds[0], io->buf, MSG_SIZE,
+                             0) != MSG_SIZE)
+                        PLOG_FATAL(io->cb, "write");
+                if (do_read(io->ss, NULL, io->fds[1], io->buf, MSG_SIZE,
+                            0) != MSG_SIZE)
+                        PLOG_FATAL(io->cb, "read");
+        }
+}
+
+static void run(const char *name, struct callbacks *cb, const char *script)
+{
+        struct script_engine *se = NULL;
+        struct io io = { .cb = cb };
+
+        if (script_engine_create(&se, cb, true))
+                LOG_FATAL(cb, "failed to create script engine");
+        if (script && script_engine_run_string(se, script, NULL, NULL))
+                LOG_FATAL(cb, "failed to run script");
+        if (script_slave_create(&io.ss, se))
+                LOG_FATAL(cb, "failed to create script slave");
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, io.fds))
+                PLOG_FATAL(cb, "socketpair");
+        fill_random(io.buf, MSG_SIZE);
+
+        bench_run(name, bench_write_read, &io);
+
+        close(io.fds[0]);
+        close(io.fds[1]);
+        script_slave_destroy(io.ss);
+        script_engine_destroy(se);
+}
+
+int main(void)
+{
+        struct callbacks cb = {};
+
+        logging_init(&cb);
+        run("do_write_read_64", &cb, NULL);
+        run("do_write_read_64_lua_hooks", &cb, hooks_src);
+        logging_exit(&cb);
+        return 0;
+}
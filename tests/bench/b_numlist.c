@@ -0,0 +1,69 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Latency list, to which tcp_rr adds a value per transaction.
+ */
+
+#include <stdlib.h>
+
+#include "bench.h"
+#include "common.h"
+#include "logging.h"
+#include "numlist.h"
+
+#define PERCENTILE_LIST_SIZE 10000
+
+static void bench_numlist_add(void *arg, long n)
+{
+        struct numlist *lst = numlist_create(arg);
+        long i;
+
+        for (i = 0; i < n; i++)
+                numlist_add(lst, i * 1e-6);
+        numlist_destroy(lst);
+}
+
+static void bench_numlist_percentile(void *arg, long n)
+{
+        volatile double p;
+        long i;
+
+        for (i = 0; i < n; i++)
+                p = numlist_percentile(arg, 99);
+        (void) p;
+}
+
+int main(void)
+{
+        struct callbacks cb = {};
+        struct numlist *lst;
+        int i;
+
+        logging_init(&cb);
+
+        bench_run("numlist_add", bench_numlist_add, &cb);
+
+        lst = numlist_create(&cb);
+        srand(1);
+        for (i = 0; i < PERCENTILE_LIST_SIZE; i++)
+                numlist_add(lst, rand() * 1e-9);
+        bench_run("numlist_percentile_10k", bench_numlist_percentile, lst);
+        numlist_destroy(lst);
+
+        logging_exit(&cb);
+        return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Sampling of flows every --interval, and the statistics calculated from
+ * the samples once the test is over.
+ */
+
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "bench.h"
+#include "common.h"
+#include "flow.h"
+#include "interval.h"
+#include "logging.h"
+#include "numlist.h"
+#include "sample.h"
+#include "script.h"
+#include "thread.h"
+#include "workload.h"
+
+/* Synthetic sample set: 4 threads with 16 flows each, sampled 60 times */
+#define STATS_THREADS 4
+#define STATS_FLOWS 16
+#define STATS_SAMPLES 60
+
+struct sampling {
+        struct thread t;
+        struct flow flow;
+        struct timespec time_start;
+        pthread_mutex_t time_start_mutex;
+        struct rusage rusage_start;
+};
+
+static void bench_add_sample(void *arg, long n)
+{
+        struct sampling *s = arg;
+        struct timespec now;
+        long i;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for (i = 0; i < n; i++)
+                add_sample(s->t.index, &s->flow, &now, &s->t.samples, s->t.cb);
+        free_samples(s->t.samples);
+        s->t.samples = NULL;
+}
+
+static void bench_interval_collect(void *arg, long n)
+{
+        struct sampling *s = arg;
+        long i;
+
+        for (i = 0; i < n; i++)
+                interval_collect(&s->flow, &s->t);
+        free_samples(s->t.samples);
+        s->t.samples = NULL;
+}
+
+static void bench_calculate_stream_stats(void *arg, long n)
+{
+        const struct thread *threads = arg;
+        struct stats stats;
+        long i;
+
+        for (i = 0; i < n; i++)
+                calculate_stream_stats(threads, STATS_THREADS, &stats, NULL);
+}
+
+static void init_sampling(struct sampling *s, struct callbacks *cb,
+                          struct script_slave *ss, double interval)
+{
+        s->t.cb = cb;
+        s->t.script_slave = ss;
+        s->t.time_start = &s->time_start;
+        s->t.time_start_mutex = &s->time_start_mutex;
+        s->t.rusage_start = &s->rusage_start;
+        pthread_mutex_init(&s->time_start_mutex, NULL);
+        s->flow.latency = numlist_create(cb);
+        s->flow.itv = interval_create(interval, &s->t);
+}
+
+static void fini_sampling(struct sampling *s)
+{
+        interval_destroy(s->flow.itv);
+        numlist_destroy(s->flow.latency);
+        pthread_mutex_destroy(&s->time_start_mutex);
+}
+
+static struct sample *synthetic_samples(int tid)
+{
+        struct sample *samples, *s;
+        int flow, i;
+
+        samples = calloc(STATS_FLOWS * STATS_SAMPLES, sizeof(*samples));
+        for (flow = 0; flow < STATS_FLOWS; flow++) {
+                for (i = 0; i < STATS_SAMPLES; i++) {
+                        s = &samples[flow * STATS_SAMPLES + i];
+                        s->tid = tid;
+                        s->flow_id = tid * STATS_FLOWS + flow;
+                        s->bytes_read = (i + 1) * (1 << 20) + flow * 4096;
+                        s->timestamp.tv_sec = i + 1;
+                        s->timestamp.tv_nsec = flow * 1000;
+                        s->next = s + 1;
+                }
+        }
+        samples[STATS_FLOWS * STATS_SAMPLES - 1].next = NULL;
+        return samples;
+}
+
+int main(void)
+{
+        struct thread threads[STATS_THREADS] = {};
+        struct script_engine *se = NULL;
+        struct script_slave *ss = NULL;
+        struct callbacks cb = {};
+        struct sampling s = {};
+        int i;
+
+        logging_init(&cb);
+        if (script_engine_create(&se, &cb, true) ||
+            script_slave_create(&ss, se))
+                LOG_FATAL(&cb, "failed to create script engine");
+
+        init_sampling(&s, &cb, ss, 1.0);
+        bench_run("add_sample", bench_add_sample, &s);
+        /* Nothing to sample, the common case */
+        bench_run("interval_collect", bench_interval_collect, &s);
+        fini_sampling(&s);
+
+        memset(&s, 0, sizeof(s));
+        init_sampling(&s, &cb, ss, 1e-9);
+        bench_run("interval_collect_sample", bench_interval_collect, &s);
+        fini_sampling(&s);
+
+        for (i = 0; i < STATS_THREADS; i++) {
+                threads[i].index = i;
+                threads[i].samples = synthetic_samples(i);
+        }
+        bench_run("calculate_stream_stats_3840", bench_calculate_stream_stats,
+                  threads);
+        for (i = 0; i < STATS_THREADS; i++)
+                free(threads[i].samples);
+
+        script_slave_destroy(ss);
+        script_engine_destroy(se);
+        logging_exit(&cb);
+        return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Round trip of a Lua value between two Lua states, as done when a script's
+ * collected values are pulled from a worker into the main engine.
+ */
+
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "bench.h"
+#include "common.h"
+#include "logging.h"
+#include "serialize.h"
+
+/* A table of numbers, strings and nested tables, like a collected stats row */
+static const char value_src[] =
+        "local t = { name = 'flow', samples = {}, tags = {} }\n"
+        "for i = 1, 64 do t.samples[i] = i * 1.5 end\n"
+        "for i = 1, 8 do t.tags['tag' .. i] = { id = i, on = i % 2 == 0 } end\n"
+        "return t\n";
+
+struct round_trip {
+        struct callbacks *cb;
+        lua_State *src;
+        lua_State *dst;
+};
+
+static void bench_round_trip(void *arg, long n)
+{
+        struct round_trip *rt = arg;
+        struct upvalue_cache *cache;
+        struct svalue *sv;
+        int cache_idx;
+        long i;
+
+        for (i = 0; i < n; i++) {
+                sv = serialize_value(rt->cb, rt->src);
+
+                cache = upvalue_cache_new();
+                lua_newtable(rt->dst);
+                cache_idx = lua_gettop(rt->dst);
+                deserialize_value(rt->cb, rt->dst, cache, cache_idx, sv);
+                lua_pop(rt->dst, 2); /* value, cache tbl */
+                free_upvalue_cache(cache);
+                free_svalue(sv);
+        }
+}
+
+int main(void)
+{
+        struct callbacks cb = {};
+        struct round_trip rt = { .cb = &cb };
+
+        logging_init(&cb);
+        rt.src = luaL_newstate();
+        rt.dst = luaL_newstate();
+        if (!rt.src || !rt.dst)
+                LOG_FATAL(&cb, "failed to create Lua state");
+        luaL_openlibs(rt.src);
+        if (luaL_dostring(rt.src, value_src))
+                LOG_FATAL(&cb, "%s", lua_tostring(rt.src, -1));
+
+        bench_run("serialize_round_trip", bench_round_trip, &rt);
+
+        lua_close(rt.dst);
+        lua_close(rt.src);
+        logging_exit(&cb);
+        return 0;
+}
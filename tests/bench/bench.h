@@ -0,0 +1,65 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Minimal harness for the microbenchmarks run by `make bench`.
+ *
+ * Each benchmark is a function running its operation @n times.  It is called
+ * with a doubling @n until a run takes long enough to time, and the result
+ * is printed as one line of key=value pairs:
+ *
+ *   bench=<name> iterations=<n> ns_per_op=<nanoseconds>
+ */
+
+#ifndef NEPER_BENCH_H
+#define NEPER_BENCH_H
+
+#include <stdio.h>
+#include <time.h>
+
+/* Shortest run we trust the timing of, in seconds */
+#define BENCH_MIN_TIME 0.25
+
+typedef void (*bench_fn_t)(void *arg, long n);
+
+static inline double bench_now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline void bench_run(const char *name, bench_fn_t fn, void *arg)
+{
+        double start, elapsed;
+        long n;
+
+        /* Warm up caches, the JIT and the allocator first */
+        fn(arg, 1);
+        for (n = 1;; n *= 2) {
+                start = bench_now();
+                fn(arg, n);
+                elapsed = bench_now() - start;
+                if (elapsed >= BENCH_MIN_TIME)
+                        break;
+        }
+        printf("bench=%s iterations=%ld ns_per_op=%.2f\n", name, n,
+               elapsed * 1e9 / n);
+        fflush(stdout);
+}
+
+#endif
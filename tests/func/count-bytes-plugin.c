@@ -0,0 +1,94 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Plugin counting the bytes each thread sends and receives.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "plugin.h"
+
+struct counters {
+        size_t sent;
+        size_t received;
+};
+
+static struct counters total;
+
+static ssize_t count(ssize_t n, size_t *bytes)
+{
+        if (n < 0)
+                return -errno;
+        *bytes += n;
+        return n;
+}
+
+ssize_t client_sendmsg(void *ctx, int sockfd, struct msghdr *msg, int flags)
+{
+        struct counters *c = ctx;
+
+        return count(sendmsg(sockfd, msg, flags), &c->sent);
+}
+
+ssize_t client_recvmsg(void *ctx, int sockfd, struct msghdr *msg, int flags)
+{
+        struct counters *c = ctx;
+
+        return count(recvmsg(sockfd, msg, flags), &c->received);
+}
+
+ssize_t server_sendmsg(void *ctx, int sockfd, struct msghdr *msg, int flags)
+{
+        struct counters *c = ctx;
+
+        return count(sendmsg(sockfd, msg, flags), &c->sent);
+}
+
+ssize_t server_recvmsg(void *ctx, int sockfd, struct msghdr *msg, int flags)
+{
+        struct counters *c = ctx;
+
+        return count(recvmsg(sockfd, msg, flags), &c->received);
+}
+
+void *plugin_thread_init(int index)
+{
+        return calloc(1, sizeof(struct counters));
+}
+
+void plugin_thread_collect(void *ctx)
+{
+        struct counters *c = ctx;
+
+        total.sent += c->sent;
+        total.received += c->received;
+}
+
+void plugin_report(void (*print)(void *logger, const char *key,
+                                 const char *value, ...),
+                   void *logger)
+{
+        print(logger, "plugin_bytes_sent", "%zu", total.sent);
+        print(logger, "plugin_bytes_received", "%zu", total.received);
+}
+
+void plugin_thread_fini(void *ctx)
+{
+        free(ctx);
+}
@@ -0,0 +1,23 @@
+--
+-- A handshake, then queries over the same connection until it gets replaced.
+--
+local transactions = collect_counter()
+
+sequence {
+  setup = { { send = 64 }, { recv = 64 } },
+  { send = 100 },
+  { think = 0.001 },
+  { recv = 100000 },
+  reuse = 10,
+}
+
+client_transaction(
+  function (flow_id, latency)
+    transactions:add()
+    return 0
+  end
+)
+
+run()
+
+print(string.format("script_transactions=%d", transactions:value()))
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Tests for parsing and formatting CPU lists.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <errno.h>
+#include <string.h>
+
+#include "common.h"
+#include "cpuinfo.h"
+
+
+static void t_parse_cpulist_ranges(void **state)
+{
+        cpu_set_t set;
+
+        UNUSED(state);
+
+        assert_int_equal(0, parse_cpulist("0-3,8,10-11", &set));
+        assert_int_equal(7, CPU_COUNT(&set));
+        assert_true(CPU_ISSET(0, &set));
+        assert_true(CPU_ISSET(3, &set));
+        assert_false(CPU_ISSET(4, &set));
+        assert_true(CPU_ISSET(8, &set));
+        assert_false(CPU_ISSET(9, &set));
+        assert_true(CPU_ISSET(11, &set));
+
+        /* as read from sysfs */
+        assert_int_equal(0, parse_cpulist("2-3\n", &set));
+        assert_int_equal(2, CPU_COUNT(&set));
+
+        assert_int_equal(0, parse_cpulist("5-5", &set));
+        assert_int_equal(1, CPU_COUNT(&set));
+        assert_true(CPU_ISSET(5, &set));
+}
+
+static void t_parse_cpulist_duplicates(void **state)
+{
+        cpu_set_t set;
+
+        UNUSED(state);
+
+        assert_int_equal(0, parse_cpulist("3,1,1,0-2,2-3", &set));
+        assert_int_equal(4, CPU_COUNT(&set));
+        assert_true(CPU_ISSET(0, &set));
+        assert_true(CPU_ISSET(3, &set));
+}
+
+static void t_parse_cpulist_invalid(void **state)
+{
+        const char *const invalid[] = {
+                "a", "-1", "1-", "3-1", "1,,2", "1 2", "0-3x", "1;2",
+        };
+        char big[32];
+        cpu_set_t set;
+        size_t i;
+
+        UNUSED(state);
+
+        for (i = 0; i < ARRAY_SIZE(invalid); i++) {
+                errno = 0;
+                assert_int_equal(-1, parse_cpulist(invalid[i], &set));
+                assert_int_equal(EINVAL, errno);
+        }
+
+        snprintf(big, sizeof(big), "%d", CPU_SETSIZE);
+        assert_int_equal(-1, parse_cpulist(big, &set));
+        snprintf(big, sizeof(big), "0-%d", CPU_SETSIZE - 1);
+        assert_int_equal(0, parse_cpulist(big, &set));
+        assert_int_equal(CPU_SETSIZE, CPU_COUNT(&set));
+}
+
+static void t_parse_cpulist_empty(void **state)
+{
+        cpu_set_t set;
+
+        UNUSED(state);
+
+        CPU_SET(1, &set);
+        assert_int_equal(0, parse_cpulist("", &set));
+        assert_int_equal(0, CPU_COUNT(&set));
+        assert_int_equal(0, parse_cpulist("\n", &set));
+        assert_int_equal(0, CPU_COUNT(&set));
+}
+
+static void t_format_cpulist(void **state)
+{
+        char buf[64];
+        cpu_set_t set;
+
+        UNUSED(state);
+
+        CPU_ZERO(&set);
+        assert_string_equal("", format_cpulist(&set, buf, sizeof(buf)));
+
+        assert_int_equal(0, parse_cpulist("11,10,8,0-3,2", &set));
+        assert_string_equal("0-3,8,10-11",
+                            format_cpulist(&set, buf, sizeof(buf)));
+
+        CPU_ZERO(&set);
+        CPU_SET(CPU_SETSIZE - 1, &set);
+        snprintf(buf, sizeof(buf), "%d", CPU_SETSIZE - 1);
+        assert_string_equal(buf, format_cpulist(&set, buf, sizeof(buf)));
+}
+
+static void t_format_cpulist_truncated(void **state)
+{
+        char buf[5];
+        cpu_set_t set;
+
+        UNUSED(state);
+
+        assert_int_equal(0, parse_cpulist("0-3,8,10-11", &set));
+        /* cut short, but still terminated */
+        assert_string_equal("0-3,", format_cpulist(&set, buf, sizeof(buf)));
+}
+
+int main(void)
+{
+        const struct CMUnitTest tests[] = {
+                cmocka_unit_test(t_parse_cpulist_ranges),
+                cmocka_unit_test(t_parse_cpulist_duplicates),
+                cmocka_unit_test(t_parse_cpulist_invalid),
+                cmocka_unit_test(t_parse_cpulist_empty),
+                cmocka_unit_test(t_format_cpulist),
+                cmocka_unit_test(t_format_cpulist_truncated),
+        };
+
+        return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Tests for the mergeable log-linear histogram.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "histogram.h"
+
+
+static void t_histogram_empty(void **state)
+{
+        struct histogram *h = histogram_create(1e-9);
+
+        UNUSED(state);
+
+        assert_non_null(h);
+        assert_int_equal(0, histogram_count(h));
+        assert_true(isnan(histogram_percentile(h, 50)));
+        histogram_destroy(h);
+}
+
+static void t_histogram_small_values_exact(void **state)
+{
+        struct histogram *h = histogram_create(1);
+        int i;
+
+        UNUSED(state);
+
+        for (i = 0; i < 100; i++)
+                histogram_add(h, i);
+        assert_int_equal(100, histogram_count(h));
+        assert_true(histogram_min(h) == 0);
+        assert_true(histogram_max(h) == 99);
+        assert_true(histogram_percentile(h, 50) == 49);
+        assert_true(histogram_percentile(h, 99) == 98);
+        histogram_destroy(h);
+}
+
+static void t_histogram_precision(void **state)
+{
+        struct histogram *h = histogram_create(1e-9);
+        double p;
+
+        UNUSED(state);
+
+        histogram_add(h, 0.001);
+        histogram_add(h, 0.123456);
+        histogram_add(h, 7.5);
+        p = histogram_percentile(h, 50);
+        assert_true(fabs(p - 0.123456) / 0.123456 < 0.016);
+        assert_true(histogram_percentile(h, 0) == 0.001);
+        assert_true(histogram_percentile(h, 100) == 7.5);
+        histogram_destroy(h);
+}
+
+static void t_histogram_merge(void **state)
+{
+        struct histogram *a = histogram_create(1), *b = histogram_create(1);
+        struct histogram *c = histogram_create(2);
+        int i;
+
+        UNUSED(state);
+
+        for (i = 0; i < 50; i++)
+                histogram_add(a, i);
+        for (i = 50; i < 100; i++)
+                histogram_add(b, i);
+        assert_int_equal(0, histogram_merge(a, b));
+        assert_int_equal(100, histogram_count(a));
+        assert_true(histogram_max(a) == 99);
+        assert_true(histogram_percentile(a, 90) == 89);
+        assert_int_not_equal(0, histogram_merge(a, c));
+        histogram_destroy(a);
+        histogram_destroy(b);
+        histogram_destroy(c);
+}
+
+static void t_histogram_format_parse(void **state)
+{
+        struct histogram *h = histogram_create(1e-6), *copy;
+        char *text;
+        int i;
+
+        UNUSED(state);
+
+        for (i = 1; i <= 1000; i++)
+                histogram_add(h, i * 1e-4);
+        text = histogram_format(h);
+        assert_non_null(text);
+        copy = histogram_parse(text);
+        assert_non_null(copy);
+        assert_int_equal(histogram_count(h), histogram_count(copy));
+        assert_true(histogram_mean(h) == histogram_mean(copy));
+        for (i = 0; i <= 100; i += 10)
+                assert_true(histogram_percentile(h, i) ==
+                            histogram_percentile(copy, i));
+        assert_null(histogram_parse("garbage"));
+        assert_null(histogram_parse("1,2,0,0,0,5:1"));
+        free(text);
+        histogram_destroy(copy);
+        histogram_destroy(h);
+}
+
+static void t_histogram_count_below_reset(void **state)
+{
+        struct histogram *h = histogram_create(1);
+        int i;
+
+        UNUSED(state);
+
+        for (i = 0; i < 1000; i++)
+                histogram_add(h, i);
+        assert_int_equal(0, histogram_count_below(h, 0));
+        assert_int_equal(512, histogram_count_below(h, 512));
+        assert_int_equal(1000, histogram_count_below(h, 1024));
+        histogram_reset(h);
+        assert_int_equal(0, histogram_count(h));
+        assert_int_equal(0, histogram_count_below(h, 1024));
+        histogram_add(h, 2);
+        assert_true(histogram_min(h) == 2);
+        histogram_destroy(h);
+}
+
+int main(void)
+{
+        const struct CMUnitTest tests[] = {
+                cmocka_unit_test(t_histogram_empty),
+                cmocka_unit_test(t_histogram_small_values_exact),
+                cmocka_unit_test(t_histogram_precision),
+                cmocka_unit_test(t_histogram_merge),
+                cmocka_unit_test(t_histogram_format_parse),
+                cmocka_unit_test(t_histogram_count_below_reset),
+        };
+
+        return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Tests for the single-producer single-consumer ring buffers.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "ring.h"
+
+
+static void t_ring_empty(void **state)
+{
+        struct ring *r = ring_create(4);
+
+        UNUSED(state);
+
+        assert_non_null(r);
+        assert_null(ring_pop(r));
+        ring_destroy(r);
+}
+
+static void t_ring_fifo_order(void **state)
+{
+        struct ring *r = ring_create(4);
+        int items[3];
+
+        UNUSED(state);
+
+        assert_true(ring_push(r, &items[0]));
+        assert_true(ring_push(r, &items[1]));
+        assert_true(ring_pop(r) == &items[0]);
+        assert_true(ring_push(r, &items[2]));
+        assert_true(ring_pop(r) == &items[1]);
+        assert_true(ring_pop(r) == &items[2]);
+        assert_null(ring_pop(r));
+        ring_destroy(r);
+}
+
+static void t_ring_full(void **state)
+{
+        struct ring *r = ring_create(3); /* rounded up to 4 */
+        int item;
+        int i;
+
+        UNUSED(state);
+
+        for (i = 0; i < 4; i++)
+                assert_true(ring_push(r, &item));
+        assert_false(ring_push(r, &item));
+        assert_true(ring_pop(r) == &item);
+        assert_true(ring_push(r, &item));
+        ring_destroy(r);
+}
+
+#define NUM_ITEMS 100000
+
+static void *producer(void *arg)
+{
+        struct ring *r = arg;
+        uintptr_t i;
+
+        for (i = 1; i <= NUM_ITEMS; i++) {
+                while (!ring_push(r, (void *)i))
+                        ;
+        }
+        return NULL;
+}
+
+static void t_ring_two_threads(void **state)
+{
+        struct ring *r = ring_create(16);
+        uintptr_t expected = 1;
+        pthread_t thread;
+        void *item;
+
+        UNUSED(state);
+
+        assert_int_equal(0, pthread_create(&thread, NULL, producer, r));
+        while (expected <= NUM_ITEMS) {
+                item = ring_pop(r);
+                if (!item)
+                        continue;
+                assert_int_equal(expected, (uintptr_t)item);
+                expected++;
+        }
+        assert_int_equal(0, pthread_join(thread, NULL));
+        assert_null(ring_pop(r));
+        ring_destroy(r);
+}
+
+static void t_byte_ring_wraps_around(void **state)
+{
+        struct byte_ring *r = byte_ring_create(6); /* rounded up to 8 */
+        char out[8];
+
+        UNUSED(state);
+
+        assert_int_equal(5, byte_ring_write(r, "abcde", 5));
+        assert_int_equal(3, byte_ring_read(r, out, 3));
+        assert_true(memcmp(out, "abc", 3) == 0);
+        /* Only 6 of 7 fit, across the end of the buffer */
+        assert_false(byte_ring_full(r));
+        assert_int_equal(6, byte_ring_write(r, "fghijkl", 7));
+        assert_true(byte_ring_full(r));
+        assert_int_equal(0, byte_ring_write(r, "m", 1));
+        assert_int_equal(8, byte_ring_read(r, out, sizeof(out)));
+        assert_true(memcmp(out, "defghijk", 8) == 0);
+        assert_true(byte_ring_empty(r));
+        assert_int_equal(0, byte_ring_read(r, out, sizeof(out)));
+        byte_ring_destroy(r);
+}
+
+#define NUM_BYTES 1000000
+
+static void *byte_producer(void *arg)
+{
+        struct byte_ring *r = arg;
+        unsigned char buf[37];
+        size_t i, n, sent = 0;
+
+        while (sent < NUM_BYTES) {
+                n = NUM_BYTES - sent < sizeof(buf) ? NUM_BYTES - sent :
+                                                     sizeof(buf);
+                for (i = 0; i < n; i++)
+                        buf[i] = (sent + i) & 0xff;
+                for (i = 0; i < n; )
+                        i += byte_ring_write(r, buf + i, n - i);
+                sent += n;
+        }
+        return NULL;
+}
+
+static void t_byte_ring_two_threads(void **state)
+{
+        struct byte_ring *r = byte_ring_create(64);
+        unsigned char buf[23];
+        size_t i, n, received = 0;
+        pthread_t thread;
+
+        UNUSED(state);
+
+        assert_int_equal(0, pthread_create(&thread, NULL, byte_producer, r));
+        while (received < NUM_BYTES) {
+                n = byte_ring_read(r, buf, sizeof(buf));
+                for (i = 0; i < n; i++)
+                        assert_int_equal((received + i) & 0xff, buf[i]);
+                received += n;
+        }
+        assert_int_equal(0, pthread_join(thread, NULL));
+        assert_true(byte_ring_empty(r));
+        byte_ring_destroy(r);
+}
+
+int main(void)
+{
+        const struct CMUnitTest tests[] = {
+                cmocka_unit_test(t_ring_empty),
+                cmocka_unit_test(t_ring_fifo_order),
+                cmocka_unit_test(t_ring_full),
+                cmocka_unit_test(t_ring_two_threads),
+                cmocka_unit_test(t_byte_ring_wraps_around),
+                cmocka_unit_test(t_byte_ring_two_threads),
+        };
+
+        return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -8,9 +8,13 @@
 #include <unistd.h>
 
 #include "common.h"
+#include "histogram.h"
 #include "lib.h"
 #include "logging.h"
+#include "numlist.h"
+#include "sample.h"
 #include "script.h"
+#include "workload.h"
 
 static int common_setup(void **state)
 {
@@ -293,6 +297,34 @@ static void t_run_recverr_hook(void **state)
         assert_int_equal(r, 7193);
 }
 
+static void t_run_recvmmsg_hook(void **state)
+{
+        const char *script =
+                "client_recvmmsg("
+                "  function (fd, msgvec, vlen, flags)"
+                "    for i = 0, vlen - 1 do"
+                "      msgvec[i].msg_len = msgvec[i].msg_hdr.msg_iovlen"
+                "    end"
+                "    return vlen"
+                "  end"
+                ")";
+        struct mmsghdr msgvec[3] = {
+                { .msg_hdr = { .msg_iovlen = 1 } },
+                { .msg_hdr = { .msg_iovlen = 2 } },
+                { .msg_hdr = { .msg_iovlen = 3 } },
+        };
+        struct script_slave *ss = *state;
+        int r;
+
+        r = script_engine_run_string(ss->se, script, NULL, NULL);
+        assert_return_code(r, -r);
+
+        r = script_slave_recvmmsg_hook(ss, -1, msgvec, ARRAY_SIZE(msgvec), 0);
+        assert_int_equal(r, 3);
+        assert_int_equal(msgvec[0].msg_len, 1);
+        assert_int_equal(msgvec[2].msg_len, 3);
+}
+
 #define lua_assert(expr, op, val) lua_assert_(#expr, #op, #val)
 #define lua_assert_(expr, op, val) \
         "assert(" expr " " op " " val ", \"expected " expr " to be " val ", got \" .. tostring(" expr "));\n"
@@ -396,6 +428,66 @@ static void t_pass_args_to_packet_hook(void **state)
         assert_int_equal(r, 0);
 }
 
+static void t_pass_args_to_transaction_hook(void **state)
+{
+        const char *script =
+                "client_transaction("
+                "  function (flow_id, latency)"
+                "    " lua_assert_equal(flow_id, 7)
+                "    " lua_assert_equal(latency, 0.25)
+                "    return 0;"
+                "  end"
+                ")";
+        struct script_slave *ss = *state;
+        int r;
+
+        r = script_engine_run_string(ss->se, script, NULL, NULL);
+        assert_return_code(r, -r);
+
+        r = script_slave_transaction_hook(ss, 7, 0.25);
+        assert_int_equal(r, 0);
+}
+
+static void t_pass_sample_to_interval_hook(void **state)
+{
+        const char *script =
+                "client_interval("
+                "  function (tid, s)"
+                "    " lua_assert_equal(tid, 3)
+                "    " lua_assert_equal(s.flow_id, 5)
+                "    " lua_assert_equal(s.bytes_read, 4096)
+                "    " lua_assert_equal(s.transactions, 4)
+                "    " lua_assert_equal(s.latency:size(), 4)
+                "    " lua_assert_equal(s.latency:min(), 1)
+                "    " lua_assert_equal(s.latency:max(), 4)
+                "    " lua_assert_equal(s.latency:percentile(50), 2)
+                "    " lua_assert_equal(tonumber(s.timestamp.tv_sec), 42)
+                "    return 0;"
+                "  end"
+                ")";
+        struct script_slave *ss = *state;
+        struct sample sample = {
+                .tid = 3,
+                .flow_id = 5,
+                .bytes_read = 4096,
+                .transactions = 4,
+                .timestamp = { .tv_sec = 42 },
+        };
+        int i, r;
+
+        sample.latency = numlist_create(ss->cb);
+        for (i = 1; i <= 4; i++)
+                numlist_add(sample.latency, i);
+
+        r = script_engine_run_string(ss->se, script, NULL, NULL);
+        assert_return_code(r, -r);
+
+        r = script_slave_interval_hook(ss, &sample);
+        assert_int_equal(r, 0);
+
+        numlist_destroy(sample.latency);
+}
+
 static void t_run_hook_with_boolean_upvalue(void **state)
 {
         const char *script =
@@ -921,6 +1013,332 @@ static void t_collect_table_element(void **state)
         assert_return_code(r, -r);
 }
 
+static void t_collect_large_table(void **state)
+{
+        const char *script =
+                "local shared = { n = 0 };"
+                "local t = {};"
+                "for i = 1, 1000 do"
+                "  t[i] = i;"
+                "  t['k' .. i] = shared;"
+                "end;"
+                "t = collect(t);"
+                "client_socket("
+                "  function ()"
+                "    for i = 1, #t do"
+                "      t[i] = 2 * t[i];"
+                "    end;"
+                "    t.k1.n = 42;"
+                "    return 0;"
+                "  end"
+                ");"
+                "run();"
+                "local sum = 0;"
+                "for i = 1, #t[1] do"
+                "  sum = sum + t[1][i];"
+                "end;"
+                lua_assert_equal(#t[1], 1000)
+                lua_assert_equal(sum, 1001000)
+                lua_assert_equal(t[1].k1, t[1].k1000) /* still shared */
+                lua_assert_equal(t[1].k1000.n, 42)
+                ;
+        struct script_slave *ss = *state;
+        struct script_engine *se = ss->se;
+        int r;
+
+        r = script_engine_run_string(se, script, dummy_run, ss);
+        assert_return_code(r, -r);
+}
+
+static void t_native_collectors(void **state)
+{
+        const char *script =
+                "local c = collect_counter();"
+                "local m = collect_max();"
+                "local h = collect_histogram({ 10, 100 });"
+                "client_socket("
+                "  function ()"
+                "    c:add();"
+                "    c:add(41);"
+                "    m:add(-1);"
+                "    m:add(7);"
+                "    m:add(3);"
+                "    for _, v in ipairs({ 0, 9, 10, 99, 100, 1000 }) do"
+                "      h:add(v);"
+                "    end;"
+                "    return 0;"
+                "  end"
+                ");"
+                "run();"
+                "local counts = h:counts();"
+                lua_assert_equal(c:value(), 42)
+                lua_assert_equal(m:value(), 7)
+                lua_assert_equal(#counts, 3)
+                lua_assert_equal(counts[1], 2)
+                lua_assert_equal(counts[2], 2)
+                lua_assert_equal(counts[3], 2)
+                ;
+        struct script_slave *ss = *state;
+        struct script_engine *se = ss->se;
+        int r;
+
+        r = script_engine_run_string(se, script, dummy_run, ss);
+        assert_return_code(r, -r);
+}
+
+static void t_log_histogram_collector(void **state)
+{
+        const char *script =
+                "local h = collect_log_histogram(1);"
+                "client_socket("
+                "  function ()"
+                "    for i = 0, 99 do"
+                "      h:add(i);"
+                "    end;"
+                "    " lua_assert_equal(h:value():count(), 100)
+                "    return 0;"
+                "  end"
+                ");"
+                "run();"
+                "local merged = h:value();"
+                lua_assert_equal(merged:count(), 100)
+                lua_assert_equal(merged:max(), 99)
+                lua_assert_equal(merged:percentile(50), 49)
+                ;
+        struct script_slave *ss = *state;
+        struct script_engine *se = ss->se;
+        int r;
+
+        r = script_engine_run_string(se, script, dummy_run, ss);
+        assert_return_code(r, -r);
+}
+
+static void idle_run(struct script_engine *se, void *ss_)
+{
+        struct script_slave *ss = ss_;
+
+        script_engine_push_data(se, ss);
+        assert_null(ss->L);
+        script_engine_pull_data(se, ss);
+}
+
+static void t_slave_lua_state_is_lazy(void **state)
+{
+        const char *script =
+                "local n = collect(0);"
+                "run();"
+                lua_assert_equal(#n, 0) /* nothing from an idle slave */
+                ;
+        struct script_slave *ss = *state;
+        struct script_engine *se = ss->se;
+        int r;
+
+        assert_null(ss->L);
+        r = script_engine_run_string(se, script, idle_run, ss);
+        assert_return_code(r, -r);
+
+        r = script_slave_socket_hook(ss, -1, NULL);
+        assert_int_equal(-EHOOKEMPTY, r);
+        assert_null(ss->L);
+}
+
+static void hooked_run(struct script_engine *se, void *ss_)
+{
+        struct script_slave *ss = ss_;
+
+        script_engine_push_data(se, ss);
+        assert_non_null(ss->L);
+        script_engine_pull_data(se, ss);
+}
+
+static void t_slave_lua_state_precedes_hooks(void **state)
+{
+        const char *script =
+                "client_socket("
+                "  function ()"
+                "    return 0;"
+                "  end"
+                ");"
+                "run();";
+        struct script_slave *ss = *state;
+        struct script_engine *se = ss->se;
+        int r;
+
+        r = script_engine_run_string(se, script, hooked_run, ss);
+        assert_return_code(r, -r);
+}
+
+static void t_script_runs_again_after_reset(void **state)
+{
+        const char *script =
+                "local c = collect_counter();"
+                "local h = collect_histogram({ 10 });"
+                "local n = collect(0);"
+                "client_socket("
+                "  function ()"
+                "    c:add(42);"
+                "    h:add(1);"
+                "    n = n + 1;"
+                "    return 0;"
+                "  end"
+                ");"
+                "run();"
+                lua_assert_equal(c:value(), 42)
+                lua_assert_equal(h:counts()[1], 1)
+                lua_assert_equal(#n, 1)
+                lua_assert_equal(n[1], 1)
+                ;
+        struct script_slave *ss = *state;
+        struct script_engine *se = ss->se;
+        int i, r;
+
+        for (i = 0; i < 2; i++) {
+                r = script_engine_run_string(se, script, dummy_run, ss);
+                assert_return_code(r, -r);
+                script_slave_reset(ss);
+                script_engine_reset(se);
+                assert_null(ss->L);
+        }
+}
+
+static void t_sequence_gets_compiled(void **state)
+{
+        const char *script =
+                "sequence {"
+                "  setup = { { send = 32 }, { recv = 16 } },"
+                "  { send = 100 },"
+                "  { think = 0.0015 },"
+                "  { recv = 2000 },"
+                "  reuse = 10,"
+                "}";
+        struct script_engine *se = *state;
+        const struct sequence *seq;
+        int r;
+
+        r = script_engine_run_string(se, script, NULL, NULL);
+        assert_return_code(r, -r);
+
+        seq = se->sequence;
+        assert_non_null(seq);
+        assert_int_equal(seq->num_steps, 5);
+        assert_int_equal(seq->loop_start, 2);
+        assert_int_equal(seq->reuse, 10);
+        assert_int_equal(seq->max_msg, 2000);
+        assert_int_equal(seq->steps[0].op, SEQ_SEND);
+        assert_int_equal(seq->steps[0].arg, 32);
+        assert_int_equal(seq->steps[1].op, SEQ_RECV);
+        assert_int_equal(seq->steps[1].arg, 16);
+        assert_int_equal(seq->steps[3].op, SEQ_THINK);
+        assert_int_equal(seq->steps[3].arg, 1500);
+
+        /* Nothing to loop over but think steps */
+        r = script_engine_run_string(se, "sequence { { think = 1 } }", NULL,
+                                     NULL);
+        assert_int_equal(r, -EHOOKRUN);
+        assert_int_equal(se->sequence->num_steps, 5);
+}
+
+static void t_gc_steps_get_measured(void **state)
+{
+        const char *script =
+                "client_socket("
+                "  function ()"
+                "    local garbage = { 1, 2, 3 };"
+                "    return 0;"
+                "  end"
+                ")";
+        struct script_engine *se = *state;
+        struct script_slave *idle = NULL, *ss = NULL;
+        int i, r;
+
+        assert_int_equal(script_engine_set_gc(se, "bogus"), -EINVAL);
+        assert_int_equal(script_engine_set_gc(se, "step:1:2"), -EINVAL);
+        assert_int_equal(script_engine_set_gc(se, "interval:1"), -EINVAL);
+        r = script_engine_set_gc(se, "step");
+        assert_return_code(r, -r);
+
+        r = script_slave_create(&idle, se);
+        assert_return_code(r, -r);
+        r = script_slave_create(&ss, se);
+        assert_return_code(r, -r);
+        r = script_engine_run_string(se, script, NULL, NULL);
+        assert_return_code(r, -r);
+
+        for (i = 0; i < 10; i++) {
+                r = script_slave_socket_hook(ss, -1, NULL);
+                assert_int_equal(r, 0);
+        }
+        script_engine_pull_data(se, idle);
+        script_engine_pull_data(se, ss);
+        /* kept apart for each slave */
+        assert_int_equal(histogram_count(se->gc_pauses[0]), 0);
+        assert_int_equal(histogram_count(se->gc_pauses[1]), 10);
+
+        ss = script_slave_destroy(ss);
+        assert_null(ss);
+        idle = script_slave_destroy(idle);
+        assert_null(idle);
+}
+
+static int native_close_hook(void *ctx, int sockfd, struct addrinfo *ai)
+{
+        return 0;
+}
+
+static void t_hook_calls_get_profiled(void **state)
+{
+        const char *script =
+                "client_socket(function () return 0 end);"
+                "client_sendmsg(function () getpid(); return 0 end)";
+        struct script_engine *se = *state;
+        struct script_slave *ss = NULL;
+        struct hook_profile *hp;
+        int i, r;
+
+        r = script_engine_profile_hooks(se);
+        assert_return_code(r, -r);
+        r = script_slave_create(&ss, se);
+        assert_return_code(r, -r);
+        r = script_engine_run_string(se, script, NULL, NULL);
+        assert_return_code(r, -r);
+        /* as a plugin would have it */
+        se->hooks[SCRIPT_HOOK_CLOSE].native = native_close_hook;
+
+        for (i = 0; i < 3; i++) {
+                r = script_slave_socket_hook(ss, -1, NULL);
+                assert_int_equal(r, 0);
+        }
+        r = script_slave_sendmsg_hook(ss, -1, NULL, 0);
+        assert_int_equal(r, 0);
+        r = script_slave_close_hook(ss, -1, NULL);
+        assert_int_equal(r, 0);
+        r = script_slave_recvmsg_hook(ss, -1, NULL, 0);
+        assert_int_equal(r, -EHOOKEMPTY);
+        script_engine_pull_data(se, ss);
+
+        hp = &se->hook_profiles[ss->index][SCRIPT_HOOK_SOCKET];
+        assert_int_equal(hp->calls, 3);
+        assert_int_equal(histogram_count(hp->durations), 3);
+        assert_true(hp->time > 0);
+        assert_true(hp->syscall_time == 0);
+        assert_int_equal(ss->hook_profiles[SCRIPT_HOOK_SOCKET].calls, 0);
+
+        /* getpid() is timed on its own, within the hook */
+        hp = &se->hook_profiles[ss->index][SCRIPT_HOOK_SENDMSG];
+        assert_int_equal(hp->calls, 1);
+        assert_true(hp->syscall_time > 0);
+        assert_true(hp->syscall_time < hp->time);
+
+        hp = &se->hook_profiles[ss->index][SCRIPT_HOOK_CLOSE];
+        assert_int_equal(hp->calls, 1);
+        assert_int_equal(se->hook_profiles[ss->index][SCRIPT_HOOK_RECVMSG].calls,
+                         0);
+
+        se->hooks[SCRIPT_HOOK_CLOSE].native = NULL;
+        ss = script_slave_destroy(ss);
+        assert_null(ss);
+}
+
 #define clinet_engine_unit_test(f) \
         cmocka_unit_test_setup_teardown((f), client_engine_setup, client_engine_teardown)
 #define client_slave_unit_test(f) \
@@ -934,14 +1352,20 @@ int main(void)
                 clinet_engine_unit_test(t_hooks_run_without_errors),
                 clinet_engine_unit_test(t_wait_func_gets_called),
                 clinet_engine_unit_test(t_run_cb_gets_invoked),
+                clinet_engine_unit_test(t_sequence_gets_compiled),
+                clinet_engine_unit_test(t_gc_steps_get_measured),
+                clinet_engine_unit_test(t_hook_calls_get_profiled),
                 client_slave_unit_test(t_run_socket_hook_from_string),
                 client_slave_unit_test(t_run_socket_hook_from_file),
                 client_slave_unit_test(t_run_close_hook),
                 client_slave_unit_test(t_run_sendmsg_hook),
                 client_slave_unit_test(t_run_recvmsg_hook),
                 client_slave_unit_test(t_run_recverr_hook),
+                client_slave_unit_test(t_run_recvmmsg_hook),
                 client_slave_unit_test(t_pass_args_to_socket_hook),
                 client_slave_unit_test(t_pass_args_to_packet_hook),
+                client_slave_unit_test(t_pass_args_to_transaction_hook),
+                client_slave_unit_test(t_pass_sample_to_interval_hook),
                 client_slave_unit_test(t_run_hook_with_boolean_upvalue),
                 client_slave_unit_test(t_run_hook_with_number_upvalue),
                 client_slave_unit_test(t_run_hook_with_string_upvalue),
@@ -961,6 +1385,12 @@ int main(void)
                 client_slave_unit_test(t_collect_upvalue),
                 client_slave_unit_test(t_collected_table_elements_get_unwrapped),
                 client_slave_unit_test(t_collect_table_element),
+                client_slave_unit_test(t_collect_large_table),
+                client_slave_unit_test(t_native_collectors),
+                client_slave_unit_test(t_log_histogram_collector),
+                client_slave_unit_test(t_slave_lua_state_is_lazy),
+                client_slave_unit_test(t_slave_lua_state_precedes_hooks),
+                client_slave_unit_test(t_script_runs_again_after_reset),
         };
 
         return cmocka_run_group_tests(tests, common_setup, common_teardown);
@@ -16,25 +16,58 @@
 
 #include "thread.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
 #include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <unistd.h>
 #include "common.h"
 #include "control_plane.h"
 #include "cpuinfo.h"
+#include "histogram.h"
 #include "logging.h"
+#include "numlist.h"
+#include "percentiles.h"
+#include "rebalance.h"
 #include "sample.h"
 #include "script.h"
+#include "server_pool.h"
 
 
+enum pin_policy {
+        PIN_CORE,       /* one thread per core, free to use its SMT siblings */
+        PIN_COMPACT,    /* fill CPUs in order, SMT siblings first */
+        PIN_SCATTER,    /* spread across nodes, then cores, then siblings */
+        PIN_NODE,       /* one thread per NUMA node, any CPU in the node */
+        PIN_NOSMT,      /* like compact, but one CPU per core */
+        PIN_LIST,       /* one CPU per thread, --cpus in ascending order */
+};
+
+static const char *const pin_policy_names[] = {
+        [PIN_CORE]    = "core",
+        [PIN_COMPACT] = "compact",
+        [PIN_SCATTER] = "scatter",
+        [PIN_NODE]    = "node",
+        [PIN_NOSMT]   = "nosmt",
+};
+
 struct rusage_interval {
         struct timespec time_start; /* shared by flows */
         pthread_mutex_t time_start_mutex;
 
         struct rusage rusage_start; /* updated when first packet comes */
         struct rusage rusage_end;   /* updated only from main thread */
+
+        /* Measurement window, stamped by the main thread */
+        struct timespec window_start;
+        struct timespec window_end;
 };
 
 struct main_context {
@@ -43,33 +76,62 @@ struct main_context {
 
         struct control_plane *cp;
 
+        bool pin_cpu;
+        enum pin_policy pin_policy;
+        cpu_set_t allowed_cpus;         /* CPUs threads may be pinned to */
+        cpu_set_t app_cpus;             /* CPUs threads were pinned to */
+        cpu_set_t irq_cpus;             /* CPUs servicing the NIC's IRQs */
+        unsigned long net_rx_start[CPU_SETSIZE];
+        unsigned long net_rx_end[CPU_SETSIZE];
+
+        int cpu_dma_latency_fd;         /* held open for --low-latency */
+
         void *(*worker_func)(void *);
         struct thread *workers;
         int n_workers;
+        int n_started;                  /* --daemon: kept across tests */
+        struct rebalance_group *rebalance;
+        struct server_pool *pool;
 
         struct rusage_interval rusage_ival;
         pthread_barrier_t threads_ready; /* shared by threads */
 };
 
 
-static int get_cpuset(cpu_set_t *cpuset, struct callbacks *cb)
+static enum pin_policy get_pin_policy(const char *name, struct callbacks *cb)
 {
-        int i, j, n, num_cores, physical_id[CPU_SETSIZE], core_id[CPU_SETSIZE];
-        struct cpuinfo *cpus;
+        int i;
+
+        if (!name)
+                return PIN_CORE;
+        for (i = 0; i < ARRAY_SIZE(pin_policy_names); i++) {
+                if (strcmp(name, pin_policy_names[i]) == 0)
+                        return i;
+        }
+        LOG_FATAL(cb, "unknown pin policy '%s'", name);
+        return PIN_CORE;
+}
+
+static int compare_cpus_compact(const void *a, const void *b)
+{
+        const struct cpuinfo *x = a, *y = b;
+
+        if (x->node != y->node)
+                return x->node - y->node;
+        if (x->physical_id != y->physical_id)
+                return x->physical_id - y->physical_id;
+        if (x->core_id != y->core_id)
+                return x->core_id - y->core_id;
+        if (x->smt_index != y->smt_index)
+                return x->smt_index - y->smt_index;
+        return x->processor - y->processor;
+}
+
+static int place_by_core(const struct cpuinfo *cpus, int n, cpu_set_t *cpuset)
+{
+        int i, j, num_cores = 0, physical_id[CPU_SETSIZE], core_id[CPU_SETSIZE];
 
-        cpus = calloc(CPU_SETSIZE, sizeof(struct cpuinfo));
-        if (!cpus)
-                PLOG_FATAL(cb, "calloc cpus");
-        n = get_cpuinfo(cpus, CPU_SETSIZE);
-        if (n == -1)
-                PLOG_FATAL(cb, "get_cpuinfo");
-        if (n == 0)
-                LOG_FATAL(cb, "no cpu found in /proc/cpuinfo");
-        num_cores = 0;
         for (i = 0; i < n; i++) {
-                LOG_INFO(cb, "%d\t%d\t%d\t%d\t%d", cpus[i].processor,
-                         cpus[i].physical_id, cpus[i].siblings, cpus[i].core_id,
-                         cpus[i].cpu_cores);
                 for (j = 0; j < num_cores; j++) {
                         if (physical_id[j] == cpus[i].physical_id &&
                             core_id[j] == cpus[i].core_id)
@@ -83,30 +145,225 @@ static int get_cpuset(cpu_set_t *cpuset, struct callbacks *cb)
                 }
                 CPU_SET(cpus[i].processor, &cpuset[j]);
         }
-        free(cpus);
         return num_cores;
 }
 
-static void start_worker_threads(struct callbacks *cb, struct main_context *ctx,
-                                 bool pin_cpu)
+/* Expects cpus in compact order. */
+static int place_by_node(const struct cpuinfo *cpus, int n, cpu_set_t *cpuset)
+{
+        int i, num_nodes = 0;
+
+        for (i = 0; i < n; i++) {
+                if (i == 0 || cpus[i].node != cpus[i - 1].node)
+                        CPU_ZERO(&cpuset[num_nodes++]);
+                CPU_SET(cpus[i].processor, &cpuset[num_nodes - 1]);
+        }
+        return num_nodes;
+}
+
+/* Expects cpus in compact order.  Takes the n-th core of every node in turn,
+ * and moves on to the next SMT sibling only when all cores are used up.
+ */
+static int place_scattered(const struct cpuinfo *cpus, int n,
+                           cpu_set_t *cpuset)
+{
+        int i, node, smt, progress, num_slots = 0;
+        int max_node = 0, max_smt = 0;
+        CLEANUP(free) int *cursor = NULL;
+
+        for (i = 0; i < n; i++) {
+                if (cpus[i].node > max_node)
+                        max_node = cpus[i].node;
+                if (cpus[i].smt_index > max_smt)
+                        max_smt = cpus[i].smt_index;
+        }
+        cursor = calloc(max_node + 1, sizeof(*cursor));
+        if (!cursor)
+                return -1;
+
+        for (smt = 0; smt <= max_smt; smt++) {
+                memset(cursor, 0, (max_node + 1) * sizeof(*cursor));
+                do {
+                        progress = 0;
+                        for (node = 0; node <= max_node; node++) {
+                                for (i = cursor[node]; i < n; i++) {
+                                        if (cpus[i].node == node &&
+                                            cpus[i].smt_index == smt)
+                                                break;
+                                }
+                                cursor[node] = i + 1;
+                                if (i == n)
+                                        continue;
+                                CPU_ZERO(&cpuset[num_slots]);
+                                CPU_SET(cpus[i].processor, &cpuset[num_slots]);
+                                num_slots++;
+                                progress = 1;
+                        }
+                } while (progress);
+        }
+        return num_slots;
+}
+
+/* Expects cpus in compact order. */
+static int place_compact(const struct cpuinfo *cpus, int n, bool smt,
+                         cpu_set_t *cpuset)
+{
+        int i, num_slots = 0;
+
+        for (i = 0; i < n; i++) {
+                if (!smt && cpus[i].smt_index != 0)
+                        continue;
+                CPU_ZERO(&cpuset[num_slots]);
+                CPU_SET(cpus[i].processor, &cpuset[num_slots]);
+                num_slots++;
+        }
+        return num_slots;
+}
+
+/* Returns the NUMA node all CPUs in the set belong to, or -1 if they span
+ * more than one node.
+ */
+static int cpuset_node(const cpu_set_t *cpuset, const struct cpuinfo *cpus,
+                       int n)
+{
+        int i, node = -1;
+
+        for (i = 0; i < n; i++) {
+                if (!CPU_ISSET(cpus[i].processor, cpuset))
+                        continue;
+                if (node != -1 && node != cpus[i].node)
+                        return -1;
+                node = cpus[i].node;
+        }
+        return node;
+}
+
+/* Fill in the list of CPU sets that worker threads get pinned to in turn, and
+ * the NUMA node of each set.  Returns the number of sets.
+ */
+static int get_cpuset(cpu_set_t *cpuset, int *node, enum pin_policy policy,
+                      const cpu_set_t *allowed, struct callbacks *cb)
+{
+        CLEANUP(free) struct cpuinfo *cpus = NULL;
+        int i, j, n, num_slots;
+
+        cpus = calloc(CPU_SETSIZE, sizeof(struct cpuinfo));
+        if (!cpus)
+                PLOG_FATAL(cb, "calloc cpus");
+        n = get_cpuinfo(cpus, CPU_SETSIZE);
+        if (n == -1)
+                PLOG_FATAL(cb, "get_cpuinfo");
+        for (i = 0, j = 0; i < n; i++) {
+                if (CPU_ISSET(cpus[i].processor, allowed))
+                        cpus[j++] = cpus[i];
+        }
+        n = j;
+        if (n == 0)
+                LOG_FATAL(cb, "no cpu to pin threads to");
+        for (i = 0; i < n; i++) {
+                LOG_INFO(cb, "%d\t%d\t%d\t%d\t%d", cpus[i].processor,
+                         cpus[i].node, cpus[i].physical_id, cpus[i].core_id,
+                         cpus[i].smt_index);
+        }
+
+        if (policy == PIN_CORE) {
+                num_slots = place_by_core(cpus, n, cpuset);
+        } else if (policy == PIN_LIST) {
+                /* already sorted by processor number */
+                num_slots = place_compact(cpus, n, true, cpuset);
+        } else {
+                qsort(cpus, n, sizeof(*cpus), compare_cpus_compact);
+                if (policy == PIN_NODE)
+                        num_slots = place_by_node(cpus, n, cpuset);
+                else if (policy == PIN_SCATTER)
+                        num_slots = place_scattered(cpus, n, cpuset);
+                else
+                        num_slots = place_compact(cpus, n,
+                                                  policy == PIN_COMPACT,
+                                                  cpuset);
+        }
+        if (num_slots <= 0)
+                LOG_FATAL(cb, "no cpu to pin threads to");
+
+        for (i = 0; i < num_slots; i++)
+                node[i] = cpuset_node(&cpuset[i], cpus, n);
+        return num_slots;
+}
+
+/* Workers run at the lowest real-time priority, the main thread right above
+ * them, so that it can always stop a busy-polling worker.
+ */
+static void set_realtime(struct callbacks *cb, pthread_t id, int boost)
+{
+        struct sched_param param = {
+                .sched_priority = sched_get_priority_min(SCHED_FIFO) + boost,
+        };
+        int s;
+
+        s = pthread_setschedparam(id, SCHED_FIFO, &param);
+        if (s != 0)
+                LOG_WARN(cb, "pthread_setschedparam: %s", strerror(s));
+}
+
+void thread_wait_start(struct thread *t)
 {
+        pthread_barrier_wait(t->ready);  /* all workers are set up */
+        pthread_barrier_wait(t->ready);  /* the main thread lets them go */
+        getrusage(RUSAGE_THREAD, &t->thread_rusage_start);
+}
+
+#define DAEMON_RUN  1
+#define DAEMON_EXIT 2
+
+/* With --daemon, worker threads outlive a test: they wait for the next one
+ * and run the workload again, until told to exit.
+ */
+static void *daemon_worker(void *arg)
+{
+        struct thread *t = arg;
+        eventfd_t cmd;
+
+        for (;;) {
+                if (eventfd_read(t->start_efd, &cmd))
+                        PLOG_FATAL(t->cb, "eventfd_read");
+                if (cmd != DAEMON_RUN)
+                        break;
+                t->func(t);
+                if (eventfd_write(t->done_efd, 1))
+                        PLOG_FATAL(t->cb, "eventfd_write");
+        }
+        return NULL;
+}
+
+static void start_worker_threads(struct callbacks *cb, struct main_context *ctx)
+{
+        bool pin_cpu = ctx->pin_cpu;
         CLEANUP(free) cpu_set_t *cpu_set = NULL;
+        CLEANUP(free) int *cpu_node = NULL;
         pthread_attr_t attr;
         struct thread *t;
         int n_cores = 1;
         int i, s;
 
         cpu_set = calloc(CPU_SETSIZE, sizeof(*cpu_set));
-        if (!cpu_set)
+        cpu_node = calloc(CPU_SETSIZE, sizeof(*cpu_node));
+        if (!cpu_set || !cpu_node)
                 PLOG_FATAL(cb, "calloc cpu_set");
         if (pin_cpu)
-                n_cores = get_cpuset(cpu_set, cb);
+                n_cores = get_cpuset(cpu_set, cpu_node, ctx->pin_policy,
+                                     &ctx->allowed_cpus, cb);
 
         s = pthread_attr_init(&attr);
         if (s != 0)
                 LOG_FATAL(cb, "pthread_attr_init: %s", strerror(s));
 
         for (i = 0, t = ctx->workers; i < ctx->n_workers; i++, t++) {
+                if (i < ctx->n_started) {
+                        if (eventfd_write(t->start_efd, DAEMON_RUN))
+                                PLOG_FATAL(cb, "eventfd_write");
+                        continue;
+                }
+                t->node = -1;
                 if (pin_cpu) {
                         s = pthread_attr_setaffinity_np(&attr,
                                                         sizeof(*cpu_set),
@@ -115,11 +372,23 @@ static void start_worker_threads(struct callbacks *cb, struct main_context *ctx,
                                 LOG_FATAL(cb, "pthread_attr_setaffinity_np: %s",
                                           strerror(s));
                         }
+                        t->node = cpu_node[i % n_cores];
+                        CPU_OR(&ctx->app_cpus, &ctx->app_cpus,
+                               &cpu_set[i % n_cores]);
                 }
 
-                s = pthread_create(&t->id, &attr, ctx->worker_func, t);
+                t->func = ctx->worker_func;
+                s = pthread_create(&t->id, &attr, ctx->opts->daemon ?
+                                   daemon_worker : ctx->worker_func, t);
                 if (s != 0)
                         LOG_FATAL(cb, "pthread_create: %s", strerror(s));
+                if (ctx->opts->low_latency)
+                        set_realtime(cb, t->id, 0);
+                if (ctx->opts->daemon) {
+                        if (eventfd_write(t->start_efd, DAEMON_RUN))
+                                PLOG_FATAL(cb, "eventfd_write");
+                        ctx->n_started++;
+                }
         }
 
         s = pthread_attr_destroy(&attr);
@@ -146,6 +415,14 @@ struct thread *create_worker_threads(struct options *opts, struct callbacks *cb,
                 t[i].stop_efd = eventfd(0, 0);
                 if (t[i].stop_efd == -1)
                         PLOG_FATAL(cb, "eventfd");
+                t[i].start_efd = -1;
+                t[i].done_efd = -1;
+                if (opts->daemon) {
+                        t[i].start_efd = eventfd(0, 0);
+                        t[i].done_efd = eventfd(0, 0);
+                        if (t[i].start_efd == -1 || t[i].done_efd == -1)
+                                PLOG_FATAL(cb, "eventfd");
+                }
                 t[i].samples = NULL;
                 t[i].opts = opts;
                 t[i].cb = cb;
@@ -153,6 +430,7 @@ struct thread *create_worker_threads(struct options *opts, struct callbacks *cb,
                 t[i].time_start = &rui->time_start;
                 t[i].time_start_mutex = &rui->time_start_mutex;
                 t[i].rusage_start = &rui->rusage_start;
+                t[i].window_end = &rui->window_end;
 
                 s = script_slave_create(&t[i].script_slave, se);
                 if (s < 0) {
@@ -179,6 +457,16 @@ void stop_worker_threads(struct callbacks *cb, struct main_context *ctx)
 
         // wait for them to stop
         for (i = 0, t = ctx->workers; i < ctx->n_workers; i++, t++) {
+                if (ctx->opts->daemon) {
+                        eventfd_t n;
+
+                        /* done, then clear the stop request for next time */
+                        if (eventfd_read(t->done_efd, &n) ||
+                            eventfd_read(t->stop_efd, &n))
+                                PLOG_FATAL(cb, "eventfd_read");
+                        LOG_INFO(cb, "thread %d is done", i);
+                        continue;
+                }
                 s = pthread_join(t->id, NULL);
                 if (s != 0)
                         LOG_FATAL(cb, "pthread_join: %s", strerror(s));
@@ -187,12 +475,53 @@ void stop_worker_threads(struct callbacks *cb, struct main_context *ctx)
         }
 }
 
+/* Let --daemon threads go, they are idle between tests. */
+static void exit_worker_threads(struct callbacks *cb, struct main_context *ctx)
+{
+        struct thread *t;
+        int s;
+
+        for (t = ctx->workers; t < ctx->workers + ctx->n_started; t++) {
+                if (eventfd_write(t->start_efd, DAEMON_EXIT))
+                        PLOG_FATAL(cb, "eventfd_write");
+                s = pthread_join(t->id, NULL);
+                if (s != 0)
+                        LOG_FATAL(cb, "pthread_join: %s", strerror(s));
+        }
+        ctx->n_started = 0;
+}
+
+/* Forget what the workers did during the last test. */
+static void reset_worker_threads(struct main_context *ctx)
+{
+        struct rusage_interval *rui = &ctx->rusage_ival;
+        struct thread *t;
+
+        for (t = ctx->workers; t < ctx->workers + ctx->n_workers; t++) {
+                free_samples(t->samples);
+                t->samples = NULL;
+                t->transactions = 0;
+                t->bytes_read = 0;
+                t->next_flow_id = 0;
+                t->stop = 0;
+                t->rb = NULL;
+                t->pool = NULL;
+                script_slave_reset(t->script_slave);
+        }
+        memset(&rui->time_start, 0, sizeof(rui->time_start));
+        memset(&rui->rusage_start, 0, sizeof(rui->rusage_start));
+}
+
 static void free_worker_threads(int num_threads, struct thread *t)
 {
         int i;
 
         for (i = 0; i < num_threads; i++) {
                 do_close(t[i].stop_efd);
+                if (t[i].start_efd != -1)
+                        do_close(t[i].start_efd);
+                if (t[i].done_efd != -1)
+                        do_close(t[i].done_efd);
                 free(t[i].ai);
                 free_samples(t[i].samples);
                 script_slave_destroy(t[i].script_slave);
@@ -222,19 +551,28 @@ static void run_worker_threads(struct script_engine *se, void *ctx_)
 {
         struct main_context *ctx = ctx_;
         struct callbacks *cb = ctx->cb;
-        struct options *opts = ctx->opts;
         struct rusage_interval *rui = &ctx->rusage_ival;
 
         push_script_data(se, ctx->workers, ctx->n_workers);
 
-        start_worker_threads(cb, ctx, opts->pin_cpu);
+        start_worker_threads(cb, ctx);
         LOG_INFO(cb, "started worker threads");
 
         pthread_barrier_wait(&ctx->threads_ready);
         LOG_INFO(cb, "worker threads are ready");
 
+        /* Workers have touched their buffers and stacks by now. */
+        if (ctx->opts->low_latency && mlockall(MCL_CURRENT))
+                LOG_WARN(cb, "mlockall: %s", strerror(errno));
+
+        control_plane_sync_start(ctx->cp);
+        pthread_barrier_wait(&ctx->threads_ready);
+
         getrusage(RUSAGE_SELF, &rui->rusage_start);
-        control_plane_wait_until_done(ctx->cp);
+        get_softirq_counts("NET_RX", ctx->net_rx_start);
+        control_plane_wait_until_done(ctx->cp, &rui->window_start,
+                                      &rui->window_end);
+        get_softirq_counts("NET_RX", ctx->net_rx_end);
         getrusage(RUSAGE_SELF, &rui->rusage_end);
 
         stop_worker_threads(cb, ctx);
@@ -272,6 +610,635 @@ static void report_rusage(struct callbacks *cb,
         PRINT(cb, "nivcsw_end", "%ld", rusage_end->ru_nivcsw);
 }
 
+/* Work out where threads may be pinned from --cpus and --skip-irq-cpus. */
+static void setup_cpu_pinning(struct main_context *ctx)
+{
+        struct options *opts = ctx->opts;
+        struct callbacks *cb = ctx->cb;
+        char buf[1024];
+        int cpu, n;
+
+        ctx->pin_cpu = opts->pin_cpu || opts->cpus || opts->skip_irq_cpus;
+        if (opts->cpus && !opts->pin_policy)
+                ctx->pin_policy = PIN_LIST;
+        else
+                ctx->pin_policy = get_pin_policy(opts->pin_policy, cb);
+
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                CPU_SET(cpu, &ctx->allowed_cpus);
+        if (opts->cpus && parse_cpulist(opts->cpus, &ctx->allowed_cpus))
+                LOG_FATAL(cb, "invalid cpu list '%s'", opts->cpus);
+
+        if (opts->skip_irq_cpus) {
+                n = get_irq_cpus(opts->skip_irq_cpus, &ctx->irq_cpus);
+                if (n < 0)
+                        PLOG_FATAL(cb, "get_irq_cpus: %s", opts->skip_irq_cpus);
+                if (n == 0)
+                        LOG_WARN(cb, "no IRQs found for %s",
+                                 opts->skip_irq_cpus);
+                LOG_INFO(cb, "%d IRQs of %s are serviced by cpus %s", n,
+                         opts->skip_irq_cpus,
+                         format_cpulist(&ctx->irq_cpus, buf, sizeof(buf)));
+                for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                        if (CPU_ISSET(cpu, &ctx->irq_cpus))
+                                CPU_CLR(cpu, &ctx->allowed_cpus);
+                }
+        }
+}
+
+/* CPU time the process spent in the measurement window. */
+static double cpu_seconds(const struct rusage_interval *rui)
+{
+        const struct rusage *start = &rui->rusage_start;
+        const struct rusage *end = &rui->rusage_end;
+
+        return (end->ru_utime.tv_sec - start->ru_utime.tv_sec) +
+               (end->ru_utime.tv_usec - start->ru_utime.tv_usec) * 1e-6 +
+               (end->ru_stime.tv_sec - start->ru_stime.tv_sec) +
+               (end->ru_stime.tv_usec - start->ru_stime.tv_usec) * 1e-6;
+}
+
+/* The server's measurements for its clients, as key=value lines. */
+static char *build_server_report(struct main_context *ctx)
+{
+        unsigned long transactions = 0, bytes_read = 0;
+        struct thread *t;
+        char *report = NULL;
+        size_t len;
+        FILE *f;
+
+        f = open_memstream(&report, &len);
+        if (!f)
+                PLOG_FATAL(ctx->cb, "open_memstream");
+        for (t = ctx->workers; t < ctx->workers + ctx->n_workers; t++) {
+                transactions += t->transactions;
+                bytes_read += t->bytes_read;
+        }
+        fprintf(f, "cpu_seconds=%f\n", cpu_seconds(&ctx->rusage_ival));
+        fprintf(f, "num_transactions=%lu\n", transactions);
+        fprintf(f, "bytes_read=%lu\n", bytes_read);
+        fprintf(f, "num_threads=%d\n", ctx->n_workers);
+        for (t = ctx->workers; t < ctx->workers + ctx->n_workers; t++) {
+                fprintf(f, "transactions[%d]=%lu\n", t->index,
+                        t->transactions);
+                fprintf(f, "bytes_read[%d]=%lu\n", t->index, t->bytes_read);
+        }
+        fclose(f);
+        return report;
+}
+
+/* Where the value of @key starts in a report, or NULL. */
+static const char *report_find(const char *report, const char *key)
+{
+        size_t len = strlen(key);
+        const char *p = report;
+
+        while (*p) {
+                if (!strncmp(p, key, len) && p[len] == '=')
+                        return p + len + 1;
+                p = strchrnul(p, '\n');
+                if (*p)
+                        p++;
+        }
+        return NULL;
+}
+
+static bool report_value(const char *report, const char *key, double *value)
+{
+        const char *p = report_find(report, key);
+
+        if (!p)
+                return false;
+        *value = strtod(p, NULL);
+        return true;
+}
+
+static double timespec_seconds(const struct timespec *ts)
+{
+        return ts->tv_sec + ts->tv_nsec * 1e-9;
+}
+
+/* Transactions completed in each interval, numbered from the server's clock
+ * if the start was synchronized, otherwise from the epoch, so that the
+ * clients' series line up on the server.  Samples are cumulative per flow,
+ * each one adds what its flow did since the last one.
+ */
+static void write_throughput_buckets(FILE *f, struct main_context *ctx)
+{
+        const struct rusage_interval *rui = &ctx->rusage_ival;
+        const double interval = ctx->opts->interval;
+        CLEANUP(free) unsigned long *counts = NULL;
+        CLEANUP(free) struct sample *samples = NULL;
+        unsigned long **per_flow;
+        struct timespec mono, real;
+        long first, last, bucket;
+        int num_samples = 0, i, j, max_tid = 0;
+        struct sample *p;
+        double offset;
+        struct thread *t;
+
+        if (!control_plane_clock_offset(ctx->cp, &offset)) {
+                clock_gettime(CLOCK_REALTIME, &real);
+                clock_gettime(CLOCK_MONOTONIC, &mono);
+                offset = timespec_seconds(&real) - timespec_seconds(&mono);
+        }
+        first = floor((timespec_seconds(&rui->window_start) + offset) /
+                      interval);
+        last = floor((timespec_seconds(&rui->window_end) + offset) / interval);
+
+        for (t = ctx->workers; t < ctx->workers + ctx->n_workers; t++) {
+                for (p = t->samples; p; p = p->next) {
+                        if (sample_in_window(p, t->window_end))
+                                num_samples++;
+                }
+        }
+        samples = calloc(num_samples, sizeof(*samples));
+        counts = calloc(last - first + 1, sizeof(*counts));
+        if (!samples || !counts)
+                PLOG_FATAL(ctx->cb, "calloc");
+        j = 0;
+        for (t = ctx->workers; t < ctx->workers + ctx->n_workers; t++) {
+                for (p = t->samples; p; p = p->next) {
+                        if (sample_in_window(p, t->window_end))
+                                samples[j++] = *p;
+                }
+        }
+        qsort(samples, num_samples, sizeof(*samples), compare_samples);
+
+        for (j = 0; j < num_samples; j++) {
+                if (samples[j].tid > max_tid)
+                        max_tid = samples[j].tid;
+        }
+        per_flow = calloc(max_tid + 1, sizeof(*per_flow));
+        if (!per_flow)
+                PLOG_FATAL(ctx->cb, "calloc per_flow");
+        for (i = 0; i <= max_tid; i++) {
+                int max_flow_id = 0;
+
+                for (j = 0; j < num_samples; j++) {
+                        if (samples[j].tid == i &&
+                            samples[j].flow_id > max_flow_id)
+                                max_flow_id = samples[j].flow_id;
+                }
+                per_flow[i] = calloc(max_flow_id + 1, sizeof(unsigned long));
+                if (!per_flow[i])
+                        PLOG_FATAL(ctx->cb, "calloc per_flow[%d]", i);
+        }
+        for (j = 0; j < num_samples; j++) {
+                unsigned long *last_total =
+                        &per_flow[samples[j].tid][samples[j].flow_id];
+
+                bucket = floor((timespec_seconds(&samples[j].timestamp) +
+                                offset) / interval);
+                if (bucket < first)
+                        bucket = first;
+                if (bucket > last)
+                        bucket = last;
+                counts[bucket - first] += samples[j].transactions - *last_total;
+                *last_total = samples[j].transactions;
+        }
+        for (i = 0; i <= max_tid; i++)
+                free(per_flow[i]);
+        free(per_flow);
+
+        fprintf(f, "interval=%.17g\n", interval);
+        fprintf(f, "throughput_buckets=%ld", first);
+        for (bucket = first; bucket <= last; bucket++)
+                fprintf(f, ",%lu", counts[bucket - first]);
+        fprintf(f, "\n");
+}
+
+static void add_latency(double val, void *histogram)
+{
+        histogram_add(histogram, val);
+}
+
+/* A client's measurements for the server to merge with the other clients'. */
+static char *build_client_report(struct main_context *ctx)
+{
+        unsigned long transactions = 0;
+        struct histogram *latency;
+        char *report = NULL;
+        struct sample *p;
+        struct thread *t;
+        size_t len;
+        char *text;
+        FILE *f;
+
+        latency = histogram_create(1e-9);
+        if (!latency)
+                PLOG_FATAL(ctx->cb, "histogram_create");
+        f = open_memstream(&report, &len);
+        if (!f)
+                PLOG_FATAL(ctx->cb, "open_memstream");
+        for (t = ctx->workers; t < ctx->workers + ctx->n_workers; t++) {
+                transactions += t->transactions;
+                for (p = t->samples; p; p = p->next) {
+                        if (sample_in_window(p, t->window_end))
+                                numlist_for_each(p->latency, add_latency,
+                                                 latency);
+                }
+        }
+        fprintf(f, "num_transactions=%lu\n", transactions);
+        if (ctx->opts->interval > 0)
+                write_throughput_buckets(f, ctx);
+        if (histogram_count(latency)) {
+                text = histogram_format(latency);
+                if (!text)
+                        PLOG_FATAL(ctx->cb, "histogram_format");
+                fprintf(f, "latency_histogram=%s\n", text);
+                free(text);
+        }
+        fclose(f);
+        histogram_destroy(latency);
+        return report;
+}
+
+/* A client's throughput series, as parsed from its report. */
+struct client_buckets {
+        long first;
+        int num;
+        unsigned long *counts;
+};
+
+static bool parse_buckets(const char *report, struct client_buckets *b)
+{
+        const char *p = report_find(report, "throughput_buckets");
+        unsigned long count, *counts;
+        int len;
+
+        b->num = 0;
+        b->counts = NULL;
+        if (!p || sscanf(p, "%ld%n", &b->first, &len) != 1)
+                return false;
+        for (p += len; sscanf(p, ",%lu%n", &count, &len) == 1; p += len) {
+                counts = realloc(b->counts, (b->num + 1) * sizeof(*counts));
+                if (!counts)
+                        return false;
+                b->counts = counts;
+                b->counts[b->num++] = count;
+        }
+        return b->num > 0;
+}
+
+/* Aggregate throughput of all clients over the intervals they all spent in
+ * their measurement windows.  The first and last interval of each client are
+ * only partly covered and left out.
+ */
+static void report_clients_throughput(struct callbacks *cb,
+                                      struct client_buckets *b, int n,
+                                      double interval)
+{
+        long lo = LONG_MIN, hi = LONG_MAX, bucket;
+        unsigned long total = 0;
+        int i;
+
+        for (i = 0; i < n; i++) {
+                if (b[i].first + 1 > lo)
+                        lo = b[i].first + 1;
+                if (b[i].first + b[i].num - 2 < hi)
+                        hi = b[i].first + b[i].num - 2;
+        }
+        if (lo > hi) {
+                LOG_WARN(cb, "clients have no measurement interval in common");
+                return;
+        }
+        for (i = 0; i < n; i++) {
+                for (bucket = lo; bucket <= hi; bucket++)
+                        total += b[i].counts[bucket - b[i].first];
+        }
+        PRINT(cb, "global_time_window", "%g", (hi - lo + 1) * interval);
+        PRINT(cb, "global_throughput", "%.2f",
+              total / ((hi - lo + 1) * interval));
+}
+
+/* Merge what the clients reported into results for the whole test. */
+static void report_clients(struct callbacks *cb, struct main_context *ctx)
+{
+        struct options *opts = ctx->opts;
+        CLEANUP(free) struct client_buckets *buckets = NULL;
+        double value, interval = 0, transactions = 0;
+        struct histogram *latency, *h;
+        int i, num_reports = 0, num_buckets = 0;
+        bool same_interval = true;
+        const char *report, *p;
+
+        latency = histogram_create(1e-9);
+        buckets = calloc(opts->num_clients, sizeof(*buckets));
+        if (!latency || !buckets)
+                PLOG_FATAL(cb, "calloc");
+        for (i = 0; i < opts->num_clients; i++) {
+                report = control_plane_client_report(ctx->cp, i);
+                if (!report_value(report, "num_transactions", &value)) {
+                        LOG_WARN(cb, "client %d sent no report", i);
+                        continue;
+                }
+                num_reports++;
+                transactions += value;
+                if (report_value(report, "interval", &value)) {
+                        if (interval && value != interval)
+                                same_interval = false;
+                        interval = value;
+                }
+                if (parse_buckets(report, &buckets[num_buckets]))
+                        num_buckets++;
+                else
+                        free(buckets[num_buckets].counts);
+                p = report_find(report, "latency_histogram");
+                if (!p)
+                        continue;
+                h = histogram_parse(p);
+                if (!h || histogram_merge(latency, h))
+                        LOG_WARN(cb, "invalid latency histogram from client %d",
+                                 i);
+                histogram_destroy(h);
+        }
+        if (num_reports) {
+                PRINT(cb, "global_num_clients", "%d", num_reports);
+                PRINT(cb, "global_num_transactions", "%.0f", transactions);
+        }
+        if (!same_interval)
+                LOG_WARN(cb, "clients used different intervals");
+        else if (transactions && num_buckets && num_buckets == num_reports)
+                report_clients_throughput(cb, buckets, num_buckets, interval);
+        for (i = 0; i < num_buckets; i++)
+                free(buckets[i].counts);
+        if (histogram_count(latency)) {
+                PRINT(cb, "global_latency_min", "%f", histogram_min(latency));
+                PRINT(cb, "global_latency_max", "%f", histogram_max(latency));
+                PRINT(cb, "global_latency_mean", "%f",
+                      histogram_mean(latency));
+                for (i = 0; i <= 100; i++) {
+                        char key[32];
+
+                        if (!opts->percentiles.chosen[i])
+                                continue;
+                        sprintf(key, "global_latency_p%d", i);
+                        PRINT(cb, key, "%f",
+                              histogram_percentile(latency, i));
+                }
+        }
+        histogram_destroy(latency);
+}
+
+/* CPU time both sides spent per transaction, or per KiB for stream tests,
+ * where the work is whatever the reading side has received.
+ */
+static void report_service_demand(struct callbacks *cb,
+                                  struct main_context *ctx,
+                                  const char *remote)
+{
+        double transactions = 0, bytes_read = 0;
+        double remote_transactions = 0, remote_bytes = 0;
+        double local_cpu, remote_cpu, work, remote_work;
+        const char *unit = "us/tran";
+        struct thread *t;
+
+        if (!report_value(remote, "cpu_seconds", &remote_cpu))
+                return;
+        local_cpu = cpu_seconds(&ctx->rusage_ival);
+        for (t = ctx->workers; t < ctx->workers + ctx->n_workers; t++) {
+                transactions += t->transactions;
+                bytes_read += t->bytes_read;
+        }
+        report_value(remote, "num_transactions", &remote_transactions);
+        report_value(remote, "bytes_read", &remote_bytes);
+
+        /* Each side's CPU time goes over the work it counted itself.  Of a
+         * stream, only the side that reads it counts the bytes.
+         */
+        work = transactions;
+        remote_work = remote_transactions;
+        if (!work) {
+                work = (bytes_read ? bytes_read : remote_bytes) / 1024;
+                remote_work = (remote_bytes ? remote_bytes : bytes_read) / 1024;
+                unit = "us/KB";
+        }
+        if (!work)
+                return;
+        PRINT(cb, "service_demand_unit", "%s", unit);
+        PRINT(cb, "local_service_demand", "%.3f", local_cpu * 1e6 / work);
+        if (remote_work)
+                PRINT(cb, "remote_service_demand", "%.3f",
+                      remote_cpu * 1e6 / remote_work);
+}
+
+/* Print what the server reported, with keys prefixed by remote_. */
+static void report_remote(struct callbacks *cb, struct main_context *ctx,
+                          const char *remote)
+{
+        char line[256], key[sizeof("remote_") + sizeof(line)];
+        const char *p, *end;
+        char *value;
+
+        for (p = remote; *p; p = *end ? end + 1 : end) {
+                end = strchrnul(p, '\n');
+                if (end - p >= sizeof(line))
+                        continue;
+                memcpy(line, p, end - p);
+                line[end - p] = '\0';
+                value = strchr(line, '=');
+                if (!value)
+                        continue;
+                *value++ = '\0';
+                snprintf(key, sizeof(key), "remote_%s", line);
+                PRINT(cb, key, "%s", value);
+        }
+        report_service_demand(cb, ctx, remote);
+}
+
+/* Ask for no deep C-states for as long as /dev/cpu_dma_latency stays open. */
+static void setup_low_latency(struct main_context *ctx)
+{
+        struct callbacks *cb = ctx->cb;
+        int32_t latency = 0;
+        int fd;
+
+        set_realtime(cb, pthread_self(), 1);
+
+        fd = open("/dev/cpu_dma_latency", O_WRONLY);
+        if (fd == -1) {
+                LOG_WARN(cb, "open /dev/cpu_dma_latency: %s", strerror(errno));
+                return;
+        }
+        if (write(fd, &latency, sizeof(latency)) != sizeof(latency)) {
+                LOG_WARN(cb, "write /dev/cpu_dma_latency: %s",
+                         strerror(errno));
+                do_close(fd);
+                return;
+        }
+        ctx->cpu_dma_latency_fd = fd;
+}
+
+static void teardown_low_latency(struct main_context *ctx)
+{
+        if (ctx->cpu_dma_latency_fd != -1)
+                do_close(ctx->cpu_dma_latency_fd);
+        ctx->cpu_dma_latency_fd = -1;
+        munlockall();
+}
+
+/* Host jitter as seen by each worker while its traffic ran. */
+static void report_thread_jitter(struct callbacks *cb, struct main_context *ctx)
+{
+        const struct rusage *start, *end;
+        const struct sample *s;
+        struct thread *t;
+        char key[32];
+        int i;
+
+        for (i = 0; i < ctx->n_workers; i++) {
+                t = &ctx->workers[i];
+                /* The last sample of the window, against the start */
+                for (s = t->samples; s; s = s->next) {
+                        if (sample_in_window(s, t->window_end))
+                                break;
+                }
+                if (!s)
+                        continue;
+                start = &t->thread_rusage_start;
+                end = &s->rusage;
+                snprintf(key, sizeof(key), "nivcsw[%d]", i);
+                PRINT(cb, key, "%ld", end->ru_nivcsw - start->ru_nivcsw);
+                snprintf(key, sizeof(key), "majflt[%d]", i);
+                PRINT(cb, key, "%ld", end->ru_majflt - start->ru_majflt);
+        }
+}
+
+/* Which CPUs ran worker threads, and which processed received packets. */
+static void report_cpus(struct callbacks *cb, struct main_context *ctx)
+{
+        cpu_set_t net_rx_cpus;
+        char buf[1024];
+        int cpu;
+
+        if (!ctx->pin_cpu)
+                return;
+
+        CPU_ZERO(&net_rx_cpus);
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (ctx->net_rx_end[cpu] > ctx->net_rx_start[cpu])
+                        CPU_SET(cpu, &net_rx_cpus);
+        }
+        PRINT(cb, "app_cpus", "%s",
+              format_cpulist(&ctx->app_cpus, buf, sizeof(buf)));
+        if (ctx->opts->skip_irq_cpus)
+                PRINT(cb, "irq_cpus", "%s",
+                      format_cpulist(&ctx->irq_cpus, buf, sizeof(buf)));
+        PRINT(cb, "net_rx_cpus", "%s",
+              format_cpulist(&net_rx_cpus, buf, sizeof(buf)));
+}
+
+/* Short tests still need a few samples to compute throughput and count
+ * transactions from.
+ */
+static void check_interval(struct options *opts, struct callbacks *cb)
+{
+        if (opts->interval >= opts->test_length) {
+                LOG_WARN(cb, "interval not below test length, using %g seconds",
+                         opts->test_length / 10);
+                opts->interval = opts->test_length / 10;
+        }
+}
+
+/* One test, from starting the workers to printing the results. */
+static void run_test(struct main_context *ctx, struct script_engine *se,
+                     void (*report_stats)(struct thread *))
+{
+        pthread_barrier_t *ready = &ctx->threads_ready;
+        struct rusage_interval *rui = &ctx->rusage_ival;
+        struct options *opts = ctx->opts;
+        struct callbacks *cb = ctx->cb;
+        int r;
+
+        r = pthread_barrier_init(ready, NULL, ctx->n_workers + 1);
+        if (r != 0)
+                LOG_FATAL(cb, "pthread_barrier_init: %s", strerror(r));
+
+        if (!opts->client && opts->server_model) {
+                ctx->pool = server_pool_create(opts->server_model,
+                                               ctx->n_workers, cb);
+                for (r = 0; r < ctx->n_workers; r++)
+                        ctx->workers[r].pool = ctx->pool;
+        }
+        if (opts->rebalance && ctx->pool)
+                LOG_FATAL(cb, "--rebalance needs run-to-completion threads");
+        if (opts->rebalance) {
+                ctx->rebalance = rebalance_group_create(ctx->n_workers, cb);
+                for (r = 0; r < ctx->n_workers; r++)
+                        ctx->workers[r].rb = rebalance_get(ctx->rebalance, r);
+        }
+
+        if (opts->script) {
+                r = script_engine_run_file(se, opts->script,
+                                           run_worker_threads, ctx);
+                if (r < 0)
+                        LOG_FATAL(cb, "script failed: %s: %s",
+                                  opts->script, strerror(-r));
+        } else {
+                run_worker_threads(se, ctx);
+        }
+
+        r = pthread_barrier_destroy(ready);
+        if (r != 0)
+                LOG_FATAL(cb, "pthread_barrier_destroy: %s", strerror(r));
+
+        if (opts->client) {
+                CLEANUP(free) char *report = build_client_report(ctx);
+                control_plane_stop(ctx->cp, report);
+        } else {
+                CLEANUP(free) char *report = build_server_report(ctx);
+                control_plane_stop(ctx->cp, report);
+        }
+        PRINT(cb, "invalid_secret_count", "%d", control_plane_incidents(ctx->cp));
+        report_rusage(cb, rui);
+        report_cpus(cb, ctx);
+        if (opts->low_latency)
+                report_thread_jitter(cb, ctx);
+        if (ctx->rebalance)
+                rebalance_report(ctx->rebalance, cb);
+        if (opts->client)
+                report_remote(cb, ctx, control_plane_remote_report(ctx->cp));
+        else
+                report_clients(cb, ctx);
+        report_stats(ctx->workers);
+        script_engine_report(se);
+        rebalance_group_destroy(ctx->rebalance);
+        ctx->rebalance = NULL;
+        server_pool_destroy(ctx->pool);
+        ctx->pool = NULL;
+}
+
+/* Serve test after test with the same threads, each with the parameters its
+ * clients asked for.  The server's own -T is the most threads it runs.
+ */
+static void run_daemon(struct main_context *ctx, struct script_engine *se,
+                       void (*report_stats)(struct thread *))
+{
+        const struct options base = *ctx->opts;
+        struct options *opts = ctx->opts;
+        struct callbacks *cb = ctx->cb;
+        int test;
+
+        for (test = 0; ; test++) {
+                *opts = base;
+                control_plane_accept(ctx->cp);
+                if (opts->num_threads > base.num_threads) {
+                        LOG_WARN(cb, "clients asked for %d threads, running %d",
+                                 opts->num_threads, base.num_threads);
+                        opts->num_threads = base.num_threads;
+                }
+                ctx->n_workers = opts->num_threads;
+                PRINT(cb, "test_index", "%d", test);
+                PRINT(cb, "total_run_time", "%g", opts->test_length);
+                check_interval(opts, cb);
+                run_test(ctx, se, report_stats);
+                reset_worker_threads(ctx);
+                /* the script runs again, from scratch, for the next test */
+                script_engine_reset(se);
+        }
+}
+
 int run_main_thread(struct options *opts, struct callbacks *cb,
                     void *(*thread_func)(void *),
                     void (*report_stats)(struct thread *))
@@ -282,6 +1249,7 @@ int run_main_thread(struct options *opts, struct callbacks *cb,
                 .rusage_ival = {
                         .time_start_mutex = PTHREAD_MUTEX_INITIALIZER,
                 },
+                .cpu_dma_latency_fd = -1,
         };
         struct main_context *ctx = &ctx_;
         struct rusage_interval *rui = &ctx->rusage_ival;
@@ -290,23 +1258,43 @@ int run_main_thread(struct options *opts, struct callbacks *cb,
         struct script_engine *se;
         int r;
 
-        PRINT(cb, "total_run_time", "%d", opts->test_length);
+        if (!opts->daemon)
+                PRINT(cb, "total_run_time", "%g", opts->test_length);
         if (opts->dry_run)
                 return 0;
+        check_interval(opts, cb);
+
+        setup_cpu_pinning(ctx);
+        if (opts->low_latency)
+                setup_low_latency(ctx);
 
         r = script_engine_create(&se, cb, opts->client);
         if (r < 0)
                 LOG_FATAL(cb, "failed to create script engine: %s", strerror(-r));
+        if (opts->plugin) {
+                r = script_engine_load_plugin(se, opts->plugin);
+                if (r < 0)
+                        LOG_FATAL(cb, "failed to load plugin: %s: %s",
+                                  opts->plugin, strerror(-r));
+        }
+        if (opts->profile_hooks) {
+                r = script_engine_profile_hooks(se);
+                if (r < 0)
+                        LOG_FATAL(cb, "failed to set up hook profiling: %s",
+                                  strerror(-r));
+        }
+        if (opts->script_gc) {
+                r = script_engine_set_gc(se, opts->script_gc);
+                if (r < 0)
+                        LOG_FATAL(cb, "invalid --script-gc: %s: %s",
+                                  opts->script_gc, strerror(-r));
+        }
 
         ctx->cp = control_plane_create(opts, cb, se);
         if (!ctx->cp)
                 LOG_FATAL(cb, "failed to create control plane");
         control_plane_start(ctx->cp, &ai);
 
-        r = pthread_barrier_init(ready, NULL, opts->num_threads + 1);
-        if (r != 0)
-                LOG_FATAL(cb, "pthread_barrier_init: %s", strerror(r));
-
         // start threads *after* control plane is up, to reuse addrinfo.
         ctx->worker_func = thread_func;
         ctx->n_workers = opts->num_threads;
@@ -314,25 +1302,15 @@ int run_main_thread(struct options *opts, struct callbacks *cb,
                                              rui, ai, se);
         free(ai);
 
-        if (opts->script) {
-                r = script_engine_run_file(se, opts->script,
-                                           run_worker_threads, ctx);
-                if (r < 0)
-                        LOG_FATAL(cb, "script failed: %s: %s",
-                                  opts->script, strerror(-r));
-        } else {
-                run_worker_threads(se, ctx);
-        }
-
-        r = pthread_barrier_destroy(ready);
-        if (r != 0)
-                LOG_FATAL(cb, "pthread_barrier_destroy: %s", strerror(r));
+        if (opts->daemon)
+                run_daemon(ctx, se, report_stats);
+        else
+                run_test(ctx, se, report_stats);
 
-        control_plane_stop(ctx->cp);
-        PRINT(cb, "invalid_secret_count", "%d", control_plane_incidents(ctx->cp));
-        report_rusage(cb, rui);
-        report_stats(ctx->workers);
-        free_worker_threads(ctx->n_workers, ctx->workers);
+        exit_worker_threads(cb, ctx);
+        if (opts->low_latency)
+                teardown_low_latency(ctx);
+        free_worker_threads(opts->num_threads, ctx->workers);
         control_plane_destroy(ctx->cp);
         se = script_engine_destroy(se);
 
@@ -19,6 +19,7 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <sys/resource.h>
 #include "lib.h"
 #include "script.h"
 
@@ -26,11 +27,13 @@ struct sample;
 
 struct thread {
         int index;
+        int node;               /* NUMA node pinned to, or -1 */
         pthread_t id;
         int stop_efd;
         struct addrinfo *ai;
         struct sample *samples;
         unsigned long transactions;
+        unsigned long bytes_read;       /* counted by all flows of the thread */
         struct options *opts;
         struct callbacks *cb;
         int next_flow_id;
@@ -39,9 +42,19 @@ struct thread {
         struct timespec *time_start;
         pthread_mutex_t *time_start_mutex;
         struct rusage *rusage_start;
+        struct rusage thread_rusage_start; /* RUSAGE_THREAD as traffic starts */
+        const struct timespec *window_end; /* samples after it are ignored */
         struct script_slave *script_slave;
+        struct rebalance *rb;   /* NULL unless --rebalance */
+        struct server_pool *pool; /* NULL for run-to-completion servers */
+        const struct socket_ops *ops;   /* set by the run_*() routines */
+        void *(*func)(void *);  /* the workload's thread function */
+        int start_efd;          /* --daemon: 1 runs the next test, 2 exits */
+        int done_efd;           /* --daemon: the test is over */
 };
 
+/* Workers call this once set up, and start their traffic when it returns. */
+void thread_wait_start(struct thread *t);
 int run_main_thread(struct options *opts, struct callbacks *cb,
                     void *(*thread_func)(void *),
                     void (*report_stats)(struct thread *));
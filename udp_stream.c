@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <limits.h>
 #include <sys/prctl.h>
 
 #include "common.h"
@@ -24,6 +25,42 @@
 #include "thread.h"
 #include "workload.h"
 
+/* Send or receive up to --batch-size datagrams, all of them from or into @buf.
+ * Returns the number of bytes, and of datagrams in @num_msgs.
+ */
+static ssize_t transfer(struct thread *t, int fd, char *buf, bool send,
+                        int *num_msgs)
+{
+        struct script_slave *ss = t->script_slave;
+        const int batch_size = t->opts->batch_size;
+        struct mmsghdr msgvec[IOV_MAX];
+        struct iovec iov = {
+                .iov_base = buf,
+                .iov_len = t->opts->buffer_size
+        };
+        ssize_t num_bytes = 0;
+        int i, n;
+
+        *num_msgs = 1;
+        if (batch_size == 1) {
+                return send ? do_write(ss, t->ops, fd, buf, iov.iov_len, 0) :
+                              do_read(ss, t->ops, fd, buf, iov.iov_len, 0);
+        }
+        memset(msgvec, 0, batch_size * sizeof(msgvec[0]));
+        for (i = 0; i < batch_size; i++) {
+                msgvec[i].msg_hdr.msg_iov = &iov;
+                msgvec[i].msg_hdr.msg_iovlen = 1;
+        }
+        n = send ? do_sendmmsg(ss, fd, msgvec, batch_size, 0) :
+                   do_recvmmsg(ss, fd, msgvec, batch_size, 0);
+        if (n == -1)
+                return -1;
+        for (i = 0; i < n; i++)
+                num_bytes += msgvec[i].msg_len;
+        *num_msgs = n;
+        return num_bytes;
+}
+
 static void process_events(struct thread *t, int epfd,
                            struct epoll_event *events, int nfds,
                            int listen_fd, char *buf)
@@ -34,7 +71,7 @@ static void process_events(struct thread *t, int epfd,
 
         struct flow *flow;
         ssize_t num_bytes;
-        int i;
+        int i, num_msgs;
 
         UNUSED(epfd);
         UNUSED(listen_fd);
@@ -48,17 +85,19 @@ static void process_events(struct thread *t, int epfd,
                 }
 
                 if (opts->enable_read && (events[i].events & EPOLLIN)) {
-                        ssize_t to_read = opts->buffer_size;
 read_again:
-                        num_bytes = do_read(ss, flow->fd, buf, to_read, 0);
+                        num_bytes = transfer(t, flow->fd, buf, false,
+                                             &num_msgs);
                         if (num_bytes == -1) {
                                 if (errno != EAGAIN)
                                         PLOG_ERROR(cb, "read");
                                 continue;
                         }
 
+                        t->bytes_read += num_bytes;
+
                         flow->bytes_read += num_bytes;
-                        flow->transactions++;
+                        flow->transactions += num_msgs;
                         interval_collect(flow, t);
 
                         if (opts->edge_trigger)
@@ -66,17 +105,19 @@ read_again:
                 }
 
                 if (opts->enable_write && (events[i].events & EPOLLOUT)) {
-                        ssize_t to_write = opts->buffer_size;
 write_again:
-                        num_bytes = do_write(ss, flow->fd, buf, to_write, 0);
+                        num_bytes = transfer(t, flow->fd, buf, true,
+                                             &num_msgs);
                         if (num_bytes == -1) {
                                 if (errno != EAGAIN)
                                         PLOG_ERROR(cb, "write");
                                 continue;
                         }
 
+                        t->bytes_read += num_bytes;
+
                         flow->bytes_read += num_bytes;
-                        flow->transactions++;
+                        flow->transactions += num_msgs;
                         interval_collect(flow, t);
 
                         if (opts->edge_trigger)
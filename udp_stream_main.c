@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <limits.h>
 #include "common.h"
 #include "flags.h"
 #include "lib.h"
@@ -31,10 +32,12 @@ static void check_options(struct options *opts, struct callbacks *cb)
                 CHECK(cb, opts->num_flows >= opts->num_threads,
                       "There should not be less flows than threads.");
         }
-        CHECK(cb, opts->test_length >= 1,
-              "Test length must be at least 1 second.");
+        CHECK(cb, opts->test_length >= 0.001,
+              "Test length must be at least 1 millisecond.");
         CHECK(cb, opts->buffer_size > 0,
               "Buffer size must be positive.");
+        CHECK(cb, opts->batch_size >= 1 && opts->batch_size <= IOV_MAX,
+              "Batch size must be between 1 and %d.", IOV_MAX);
         CHECK(cb, opts->interval > 0,
               "Interval must be positive.");
         CHECK(cb, opts->client || (opts->local_host == NULL),
@@ -56,8 +59,9 @@ int main(int argc, char **argv)
         DEFINE_FLAG(fp, int,           num_flows,       1,       'F', "Total number of flows");
         DEFINE_FLAG(fp, int,           num_threads,     1,       'T', "Number of threads");
         DEFINE_FLAG(fp, int,           num_clients,     1,        0,  "Number of clients");
-        DEFINE_FLAG(fp, int,           test_length,     10,      'l', "Test length in seconds");
+        DEFINE_FLAG(fp, double,        test_length,     10.0,    'l', "Test length in seconds");
         DEFINE_FLAG(fp, int,           buffer_size,     16384,   'B', "Number of bytes that each read/write uses as the buffer");
+        DEFINE_FLAG(fp, int,           batch_size,      1,        0,  "Datagrams per recvmmsg()/sendmmsg() call, or 1 for read()/write()");
         DEFINE_FLAG(fp, int,           suicide_length,  0,       's', "Suicide length in seconds");
         DEFINE_FLAG(fp, bool,          ipv4,            false,   '4', "Set desired address family to AF_INET");
         DEFINE_FLAG(fp, bool,          ipv6,            false,   '6', "Set desired address family to AF_INET6");
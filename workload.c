@@ -22,6 +22,8 @@
 #include "flow.h"
 #include "interval.h"
 #include "lib.h"
+#include "numlist.h"
+#include "rebalance.h"
 #include "sample.h"
 #include "thread.h"
 #include "workload.h"
@@ -48,6 +50,13 @@ static int socket_listen(const struct socket_ops *ops, int sockfd, int backlog)
         return ops->listen ? ops->listen(sockfd, backlog) : 0;
 }
 
+int socket_accept(const struct socket_ops *ops, int sockfd,
+                  struct sockaddr *addr, socklen_t *addrlen)
+{
+        return ops->accept ? ops->accept(sockfd, addr, addrlen) :
+                             accept(sockfd, addr, addrlen);
+}
+
 static int socket_connect(const struct socket_ops *ops, int sockfd,
                           const struct sockaddr *addr, socklen_t addrlen)
 {
@@ -59,8 +68,8 @@ static int socket_close(const struct socket_ops *ops, int sockfd)
         return ops->close ? ops->close(sockfd) : 0;
 }
 
-static int do_epoll_wait(const struct socket_ops *ops, int epfd,
-                         struct epoll_event *events, int maxevents, int timeout)
+int do_epoll_wait(const struct socket_ops *ops, int epfd,
+                  struct epoll_event *events, int maxevents, int timeout)
 {
         if (ops->epoll_wait)
                 return ops->epoll_wait(epfd, events, maxevents, timeout);
@@ -118,21 +127,40 @@ const struct socket_ops udp_socket_ops = {
         .connect = do_connect,
 };
 
-/* Allocate and initialize a buffer big enough for sending/receiving. */
-static void *buf_alloc(struct options *opts)
+const struct sequence *thread_sequence(struct thread *t)
 {
-        size_t alloc_size = opts->request_size;
-        void *buf;
+        return t->script_slave ? t->script_slave->se->sequence : NULL;
+}
 
-        if (alloc_size < opts->response_size)
-                alloc_size = opts->response_size;
+size_t buf_size(struct thread *t)
+{
+        const struct sequence *seq = thread_sequence(t);
+        struct options *opts = t->opts;
+        size_t size = opts->request_size;
+
+        if (size < opts->response_size)
+                size = opts->response_size;
+        if (size && seq && size < seq->max_msg)
+                size = seq->max_msg;
         /* request/response sizes are zero for stream workloads */
-        if (!alloc_size || alloc_size > opts->buffer_size)
-                alloc_size = opts->buffer_size;
+        if (!size || size > opts->buffer_size)
+                size = opts->buffer_size;
 
-        buf = calloc(alloc_size, sizeof(char));
-        if (!buf)
+        return size;
+}
+
+/* Runs in the worker thread after it has been pinned, so touching every page
+ * right away places the buffer on the thread's NUMA node.
+ */
+void *buf_alloc(struct thread *t)
+{
+        size_t alloc_size = buf_size(t);
+        struct options *opts = t->opts;
+        void *buf;
+
+        if (posix_memalign(&buf, sysconf(_SC_PAGESIZE), alloc_size))
                 return NULL;
+        memset(buf, 0, alloc_size);
 
         if (opts->enable_write)
                 fill_random(buf, alloc_size);
@@ -206,6 +234,7 @@ void run_client(struct thread *t, const struct socket_ops *ops,
         CLEANUP(free) int *client_fds = NULL;
 
         assert(ops);
+        t->ops = ops;
 
         client_fds = calloc(flows_in_this_thread, sizeof(int));
         if (!client_fds)
@@ -220,7 +249,8 @@ void run_client(struct thread *t, const struct socket_ops *ops,
                 fd = client_connect(t, ops);
                 setup_connected_socket(fd, opts, cb);
 
-                flow = addflow(t->index, epfd, fd, i, epoll_events(opts), cb);
+                flow = addflow(t->index, epfd, fd, t->next_flow_id++,
+                               epoll_events(opts), cb);
                 flow->bytes_to_write = opts->request_size;
                 flow->itv = interval_create(opts->interval, t);
 
@@ -229,10 +259,12 @@ void run_client(struct thread *t, const struct socket_ops *ops,
         }
 
         events = calloc(opts->maxevents, sizeof(struct epoll_event));
-        buf = buf_alloc(opts);
+        buf = buf_alloc(t);
         if (!buf)
                 PLOG_FATAL(cb, "buf_alloc");
-        pthread_barrier_wait(t->ready);
+        if (t->rb)
+                rebalance_start(t, epfd);
+        thread_wait_start(t);
         while (!t->stop) {
                 int ms = opts->nonblocking ? 10 /* milliseconds */ : -1;
                 int nfds = do_epoll_wait(ops, epfd, events, opts->maxevents, ms);
@@ -241,8 +273,14 @@ void run_client(struct thread *t, const struct socket_ops *ops,
                                 continue;
                         PLOG_FATAL(cb, "epoll_wait");
                 }
+                if (t->rb)
+                        nfds = rebalance_events(t, events, nfds, -1);
                 process_events(t, epfd, events, nfds, -1, buf);
+                if (t->rb)
+                        rebalance_account(t);
         }
+        if (t->rb)
+                rebalance_stop(t);
 
         for (i = 0; i < flows_in_this_thread; i++) {
                 if (do_socket_close(ops, ss, client_fds[i], ai) < 0)
@@ -256,22 +294,14 @@ void run_client(struct thread *t, const struct socket_ops *ops,
         do_close(epfd);
 }
 
-void run_server(struct thread *t, const struct socket_ops *ops,
-                process_events_t process_events)
+int server_socket_open(struct thread *t, const struct socket_ops *ops)
 {
-        struct script_slave *ss = t->script_slave;
         struct options *opts = t->opts;
         struct callbacks *cb = t->cb;
         struct addrinfo *ai = t->ai;
-        struct epoll_event *events;
-        struct flow *listen_fl;
-        struct flow *stop_fl;
-        int fd_listen, epfd;
-        char *buf;
+        int fd_listen;
 
-        assert(ops);
-
-        fd_listen = do_socket_open(ops, ss, ai);
+        fd_listen = do_socket_open(ops, t->script_slave, ai);
         if (fd_listen == -1)
                 PLOG_FATAL(cb, "socket");
         if (opts->reuseport)
@@ -283,6 +313,31 @@ void run_server(struct thread *t, const struct socket_ops *ops,
                 set_min_rto(fd_listen, opts->min_rto, cb);
         if (socket_listen(ops, fd_listen, opts->listen_backlog))
                 PLOG_FATAL(cb, "listen");
+        return fd_listen;
+}
+
+void server_socket_close(struct thread *t, const struct socket_ops *ops,
+                         int fd_listen)
+{
+        if (do_socket_close(ops, t->script_slave, fd_listen, t->ai) < 0)
+                PLOG_FATAL(t->cb, "close");
+}
+
+void run_server(struct thread *t, const struct socket_ops *ops,
+                process_events_t process_events)
+{
+        struct options *opts = t->opts;
+        struct callbacks *cb = t->cb;
+        struct epoll_event *events;
+        struct flow *listen_fl;
+        struct flow *stop_fl;
+        int fd_listen, epfd;
+        char *buf;
+
+        assert(ops);
+        t->ops = ops;
+
+        fd_listen = server_socket_open(t, ops);
         epfd = epoll_create1(0);
         if (epfd == -1)
                 PLOG_FATAL(cb, "epoll_create1");
@@ -293,10 +348,12 @@ void run_server(struct thread *t, const struct socket_ops *ops,
 
         stop_fl = addflow_lite(epfd, t->stop_efd, EPOLLIN, cb);
         events = calloc(opts->maxevents, sizeof(struct epoll_event));
-        buf = buf_alloc(opts);
+        buf = buf_alloc(t);
         if (!buf)
                 PLOG_FATAL(cb, "buf_alloc");
-        pthread_barrier_wait(t->ready);
+        if (t->rb)
+                rebalance_start(t, epfd);
+        thread_wait_start(t);
         while (!t->stop) {
                 int ms = opts->nonblocking ? 10 /* milliseconds */ : -1;
                 int nfds = do_epoll_wait(ops, epfd, events, opts->maxevents, ms);
@@ -305,11 +362,16 @@ void run_server(struct thread *t, const struct socket_ops *ops,
                                 continue;
                         PLOG_FATAL(cb, "epoll_wait");
                 }
+                if (t->rb)
+                        nfds = rebalance_events(t, events, nfds, fd_listen);
                 process_events(t, epfd, events, nfds, fd_listen, buf);
+                if (t->rb)
+                        rebalance_account(t);
         }
+        if (t->rb)
+                rebalance_stop(t);
 
-        if (do_socket_close(ops, ss, fd_listen, ai) < 0)
-                PLOG_FATAL(cb, "close");
+        server_socket_close(t, ops, fd_listen);
         delflow(t->index, epfd, listen_fl, cb);
 
         free(buf);
@@ -318,6 +380,432 @@ void run_server(struct thread *t, const struct socket_ops *ops,
         do_close(epfd);
 }
 
+/*
+ * Sequences.  Each flow walks through the steps of the sequence, in a loop
+ * after the setup ones, and the client reconnects every seq->reuse loops.
+ * Lua isn't involved past compiling the sequence, apart from the hooks.
+ */
+
+/* Moves @flow to its next step.  Returns true if the client is to reconnect
+ * before running it.
+ */
+static bool seq_advance(const struct sequence *seq, struct flow *flow)
+{
+        if (++flow->step < seq->num_steps)
+                return false;
+        flow->step = seq->loop_start;
+        if (!seq->reuse || ++flow->loops < seq->reuse)
+                return false;
+        flow->step = 0;
+        flow->loops = 0;
+        return true;
+}
+
+struct seq_client {
+        struct thread *t;
+        const struct socket_ops *ops;
+        const struct sequence *seq;
+        int epfd;
+        struct flow **flows;
+        int num_flows;
+        int thinking;           /* flows in a think step */
+        char *buf;
+        size_t buf_len;
+};
+
+/* Replaces the connection of @flow with a new one, keeping its stats. */
+static void seq_client_reconnect(struct seq_client *c, struct flow *flow)
+{
+        struct thread *t = c->t;
+        struct callbacks *cb = t->cb;
+        struct epoll_event ev;
+
+        epoll_del_or_err(c->epfd, flow->fd, cb);
+        if (do_socket_close(c->ops, t->script_slave, flow->fd, t->ai) < 0)
+                PLOG_ERROR(cb, "close");
+
+        flow->fd = client_connect(t, c->ops);
+        setup_connected_socket(flow->fd, t->opts, cb);
+        set_nonblocking(flow->fd, cb);
+
+        flow->events = EPOLLRDHUP;
+        ev.events = flow->events;
+        ev.data.ptr = flow;
+        epoll_ctl_or_die(c->epfd, EPOLL_CTL_ADD, flow->fd, &ev, cb);
+}
+
+/* Sets @flow up for its current step and waits for the events it needs. */
+static void seq_client_enter(struct seq_client *c, struct flow *flow)
+{
+        const struct seq_step *s = &c->seq->steps[flow->step];
+        uint32_t events = EPOLLRDHUP;
+        long nsec;
+
+        switch (s->op) {
+        case SEQ_SEND:
+                flow->bytes_to_write = s->arg;
+                clock_gettime(CLOCK_MONOTONIC, &flow->write_time);
+                events |= EPOLLOUT;
+                break;
+        case SEQ_RECV:
+                flow->bytes_to_read = s->arg;
+                events |= EPOLLIN;
+                break;
+        case SEQ_THINK:
+                clock_gettime(CLOCK_MONOTONIC, &flow->wake_time);
+                nsec = flow->wake_time.tv_nsec + (s->arg % 1000000) * 1000L;
+                flow->wake_time.tv_sec += s->arg / 1000000 + nsec / 1000000000;
+                flow->wake_time.tv_nsec = nsec % 1000000000;
+                c->thinking++;
+                break;
+        }
+        if (events != flow->events && modflow(c->epfd, flow, events))
+                PLOG_FATAL(c->t->cb, "epoll_ctl");
+}
+
+static void seq_client_next(struct seq_client *c, struct flow *flow)
+{
+        if (seq_advance(c->seq, flow))
+                seq_client_reconnect(c, flow);
+        seq_client_enter(c, flow);
+}
+
+/* Ends the think steps that are over, returns how long until the next one
+ * ends in milliseconds, or -1 if no flow is thinking.
+ */
+static int seq_client_wake(struct seq_client *c)
+{
+        double next = INFINITY, left;
+        struct timespec now;
+        struct flow *flow;
+        int i;
+
+        if (!c->thinking)
+                return -1;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for (i = 0; i < c->num_flows; i++) {
+                flow = c->flows[i];
+                while (flow && c->seq->steps[flow->step].op == SEQ_THINK) {
+                        left = seconds_between(&now, &flow->wake_time);
+                        if (left > 0) {
+                                next = fmin(next, left);
+                                break;
+                        }
+                        c->thinking--;
+                        seq_client_next(c, flow);
+                }
+        }
+        if (!c->thinking)
+                return -1;
+        return ceil(next * 1000);
+}
+
+static void seq_client_drop(struct seq_client *c, struct flow *flow)
+{
+        int i;
+
+        for (i = 0; i < c->num_flows; i++) {
+                if (c->flows[i] == flow)
+                        c->flows[i] = NULL;
+        }
+        if (c->seq->steps[flow->step].op == SEQ_THINK)
+                c->thinking--;
+        delflow(c->t->index, c->epfd, flow, c->t->cb);
+}
+
+static void seq_client_events(struct seq_client *c, struct epoll_event *events,
+                              int nfds)
+{
+        struct script_slave *ss = c->t->script_slave;
+        struct callbacks *cb = c->t->cb;
+        struct thread *t = c->t;
+        struct timespec now;
+        struct flow *flow;
+        ssize_t num_bytes;
+        double latency;
+        int i;
+
+        for (i = 0; i < nfds; i++) {
+                flow = events[i].data.ptr;
+                if (flow->fd == t->stop_efd) {
+                        t->stop = 1;
+                        break;
+                }
+                if (events[i].events & EPOLLRDHUP) {
+                        seq_client_drop(c, flow);
+                        continue;
+                }
+                if (events[i].events & EPOLLOUT &&
+                    c->seq->steps[flow->step].op == SEQ_SEND) {
+                        ssize_t to_write = flow->bytes_to_write;
+                        int flags = 0;
+
+                        if (to_write > c->buf_len) {
+                                to_write = c->buf_len;
+                                flags |= MSG_MORE;
+                        }
+                        num_bytes = do_write(ss, c->ops, flow->fd, c->buf,
+                                             to_write, flags);
+                        if (num_bytes == -1) {
+                                PLOG_ERROR(cb, "write");
+                                continue;
+                        }
+                        flow->bytes_to_write -= num_bytes;
+                        if (flow->bytes_to_write > 0)
+                                continue;
+                        seq_client_next(c, flow);
+                } else if (events[i].events & EPOLLIN &&
+                           c->seq->steps[flow->step].op == SEQ_RECV) {
+                        ssize_t to_read = flow->bytes_to_read;
+
+                        if (to_read > c->buf_len)
+                                to_read = c->buf_len;
+                        num_bytes = do_read(ss, c->ops, flow->fd, c->buf,
+                                            to_read, 0);
+                        if (num_bytes == -1) {
+                                PLOG_ERROR(cb, "read");
+                                continue;
+                        }
+                        if (num_bytes == 0) {
+                                seq_client_drop(c, flow);
+                                continue;
+                        }
+                        t->bytes_read += num_bytes;
+                        flow->bytes_read += num_bytes;
+                        flow->bytes_to_read -= num_bytes;
+                        if (flow->bytes_to_read > 0)
+                                continue;
+                        /* A response, timed from the last send step */
+                        t->transactions++;
+                        flow->transactions++;
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                        latency = seconds_between(&flow->write_time, &now);
+                        numlist_add(flow->latency, latency);
+                        script_slave_transaction_hook(ss, flow->id, latency);
+                        interval_collect(flow, t);
+                        seq_client_next(c, flow);
+                }
+        }
+}
+
+void run_sequence_client(struct thread *t, const struct socket_ops *ops)
+{
+        struct script_slave *ss = t->script_slave;
+        struct options *opts = t->opts;
+        struct callbacks *cb = t->cb;
+        struct epoll_event *events;
+        struct flow *flow, *stop_fl;
+        struct seq_client c = {
+                .t = t,
+                .ops = ops,
+                .seq = thread_sequence(t),
+                .num_flows = flows_in_thread(opts->num_flows,
+                                             opts->num_threads, t->index),
+                .buf_len = buf_size(t),
+        };
+        int i;
+
+        assert(c.seq);
+        t->ops = ops;
+        if (t->rb)
+                LOG_FATAL(cb, "--rebalance doesn't support sequences");
+
+        c.flows = calloc(c.num_flows, sizeof(*c.flows));
+        if (!c.flows)
+                PLOG_FATAL(cb, "alloc flows array");
+
+        LOG_INFO(cb, "flows_in_this_thread=%d", c.num_flows);
+        c.epfd = epoll_create1(0);
+        if (c.epfd == -1)
+                PLOG_FATAL(cb, "epoll_create1");
+        stop_fl = addflow_lite(c.epfd, t->stop_efd, EPOLLIN, cb);
+        for (i = 0; i < c.num_flows; i++) {
+                int fd = client_connect(t, ops);
+
+                setup_connected_socket(fd, opts, cb);
+                flow = addflow(t->index, c.epfd, fd, t->next_flow_id++, 0,
+                               cb);
+                flow->itv = interval_create(opts->interval, t);
+                c.flows[i] = flow;
+        }
+
+        events = calloc(opts->maxevents, sizeof(struct epoll_event));
+        c.buf = buf_alloc(t);
+        if (!c.buf)
+                PLOG_FATAL(cb, "buf_alloc");
+        thread_wait_start(t);
+        for (i = 0; i < c.num_flows; i++)
+                seq_client_enter(&c, c.flows[i]);
+        while (!t->stop) {
+                int ms = seq_client_wake(&c);
+                int nfds;
+
+                if (opts->nonblocking && (ms < 0 || ms > 10))
+                        ms = 10; /* milliseconds */
+                nfds = do_epoll_wait(ops, c.epfd, events, opts->maxevents, ms);
+                if (nfds == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        PLOG_FATAL(cb, "epoll_wait");
+                }
+                seq_client_events(&c, events, nfds);
+        }
+
+        for (i = 0; i < c.num_flows; i++) {
+                flow = c.flows[i];
+                if (!flow)
+                        continue;
+                epoll_del_or_err(c.epfd, flow->fd, cb);
+                if (do_socket_close(ops, ss, flow->fd, t->ai) < 0)
+                        /* XXX: ignore errors */ ;
+                interval_destroy(flow->itv);
+                numlist_destroy(flow->latency);
+                free(flow);
+        }
+
+        free(c.buf);
+        free(c.flows);
+        free(events);
+        free(stop_fl);
+        do_close(c.epfd);
+}
+
+/* Skips think steps, which only the client runs.  Returns the events to wait
+ * for next.
+ */
+static uint32_t seq_server_enter(const struct sequence *seq, struct flow *flow)
+{
+        const struct seq_step *s;
+
+        while ((s = &seq->steps[flow->step])->op == SEQ_THINK)
+                seq_advance(seq, flow);
+
+        if (s->op == SEQ_SEND) {
+                flow->bytes_to_read = s->arg;
+                return EPOLLRDHUP | EPOLLIN;
+        }
+        flow->bytes_to_write = s->arg;
+        return EPOLLRDHUP | EPOLLOUT;
+}
+
+void sequence_server_accept(struct thread *t, int fd_listen, int epfd,
+                            uint32_t flags)
+{
+        struct options *opts = t->opts;
+        struct callbacks *cb = t->cb;
+        struct sockaddr_storage cli_addr;
+        struct flow *flow;
+        socklen_t cli_len;
+        int client;
+
+        cli_len = sizeof(cli_addr);
+        client = socket_accept(t->ops, fd_listen, (struct sockaddr *)&cli_addr,
+                               &cli_len);
+        if (client == -1) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                        return;
+                PLOG_ERROR(cb, "accept");
+                return;
+        }
+        setup_connected_socket(client, opts, cb);
+
+        flow = addflow(t->index, epfd, client, t->next_flow_id++, flags, cb);
+        flow->itv = interval_create(opts->interval, t);
+        if (modflow(epfd, flow,
+                    seq_server_enter(thread_sequence(t), flow) | flags))
+                PLOG_FATAL(cb, "epoll_ctl");
+}
+
+uint32_t sequence_server_flow(struct thread *t, int epfd, struct flow *flow,
+                              uint32_t events, char *buf)
+{
+        const struct sequence *seq = thread_sequence(t);
+        struct script_slave *ss = t->script_slave;
+        const size_t buf_len = buf_size(t);
+        struct callbacks *cb = t->cb;
+        ssize_t num_bytes;
+
+        if (events & EPOLLRDHUP) {
+                delflow(t->index, epfd, flow, cb);
+                return 0;
+        }
+        if (events & EPOLLIN && seq->steps[flow->step].op == SEQ_SEND) {
+                ssize_t to_read = flow->bytes_to_read;
+
+                if (to_read > buf_len)
+                        to_read = buf_len;
+                num_bytes = do_read(ss, t->ops, flow->fd, buf, to_read,
+                                    0);
+                if (num_bytes == -1) {
+                        PLOG_ERROR(cb, "read");
+                        return flow->events;
+                }
+                if (num_bytes == 0) {
+                        delflow(t->index, epfd, flow, cb);
+                        return 0;
+                }
+                t->bytes_read += num_bytes;
+                flow->bytes_read += num_bytes;
+                flow->bytes_to_read -= num_bytes;
+                if (flow->bytes_to_read > 0)
+                        return flow->events;
+        } else if (events & EPOLLOUT && seq->steps[flow->step].op == SEQ_RECV) {
+                ssize_t to_write = flow->bytes_to_write;
+                int flags = 0;
+
+                if (to_write > buf_len) {
+                        to_write = buf_len;
+                        flags |= MSG_MORE;
+                }
+                num_bytes = do_write(ss, t->ops, flow->fd, buf, to_write,
+                                     flags);
+                if (num_bytes == -1) {
+                        PLOG_ERROR(cb, "write");
+                        return flow->events;
+                }
+                flow->bytes_to_write -= num_bytes;
+                if (flow->bytes_to_write > 0)
+                        return flow->events;
+                t->transactions++;
+                flow->transactions++;
+                script_slave_transaction_hook(ss, flow->id, NAN);
+                interval_collect(flow, t);
+        } else {
+                return flow->events;
+        }
+        seq_advance(seq, flow);
+        return seq_server_enter(seq, flow);
+}
+
+void sequence_server_events(struct thread *t, int epfd,
+                            struct epoll_event *events, int nfds,
+                            int fd_listen, char *buf)
+{
+        struct callbacks *cb = t->cb;
+        struct flow *flow;
+        uint32_t next;
+        int i;
+
+        for (i = 0; i < nfds; i++) {
+                flow = events[i].data.ptr;
+                if (flow->fd == t->stop_efd) {
+                        t->stop = 1;
+                        break;
+                }
+                if (flow->fd == fd_listen) {
+                        sequence_server_accept(t, fd_listen, epfd, 0);
+                        continue;
+                }
+                next = sequence_server_flow(t, epfd, flow, events[i].events,
+                                            buf);
+                if (next && next != flow->events && modflow(epfd, flow, next)) {
+                        /* not necessarily fatal, just drop */
+                        delflow(t->index, epfd, flow, cb);
+                }
+        }
+}
+
 static void collect_samples(const struct thread *threads, int num_threads,
                             struct sample **samples_p, int *num_samples_p)
 {
@@ -328,14 +816,18 @@ static void collect_samples(const struct thread *threads, int num_threads,
 
         num_samples = 0;
         for (i = 0; i < num_threads; i++) {
-                LIST_FOR_EACH(threads[i].samples, s)
-                        num_samples++;
+                LIST_FOR_EACH(threads[i].samples, s) {
+                        if (sample_in_window(s, threads[i].window_end))
+                                num_samples++;
+                }
         }
 
         samples = calloc(num_samples, sizeof(*samples));
         for (i = 0, j = 0; i < num_threads; i++) {
-                LIST_FOR_EACH(threads[i].samples, s)
-                        samples[j++] = *s;
+                LIST_FOR_EACH(threads[i].samples, s) {
+                        if (sample_in_window(s, threads[i].window_end))
+                                samples[j++] = *s;
+                }
         }
         qsort(samples, num_samples, sizeof(*samples), compare_samples);
 
@@ -357,7 +849,6 @@ void calculate_stream_stats(const struct thread *threads, int num_threads,
         double throughput;
         double correlation_coefficient;
         double sum_xy, sum_xx, sum_yy;
-        struct sample *s;
         int flow_id;
         int tid;
         int i, j;
@@ -377,9 +868,11 @@ void calculate_stream_stats(const struct thread *threads, int num_threads,
         per_flow = calloc(num_threads, sizeof(*per_flow));
         for (i = 0; i < num_threads; i++) {
                 int max_flow_id = 0;
-                LIST_FOR_EACH(threads[i].samples, s) {
-                        if (s->flow_id > max_flow_id)
-                                max_flow_id = s->flow_id;
+                /* Flows may be sampled by threads other than their own. */
+                for (j = 0; j < num_samples; j++) {
+                        if (samples[j].tid % num_threads == i &&
+                            samples[j].flow_id > max_flow_id)
+                                max_flow_id = samples[j].flow_id;
                 }
                 per_flow[i] = calloc(max_flow_id + 1, sizeof(*per_flow[i]));
         }
@@ -444,11 +937,44 @@ static void print_throughput_per_thread(const struct callbacks *cb,
         }
 }
 
+void print_throughput_per_node(const struct callbacks *cb,
+                               const struct thread *threads, int num_threads,
+                               const double *per_thread, const char *name)
+{
+        int i, node, max_node = -1;
+
+        for (i = 0; i < num_threads; i++) {
+                if (threads[i].node > max_node)
+                        max_node = threads[i].node;
+        }
+        for (node = 0; node <= max_node; node++) {
+                CLEANUP(free) char *key = NULL;
+                double tput = 0.0;
+                int n = 0;
+
+                for (i = 0; i < num_threads; i++) {
+                        if (threads[i].node == node) {
+                                tput += per_thread[i];
+                                n++;
+                        }
+                }
+                if (!n)
+                        continue;
+                if (asprintf(&key, "%s_node[%d]", name, node) == -1)
+                        PLOG_FATAL(cb, "asprintf");
+                PRINT(cb, key, "%.2f", tput);
+        }
+}
+
 static void print_stream_stats(const struct callbacks *cb,
+                               const struct thread *threads,
                                const struct stats *stats,
                                const struct stats *per_thread,
                                int num_threads)
 {
+        CLEANUP(free) double *tput = NULL;
+        int i;
+
         if (stats->num_samples == 0) {
                 LOG_WARN(cb, "no samples collected");
                 return;
@@ -460,6 +986,14 @@ static void print_stream_stats(const struct callbacks *cb,
         PRINT(cb, "num_samples", "%d", stats->num_samples);
         PRINT(cb, "throughput_Mbps", "%.2f", stats->throughput * 8 / 1e6);
         print_throughput_per_thread(cb, per_thread, num_threads);
+
+        tput = calloc(num_threads, sizeof(*tput));
+        if (tput) {
+                for (i = 0; i < num_threads; i++)
+                        tput[i] = per_thread[i].throughput * 8 / 1e6;
+                print_throughput_per_node(cb, threads, num_threads, tput,
+                                          "throughput_Mbps");
+        }
         PRINT(cb, "correlation_coefficient", "%.2f",
               stats->correlation_coefficient);
         PRINT(cb, "time_end", "%ld.%09ld",
@@ -491,7 +1025,7 @@ void report_stream_stats(struct thread *threads)
                 LOG_FATAL(cb, "failed to calculate per thread stats (%d)",
                           num_stats);
         }
-        print_stream_stats(cb, &stats, stats_per_thread, num_stats);
+        print_stream_stats(cb, threads, &stats, stats_per_thread, num_stats);
 
         if (samples_file)
                 print_samples(0, samples, stats.num_samples, samples_file, cb);
@@ -29,7 +29,9 @@ struct addrinfo;
 struct epoll_event;
 
 struct callbacks;
+struct flow;
 struct options;
+struct sample;
 struct thread;
 
 /* Set of all possible socket operations. open() is mandatory, rest is optional. */
@@ -43,6 +45,36 @@ struct socket_ops {
 
         /* For dummy/fake workloads only. Defaults to epoll_wait(2) if not set. */
         int (*epoll_wait)(int epfd, struct epoll_event *events, int maxevents, int timeout);
+
+        /* For transports other than kernel sockets, see do_read()/do_write().
+         * Default to read(2)/write(2) through the script's hooks if not set.
+         */
+        ssize_t (*read)(int sockfd, void *buf, size_t len);
+        ssize_t (*write)(int sockfd, const void *buf, size_t len);
+};
+
+/*
+ * Message sequence a script declares with sequence(), compiled into steps
+ * the client and server event loops below walk through for each flow.
+ * Steps are from the client's point of view, the server mirrors them.
+ */
+enum seq_op {
+        SEQ_SEND,       /* client sends arg bytes, server reads them */
+        SEQ_RECV,       /* server sends arg bytes, client reads them */
+        SEQ_THINK,      /* client pauses for arg microseconds */
+};
+
+struct seq_step {
+        uint32_t op;
+        uint32_t arg;
+};
+
+struct sequence {
+        unsigned long reuse;    /* loops per connection, 0 if unlimited */
+        uint32_t max_msg;       /* largest send/recv step */
+        int loop_start;         /* first step after the setup ones */
+        int num_steps;
+        struct seq_step steps[];
 };
 
 /* Statistics we calculate from a set of samples for stream workloads. */
@@ -60,12 +92,42 @@ extern const struct socket_ops tcp_socket_ops;
 /* Operations for connected UDP sockets. */
 extern const struct socket_ops udp_socket_ops;
 
+/* Operations for in-memory connections, see null_transport.h. */
+extern const struct socket_ops null_socket_ops;
+
 /* Callback invoked from main thread loop for processing socket events. */
 typedef void (*process_events_t)(struct thread *t, int epoll_fd,
                                  struct epoll_event *events, int nfds,
                                  int listen_fd, char *buf);
 
 
+/* Callback for thread pool servers accepting a connection on listen_fd.  The
+ * new flow is added to epoll set epfd with flags added to its events.
+ */
+typedef void (*accept_flow_t)(struct thread *t, int listen_fd, int epfd,
+                              uint32_t flags);
+
+/* Callback for thread pool servers processing events of a single flow.
+ * Returns the events the flow waits for next, or 0 if it has been deleted.
+ */
+typedef uint32_t (*process_flow_t)(struct thread *t, int epfd,
+                                   struct flow *flow, uint32_t events,
+                                   char *buf);
+
+/* Accept a connection, through socket operations if they provide accept() */
+int socket_accept(const struct socket_ops *ops, int sockfd,
+                  struct sockaddr *addr, socklen_t *addrlen);
+
+/* Wait for events, through socket operations if they provide epoll_wait() */
+int do_epoll_wait(const struct socket_ops *ops, int epfd,
+                  struct epoll_event *events, int maxevents, int timeout);
+
+/* Size of the buffer threads send/receive through, see buf_alloc() */
+size_t buf_size(struct thread *t);
+
+/* Allocate and initialize a buffer big enough for sending/receiving */
+void *buf_alloc(struct thread *t);
+
 /* Convert run-time options to a set of epoll events */
 uint32_t epoll_events(struct options *opts);
 
@@ -76,6 +138,26 @@ void setup_connected_socket(int fd, struct options *opts, struct callbacks *cb);
 void run_client(struct thread *t, const struct socket_ops *ops,
                 process_events_t process_events);
 
+/* Sequence the thread's script declared, if any */
+const struct sequence *thread_sequence(struct thread *t);
+
+/* Main routine for client threads running a sequence */
+void run_sequence_client(struct thread *t, const struct socket_ops *ops);
+
+/* Server callbacks running a sequence, for run_server() and the pool */
+void sequence_server_events(struct thread *t, int epfd,
+                            struct epoll_event *events, int nfds,
+                            int fd_listen, char *buf);
+void sequence_server_accept(struct thread *t, int fd_listen, int epfd,
+                            uint32_t flags);
+uint32_t sequence_server_flow(struct thread *t, int epfd, struct flow *flow,
+                              uint32_t events, char *buf);
+
+/* Create a bound, listening socket for server thread t */
+int server_socket_open(struct thread *t, const struct socket_ops *ops);
+void server_socket_close(struct thread *t, const struct socket_ops *ops,
+                         int fd_listen);
+
 /* Main routine for server threads, both stream & request/response workloads */
 void run_server(struct thread *t, const struct socket_ops *ops,
                 process_events_t process_events);
@@ -88,6 +170,13 @@ void run_server(struct thread *t, const struct socket_ops *ops,
 void calculate_stream_stats(const struct thread *threads, int num_threads,
                             struct stats *stats, struct sample **samples_);
 
+/* Sum up per-thread throughput by the NUMA node threads were pinned to and
+ * print it as <name>_node[N].  Prints nothing if threads weren't pinned.
+ */
+void print_throughput_per_node(const struct callbacks *cb,
+                               const struct thread *threads, int num_threads,
+                               const double *per_thread, const char *name);
+
 /* Calculate and print out statistics for a stream workload */
 void report_stream_stats(struct thread *tinfo);
 